@@ -0,0 +1,350 @@
+// benchmark.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of the main operations of "wvewht" on a word vector file (e.g.
+// one written by "generate_word_vectors"): loading "HashTableOnMemory",
+// looking words up, the similarity kernels, writing hash table files and
+// reading word vectors with "HashTableReader". Every benchmark is repeated and
+// the median is written as a tab-separated line (after a header line and some
+// lines starting with '#' describing the run), so that the results of two
+// versions can be compared with "diff" or any spreadsheet; the progress is
+// written to the standard error output.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+#include "../src/wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+namespace {
+
+const int kDefaultNumOfRepetitions = 3;
+const int kNumOfKernelVectors = 1024; // the similarity kernels are run on pairs of these vectors (small enough to stay in the cache)
+const long long kNumOfKernelValues = 1LL << 24; // the number of values (of both vectors) processed per repetition of a kernel benchmark
+const size_t kMaxNumOfReaderQueries = 20000;
+const char* const kNamesOfKernels[] = {"scalar", "sse2", "avx2", "avx512"};
+const int kOddKernelVectorSize = 300; // the kernels are run on this size as well (a common size that is not a multiple of 16, so that their scalar tails are measured)
+
+volatile double sink; // keeps the compiler from dropping the benchmarked calls
+
+class NullBuffer : public std::streambuf {
+// Stream buffer discarding everything written to it (used for the messages of
+// the benchmarked classes).
+ protected:
+  int overflow(int character) override {
+    return character;
+  }
+};
+
+class Random {
+// SplitMix64 (Steele et al., 2014), so that the benchmarks use the same words
+// on every machine.
+ public:
+  Random(const uint64_t seed)
+      : state_(seed) {}
+
+  uint64_t GetNext() {
+    uint64_t value = (state_ += 0x9e3779b97f4a7c15ULL);
+    value = (value^(value >> 30))*0xbf58476d1ce4e5b9ULL;
+    value = (value^(value >> 27))*0x94d049bb133111ebULL;
+    return value^(value >> 31);
+  }
+
+  double GetUniform() {
+  // Returns a number in [0, 1).
+    return (GetNext() >> 11)*(1.0/9007199254740992.0);
+  }
+
+ private:
+  uint64_t state_;
+};
+
+class Benchmarks {
+// Runs benchmarks and writes their results to "out".
+ public:
+  Benchmarks(std::ostream& out, const int num_of_repetitions)
+      : out_(out),
+        num_of_repetitions_(num_of_repetitions) {
+    out_ << "benchmark\toperations\tmedian_seconds\tns_per_operation\toperations_per_second\n";
+  }
+
+  void Run(const std::string& name, const long long num_of_operations, const std::function<void()>& function, const std::function<void()>& preparation = nullptr) {
+  // Calls "function" (doing "num_of_operations" operations) repeatedly - after
+  // "preparation", which is not measured - and writes the median time.
+    std::vector<double> seconds;
+    for (int i = 0; i < num_of_repetitions_; ++i) {
+      if (preparation)
+        preparation();
+      const auto start = std::chrono::steady_clock::now();
+      function();
+      seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count());
+    }
+    std::sort(seconds.begin(), seconds.end());
+    const double median = (seconds.size()%2 == 1)? seconds[seconds.size()/2] : (seconds[seconds.size()/2-1]+seconds[seconds.size()/2])/2;
+    char result[128];
+    snprintf(result, sizeof(result), "\t%lld\t%.6f\t%.1f\t%.1f\n", num_of_operations, median, 1e9*median/num_of_operations, (median > 0)? num_of_operations/median : 0.0);
+    out_ << name << result;
+    out_.flush();
+    std::cerr << "\t" << name << ": " << 1e9*median/num_of_operations << " ns per operation" << std::endl;
+  }
+
+ private:
+  std::ostream& out_;
+  const int num_of_repetitions_;
+};
+
+std::vector<std::string> ReadWords(const std::string& word_vector_file, int& vector_size) {
+// Returns the words of "word_vector_file" (the first field of every line) and
+// sets "vector_size" to the number of values of the first line.
+  std::ifstream file_stream(word_vector_file);
+  std::vector<std::string> words;
+  std::string line;
+  vector_size = 0;
+  while (std::getline(file_stream, line)) {
+    if (line.empty())
+      continue;
+    words.push_back(line.substr(0, line.find(' ')));
+    if (words.size() == 1) {
+      std::stringstream stream(line.substr(words[0].size()));
+      for (double value; stream >> value;)
+        ++vector_size;
+    }
+  }
+  return words;
+}
+
+void Shuffle(std::vector<std::string>& words, Random& random) {
+// Shuffles "words" (Fisher-Yates).
+  for (size_t i = words.size(); i > 1; --i)
+    std::swap(words[i-1], words[random.GetNext()%i]);
+}
+
+void RunKernelBenchmarks(Benchmarks& benchmarks, const int vector_size, Random& random, const std::string& suffix = "") {
+// Benchmarks all similarity kernels the CPU supports on "vector_size"
+// dimensions ("suffix" is appended to the names of the benchmarks); the
+// kernels selected at startup are selected again afterwards.
+  const std::string default_kernels = kSimilarityKernels.name;
+  const size_t num_of_values = (size_t) kNumOfKernelVectors*vector_size;
+  std::vector<double> doubles(num_of_values);
+  std::vector<float> floats(num_of_values);
+  std::vector<uint16_t> halfs(num_of_values);
+  std::vector<int8_t> int8s(num_of_values);
+  for (size_t i = 0; i < num_of_values; ++i) {
+    doubles[i] = 2.0*random.GetUniform()-1.0;
+    floats[i] = doubles[i];
+    halfs[i] = ConvertToHalf(floats[i]);
+    int8s[i] = (int8_t) std::lround(127*doubles[i]);
+  }
+  const long long num_of_operations = std::max(1LL, kNumOfKernelValues/(2*vector_size));
+  for (auto name : kNamesOfKernels) {
+    if (!SelectSimilarityKernels(name))
+      continue;
+    const std::string prefix = std::string("kernel_")+name+"_";
+    auto run = [&](const std::string& kernel, const std::function<double(size_t offset_0, size_t offset_1)>& function) {
+      benchmarks.Run(prefix+kernel+suffix, num_of_operations, [&] {
+        double sum = 0;
+        for (long long i = 0; i < num_of_operations; ++i)
+          sum += function((size_t) (i%kNumOfKernelVectors)*vector_size, (size_t) ((i*7+1)%kNumOfKernelVectors)*vector_size);
+        sink = sum;
+      });
+    };
+    run("dot_product_f64", [&](size_t offset_0, size_t offset_1) { return kSimilarityKernels.dot_product_f64(&doubles[offset_0], &doubles[offset_1], vector_size); });
+    run("squared_distance_f64", [&](size_t offset_0, size_t offset_1) { return kSimilarityKernels.squared_distance_f64(&doubles[offset_0], &doubles[offset_1], vector_size); });
+    run("dot_product_f32", [&](size_t offset_0, size_t offset_1) { return kSimilarityKernels.dot_product_f32(&floats[offset_0], &floats[offset_1], vector_size); });
+    run("squared_distance_f32", [&](size_t offset_0, size_t offset_1) { return kSimilarityKernels.squared_distance_f32(&floats[offset_0], &floats[offset_1], vector_size); });
+    run("dot_product_f16", [&](size_t offset_0, size_t offset_1) { return kSimilarityKernels.dot_product_f16(&halfs[offset_0], &halfs[offset_1], vector_size); });
+    run("dot_product_i8", [&](size_t offset_0, size_t offset_1) { return kSimilarityKernels.dot_product_i8(&int8s[offset_0], &int8s[offset_1], vector_size); });
+  }
+  SelectSimilarityKernels(default_kernels);
+}
+
+bool GetIntegerOption(std::map<std::string, std::string>& options, const std::string& name, const int min_value, const int max_value, int& value) {
+// Sets "value" to the value of the option "name" if it is given and returns
+// "false" (after showing an error) if that is no integer from "min_value" to
+// "max_value" (see "NumericOptionsAreValid()" of "main.cc").
+  auto given_option = options.find(name);
+  if (given_option == options.end())
+    return true;
+  const std::string& text = given_option->second;
+  char* end;
+  errno = 0;
+  const long long parsed_value = strtoll(text.c_str(), &end, 10);
+  if (text.empty() || isspace((unsigned char) text[0]) || *end != '\0' || errno == ERANGE || parsed_value < min_value || parsed_value > max_value) {
+    std::cout << "ERROR: INVALID VALUE \"" << text << "\" OF \"--" << name << "\" - it must be an integer from " << min_value << " to " << max_value << "!\n";
+    return false;
+  }
+  value = parsed_value;
+  return true;
+}
+
+void RemoveHashTableFile(const std::string& hash_table_file) {
+// Removes a hash table file written by a benchmark and its companion files.
+  for (auto extension : {"", kOffsetIndexExtension.c_str(), kMinimalPerfectHashExtension.c_str()})
+    std::remove((hash_table_file+extension).c_str());
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+// Arguments: the word vector file the benchmarks are run on.
+// Options:
+//  --repetitions=N: the number of times every benchmark is run (default: 3).
+//  --threads=N: the number of threads used for loading and batch comparisons
+//   (default: as many as the hardware supports).
+//  --output=FILE: the file the results are written to (default: the standard
+//   output).
+//  --verbose: the messages of the benchmarked classes are written to the
+//   standard error output instead of being discarded.
+  std::string word_vector_file;
+  std::map<std::string, std::string> options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string argument = argv[i];
+    const size_t equals_sign = argument.find('=');
+    if (argument.compare(0, 2, "--") == 0)
+      options[argument.substr(2, equals_sign-2)] = (equals_sign == std::string::npos)? "" : argument.substr(equals_sign+1);
+    else
+      word_vector_file = argument;
+  }
+  int num_of_repetitions = kDefaultNumOfRepetitions, num_of_threads = 0;
+  if (word_vector_file.empty() || !GetIntegerOption(options, "repetitions", 1, 1000000, num_of_repetitions) || !GetIntegerOption(options, "threads", 0, 4096, num_of_threads)) {
+    std::cout << "Style of usage:\n\t./benchmark WORD_VECTOR_FILE [--repetitions=N] [--threads=N] [--output=FILE]\n";
+    return -1;
+  }
+  std::ofstream output_file_stream;
+  if (options.count("output")) {
+    output_file_stream.open(options["output"], std::ios_base::trunc);
+    if (!output_file_stream.is_open()) {
+      std::cout << "ERROR: OPENING \"" << options["output"] << "\" FAILED!\n";
+      return -1;
+    }
+  }
+  std::ostream standard_output(std::cout.rdbuf());
+  std::ostream& out = options.count("output")? output_file_stream : standard_output;
+  NullBuffer null_buffer;
+  std::cout.rdbuf(options.count("verbose")? std::cerr.rdbuf() : &null_buffer); // the standard output is reserved for the results
+  ThreadPool thread_pool(num_of_threads);
+  Random random(1);
+  int vector_size;
+  std::vector<std::string> words = ReadWords(word_vector_file, vector_size);
+  if (words.empty()) {
+    std::cerr << "ERROR: READING \"" << word_vector_file << "\" FAILED!\n";
+    return -1;
+  }
+  Shuffle(words, random);
+  std::vector<std::string> unknown_words(words);
+  for (auto& word : unknown_words)
+    word += '#';
+  std::unique_ptr<HashTableOnMemory> hash_table;
+  out << "# file=" << word_vector_file << " file_size=" << HashTable::GetFileSize(word_vector_file) << " words=" << words.size() << " dimensions=" << vector_size << '\n';
+  out << "# kernels=" << kSimilarityKernels.name << " threads=" << thread_pool.GetNumOfThreads() << " repetitions=" << num_of_repetitions << '\n';
+  Benchmarks benchmarks(out, num_of_repetitions);
+  benchmarks.Run("hash_table_on_memory_load", words.size(), [&] {
+    hash_table.reset(new HashTableOnMemory(word_vector_file, thread_pool));
+  }, [&] {
+    hash_table.reset();
+  });
+  if (!hash_table->HashTableIsValid()) {
+    std::cerr << "ERROR: LOADING \"" << word_vector_file << "\" FAILED!\n";
+    return -1;
+  }
+  benchmarks.Run("hash_table_on_memory_lookup_hit", words.size(), [&] {
+    long long sum = 0;
+    for (auto& word : words)
+      sum += hash_table->GetRow(word);
+    sink = sum;
+  });
+  benchmarks.Run("hash_table_on_memory_lookup_miss", unknown_words.size(), [&] {
+    long long sum = 0;
+    for (auto& word : unknown_words)
+      sum += hash_table->GetRow(word);
+    sink = sum;
+  });
+  benchmarks.Run("hash_table_on_memory_get_vector_hit", words.size(), [&] {
+    double norm, sum = 0;
+    for (auto& word : words)
+      sum += hash_table->GetVectorOfWord(word, norm).size();
+    sink = sum;
+  });
+  std::vector<std::pair<unsigned, unsigned>> pairs_of_rows(words.size());
+  std::string word_pairs;
+  for (auto& pair_of_rows : pairs_of_rows) {
+    pair_of_rows = {random.GetNext()%words.size(), random.GetNext()%words.size()};
+    word_pairs += words[pair_of_rows.first]+'\t'+words[pair_of_rows.second]+'\n';
+  }
+  benchmarks.Run("hash_table_on_memory_similarity", pairs_of_rows.size(), [&] {
+    double cosine_similarity, euclidean_distance, sum = 0;
+    for (auto& pair_of_rows : pairs_of_rows) {
+      hash_table->GetSimilarityOfRows(pair_of_rows.first, pair_of_rows.second, cosine_similarity, euclidean_distance);
+      sum += cosine_similarity;
+    }
+    sink = sum;
+  });
+  benchmarks.Run("hash_table_on_memory_batch_comparison", pairs_of_rows.size(), [&] {
+    std::stringstream in(word_pairs), results;
+    hash_table->CompareWordPairs(in, results, thread_pool);
+    sink = results.str().size();
+  });
+  hash_table.reset();
+  RunKernelBenchmarks(benchmarks, vector_size, random);
+  if (vector_size != kOddKernelVectorSize)
+    RunKernelBenchmarks(benchmarks, kOddKernelVectorSize, random, "_"+std::to_string(kOddKernelVectorSize)+"d");
+  const std::string hash_table_file = word_vector_file+".bench.csv";
+  HashTableWriterOptions writer_options;
+  writer_options.minimal_perfect_hash = true;
+  benchmarks.Run("hash_table_writer_mph", words.size(), [&] {
+    HashTableWriter hash_table_writer(word_vector_file, hash_table_file, writer_options);
+  }, [&] {
+    RemoveHashTableFile(hash_table_file);
+  });
+  writer_options.minimal_perfect_hash = false;
+  benchmarks.Run("hash_table_writer", words.size(), [&] {
+    HashTableWriter hash_table_writer(word_vector_file, hash_table_file, writer_options);
+  }, [&] {
+    RemoveHashTableFile(hash_table_file);
+  });
+  // The reader benchmarks look up one word per query (as the interactive
+  // comparison does): random words without cache, unknown words and words
+  // drawn from a Zipf-like distribution (the rank is log-uniform) with the
+  // default cache, which starts empty in every repetition.
+  const size_t num_of_queries = std::min(words.size(), kMaxNumOfReaderQueries);
+  std::vector<std::string> zipf_words(num_of_queries);
+  for (auto& word : zipf_words)
+    word = words[std::min<size_t>(words.size()-1, std::exp(random.GetUniform()*std::log((double) words.size()+1))-1)];
+  std::unique_ptr<HashTableReader> hash_table_reader;
+  HashTableReaderOptions reader_options;
+  auto run_reader_benchmark = [&](const std::string& name, const std::vector<std::string>& queries) {
+    benchmarks.Run(name, num_of_queries, [&] {
+      std::unordered_map<std::string, std::pair<std::vector<double>, double>> vectors;
+      for (size_t i = 0; i < num_of_queries; ++i)
+        hash_table_reader->FetchVectors(std::vector<std::string>(1, queries[i]), vectors);
+      sink = vectors.size();
+    }, [&] {
+      hash_table_reader.reset(new HashTableReader(hash_table_file, reader_options));
+    });
+  };
+  reader_options.vector_cache_size = 0;
+  run_reader_benchmark("hash_table_reader_fetch_hit", words);
+  run_reader_benchmark("hash_table_reader_fetch_miss", unknown_words);
+  reader_options.vector_cache_size = HashTableReaderOptions().vector_cache_size;
+  run_reader_benchmark("hash_table_reader_fetch_zipf_cached", zipf_words);
+  hash_table_reader.reset();
+  RemoveHashTableFile(hash_table_file);
+  return 0;
+}
@@ -0,0 +1,130 @@
+// generate_word_vectors.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Writes a synthetic word vector file for the benchmarks (see "benchmark.cc"):
+// one line per word, the word followed by its values. The file only depends
+// on the options (the random numbers are generated by SplitMix64 and no
+// distribution of the standard library is used), so that the same file is
+// generated on every machine.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_set>
+
+namespace {
+
+class Random {
+// SplitMix64 (Steele et al., 2014).
+ public:
+  Random(const uint64_t seed)
+      : state_(seed) {}
+
+  uint64_t GetNext() {
+    uint64_t value = (state_ += 0x9e3779b97f4a7c15ULL);
+    value = (value^(value >> 30))*0xbf58476d1ce4e5b9ULL;
+    value = (value^(value >> 27))*0x94d049bb133111ebULL;
+    return value^(value >> 31);
+  }
+
+  double GetUniform() {
+  // Returns a number in [0, 1).
+    return (GetNext() >> 11)*(1.0/9007199254740992.0);
+  }
+
+  int GetPoisson(const double mean) {
+  // Returns a Poisson-distributed number (Knuth's algorithm).
+    const double limit = std::exp(-mean);
+    double product = GetUniform();
+    int number = 0;
+    while (product > limit) {
+      ++number;
+      product *= GetUniform();
+    }
+    return number;
+  }
+
+ private:
+  uint64_t state_;
+};
+
+long long GetOption(std::map<std::string, std::string>& options, const std::string& name, const long long default_value) {
+// Returns the value of the option "name" (or "default_value" if it is missing).
+  return options.count(name)? std::stoll(options[name]) : default_value;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+// Options:
+//  --words=N: the number of (distinct) words (default: 100000).
+//  --dimensions=D: the number of values per word vector (default: 100).
+//  --min-word-length=N, --max-word-length=N, --mean-word-length=X: the
+//   lengths of the words are N_min plus a Poisson-distributed number with the
+//   mean X-N_min, limited to N_max (defaults: 2, 20 and 8).
+//  --seed=N: the seed of the random numbers (default: 1).
+  std::string output_file;
+  std::map<std::string, std::string> options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string argument = argv[i];
+    const size_t equals_sign = argument.find('=');
+    if (argument.compare(0, 2, "--") == 0 && equals_sign != std::string::npos)
+      options[argument.substr(2, equals_sign-2)] = argument.substr(equals_sign+1);
+    else
+      output_file = argument;
+  }
+  const long long num_of_words = GetOption(options, "words", 100000), num_of_dimensions = GetOption(options, "dimensions", 100);
+  const int min_word_length = std::max(1LL, GetOption(options, "min-word-length", 2)), max_word_length = std::max<long long>(min_word_length, GetOption(options, "max-word-length", 20));
+  const double mean_word_length = options.count("mean-word-length")? std::stod(options["mean-word-length"]) : 8.0;
+  if (output_file.empty() || num_of_words < 1 || num_of_dimensions < 1) {
+    std::cout << "Style of usage:\n\t./generate_word_vectors OUTPUT_FILE [--words=N] [--dimensions=D] [--min-word-length=N] [--mean-word-length=X] [--max-word-length=N] [--seed=N]\n";
+    return -1;
+  }
+  std::ofstream out(output_file, std::ios_base::trunc);
+  if (!out.is_open()) {
+    std::cout << "ERROR: OPENING \"" << output_file << "\" FAILED!\n";
+    return -1;
+  }
+  Random random(GetOption(options, "seed", 1));
+  std::unordered_set<std::string> words;
+  std::string word, line;
+  char value[16];
+  for (long long i = 0; i < num_of_words; ++i) {
+    word.assign(std::min(max_word_length, min_word_length+random.GetPoisson(std::max(0.0, mean_word_length-min_word_length))), ' ');
+    for (auto& character : word)
+      character = 'a'+random.GetNext()%26;
+    while (!words.insert(word).second) // makes the word distinct by appending letters
+      word += (char) ('a'+random.GetNext()%26);
+    line = word;
+    for (long long j = 0; j < num_of_dimensions; ++j) {
+      snprintf(value, sizeof(value), " %.6f", 2.0*random.GetUniform()-1.0);
+      line += value;
+    }
+    line += '\n';
+    out << line;
+  }
+  if (!out) {
+    std::cout << "ERROR: WRITING \"" << output_file << "\" FAILED!\n";
+    return -1;
+  }
+  std::cout << "Wrote " << num_of_words << " word vectors with " << num_of_dimensions << " dimensions to \"" << output_file << "\".\n";
+  return 0;
+}
@@ -0,0 +1,89 @@
+// batch_comparison.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+namespace {
+
+const size_t kNumOfWordPairsPerBlock = 1 << 16; // the number of lines of "word_pairs" read (and compared in parallel) at once
+const std::string kOutOfVocabulary = "OOV"; // written instead of the similarities if a word couldn't be found
+
+std::string GetFirstTwoFields(const std::string& line, std::string& word_1) {
+// Returns the first tab-separated field of "line" and writes the second one to
+// "word_1" (a line without a tab is split at its first whitespace instead).
+  size_t separator = line.find('\t');
+  if (separator == std::string::npos)
+    separator = line.find(' ');
+  if (separator == std::string::npos) {
+    word_1.clear();
+    return line;
+  }
+  const size_t end_of_word_1 = line.find_first_of("\t\r", separator+1);
+  word_1 = line.substr(separator+1, (end_of_word_1 == std::string::npos)? std::string::npos : end_of_word_1-separator-1);
+  return line.substr(0, separator);
+}
+
+} // namespace
+
+void HashTableOnMemory::CompareWordPairs(std::istream& word_pairs, std::ostream& out, ThreadPool& thread_pool) {
+// Compares the word pairs given as lines of "word_pairs" (two tab-separated
+// words per line) and writes one line per pair to "out": the two words
+// followed by their cosine similarity and their Euclidean distance (or
+// "kOutOfVocabulary" twice if at least one of the words couldn't be found),
+// all separated by tabs. The lines are processed in blocks; the pairs of a
+// block are compared on all threads of "thread_pool" and the results are
+// written in the order of "word_pairs".
+  if (!HashTableIsValid())
+    return;
+  std::vector<std::string> lines, results;
+  std::string line;
+  bool end_of_word_pairs = false;
+  while (!end_of_word_pairs) {
+    lines.clear();
+    while (lines.size() < kNumOfWordPairsPerBlock) {
+      if (!std::getline(word_pairs, line)) {
+        end_of_word_pairs = true;
+        break;
+      }
+      if (!line.empty())
+        lines.push_back(line);
+    }
+    results.assign(lines.size(), "");
+    thread_pool.ParallelFor(lines.size(), [&](size_t begin, size_t end, int) {
+      std::string word_0, word_1;
+      double cosine_similarity, euclidean_distance;
+      char similarities[64];
+      int rows[2];
+      for (size_t i = begin; i < end; ++i) {
+        word_0 = GetFirstTwoFields(lines[i], word_1);
+        rows[0] = GetRow(word_0);
+        rows[1] = GetRow(word_1);
+        if (rows[0] < 0 || rows[1] < 0)
+          results[i] = word_0+'\t'+word_1+'\t'+kOutOfVocabulary+'\t'+kOutOfVocabulary+'\n';
+        else {
+          GetSimilarityOfRows(rows[0], rows[1], cosine_similarity, euclidean_distance);
+          snprintf(similarities, sizeof(similarities), "\t%.9g\t%.9g\n", cosine_similarity, euclidean_distance);
+          results[i] = word_0+'\t'+word_1+similarities;
+        }
+      }
+    }, 4*thread_pool.GetNumOfThreads()); // more chunks than threads balance the load
+    for (auto& result : results)
+      out << result;
+  }
+  out.flush();
+}
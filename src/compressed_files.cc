@@ -0,0 +1,290 @@
+// compressed_files.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Reading compressed word vector files without decompressing them to disk:
+// gzip files are decompressed with zlib, zstd files by the external program
+// "zstd" writing to a pipe. Either way the decompressed content is produced
+// by a pipeline thread while the reader processes the blocks produced before.
+
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+extern char** environ;
+
+namespace {
+
+const size_t kSizeOfDecompressedBlocks = 1 << 20;
+const size_t kMaxNumOfDecompressedBlocks = 8; // the number of blocks the pipeline thread may decompress ahead of the reader
+const long long kEstimatedCompressionRatio = 3; // text word vectors are compressed to about a third of their size
+
+} // namespace
+
+DecompressingStreamBuffer::DecompressingStreamBuffer(const std::string& file, const Compression compression)
+    : file_(file),
+      compression_(compression),
+      is_open_(false),
+      is_finished_(false),
+      is_stopped_(false),
+      has_failed_(false),
+      position_of_current_block_(0),
+      gzip_file_(NULL),
+      pipe_of_zstd_(-1),
+      process_of_zstd_(-1) {
+  Start();
+}
+
+DecompressingStreamBuffer::~DecompressingStreamBuffer() {
+  Stop();
+}
+
+void DecompressingStreamBuffer::Start() {
+// Opens "file_" (or starts "zstd" decompressing it) and starts the pipeline
+// thread at the beginning of the decompressed content.
+  if (compression_ == kGzip) {
+    gzip_file_ = gzopen(file_.c_str(), "rb");
+    is_open_ = (gzip_file_ != NULL);
+    if (is_open_)
+      gzbuffer((gzFile) gzip_file_, 1 << 17);
+  } else {
+    int pipe_ends[2];
+    if (pipe2(pipe_ends, O_CLOEXEC) != 0) {
+      std::cout << "ERROR: CREATING A PIPE FOR \"zstd\" FAILED!\n";
+      return;
+    }
+#ifdef F_SETPIPE_SZ
+    fcntl(pipe_ends[0], F_SETPIPE_SZ, (int) kSizeOfDecompressedBlocks); // fewer context switches between "zstd" and the pipeline thread
+#endif
+    posix_spawn_file_actions_t file_actions;
+    posix_spawn_file_actions_init(&file_actions);
+    posix_spawn_file_actions_adddup2(&file_actions, pipe_ends[1], STDOUT_FILENO);
+    std::string program = "zstd", options = "-dcq", end_of_options = "--", file = file_;
+    char* arguments[] = {&program[0], &options[0], &end_of_options[0], &file[0], NULL};
+    const int error = posix_spawnp(&process_of_zstd_, "zstd", &file_actions, NULL, arguments, environ);
+    posix_spawn_file_actions_destroy(&file_actions);
+    close(pipe_ends[1]);
+    if (error != 0) {
+      std::cout << "ERROR: STARTING \"zstd\" TO DECOMPRESS \"" << file_ << "\" FAILED!\nMake sure that zstd is installed.\n";
+      close(pipe_ends[0]);
+      process_of_zstd_ = -1;
+      return;
+    }
+    pipe_of_zstd_ = pipe_ends[0];
+    is_open_ = true;
+  }
+  if (is_open_)
+    decompressor_ = std::thread(&DecompressingStreamBuffer::Decompress, this);
+}
+
+void DecompressingStreamBuffer::Stop() {
+// Stops the pipeline thread (and "zstd") and discards the decompressed
+// content, so that "Start()" can start again.
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_stopped_ = true;
+    if (process_of_zstd_ > 0)
+      kill(process_of_zstd_, SIGTERM); // the pipeline thread may wait for its output
+  }
+  block_taken_.notify_all();
+  if (decompressor_.joinable())
+    decompressor_.join();
+  if (pipe_of_zstd_ >= 0)
+    close(pipe_of_zstd_);
+  pipe_of_zstd_ = -1;
+  blocks_.clear();
+  current_block_.clear();
+  setg(NULL, NULL, NULL);
+  position_of_current_block_ = 0;
+  is_finished_ = false;
+  is_stopped_ = false;
+  has_failed_ = false;
+  is_open_ = false;
+}
+
+void DecompressingStreamBuffer::Decompress() {
+// Decompresses "file_" block by block (the function of the pipeline thread).
+// If the file is truncated or corrupt, "has_failed_" is set, so that the
+// reader does not take the end of the decompressed content for the end of the
+// file (see "underflow()").
+  std::vector<char> block;
+  bool has_failed = false;
+  if (compression_ == kGzip) {
+    gzFile gzip_file = (gzFile) gzip_file_;
+    while (true) {
+      block.resize(kSizeOfDecompressedBlocks);
+      const int size_of_block = gzread(gzip_file, block.data(), block.size());
+      int error = Z_OK;
+      gzerror(gzip_file, &error);
+      if (size_of_block > 0) { // the content decompressed before an error is kept
+        block.resize(size_of_block);
+        if (!AddBlock(block))
+          break;
+      }
+      if (error != Z_OK && error != Z_STREAM_END) { // e.g. a truncated file
+        std::cout << "ERROR: DECOMPRESSING \"" << file_ << "\" FAILED (" << gzerror(gzip_file, &error) << ")!\n";
+        has_failed = true;
+        break;
+      }
+      if (size_of_block <= 0)
+        break;
+    }
+    gzclose(gzip_file);
+    gzip_file_ = NULL;
+  } else {
+    bool is_read = false;
+    while (!is_read) {
+      // The blocks are filled completely, since reading from the pipe returns
+      // at most the size of its buffer at once.
+      block.resize(kSizeOfDecompressedBlocks);
+      size_t size_of_block = 0;
+      while (size_of_block < block.size()) {
+        const ssize_t num_of_bytes = read(pipe_of_zstd_, block.data()+size_of_block, block.size()-size_of_block);
+        if (num_of_bytes < 0 && errno == EINTR)
+          continue;
+        if (num_of_bytes <= 0) {
+          is_read = true;
+          break;
+        }
+        size_of_block += num_of_bytes;
+      }
+      block.resize(size_of_block);
+      if (!block.empty() && !AddBlock(block))
+        break;
+    }
+    int status;
+    std::lock_guard<std::mutex> lock(mutex_); // "Stop()" must not kill "zstd" after it is reaped
+    waitpid(process_of_zstd_, &status, 0);
+    if (!is_stopped_ && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+      std::cout << "ERROR: DECOMPRESSING \"" << file_ << "\" WITH \"zstd\" FAILED!\n";
+      has_failed = true;
+    }
+    process_of_zstd_ = -1;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  is_finished_ = true;
+  has_failed_ = has_failed;
+  block_added_.notify_all();
+}
+
+bool DecompressingStreamBuffer::AddBlock(std::vector<char>& block) {
+// Hands "block" over to the reader as soon as fewer than
+// "kMaxNumOfDecompressedBlocks" blocks are waiting; returns "false" if the
+// pipeline thread is stopped.
+  std::unique_lock<std::mutex> lock(mutex_);
+  block_taken_.wait(lock, [this] { return (blocks_.size() < kMaxNumOfDecompressedBlocks || is_stopped_); });
+  if (is_stopped_)
+    return false;
+  blocks_.push_back(std::move(block));
+  block = std::vector<char>();
+  block_added_.notify_one();
+  return true;
+}
+
+DecompressingStreamBuffer::int_type DecompressingStreamBuffer::underflow() {
+// Continues with the next decompressed block (waiting for the pipeline thread
+// if necessary). After the last block of a truncated or corrupt file an
+// exception is thrown instead of returning the end of the file: the
+// "std::istream" reading from this buffer catches it and sets its "badbit".
+  if (gptr() < egptr())
+    return traits_type::to_int_type(*gptr());
+  position_of_current_block_ += current_block_.size();
+  current_block_.clear();
+  setg(NULL, NULL, NULL);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    block_added_.wait(lock, [this] { return (!blocks_.empty() || is_finished_); });
+    if (blocks_.empty() && has_failed_)
+      throw std::ios_base::failure("\""+file_+"\" is corrupt");
+    if (blocks_.empty())
+      return traits_type::eof();
+    current_block_.swap(blocks_.front());
+    blocks_.pop_front();
+  }
+  block_taken_.notify_one();
+  char* begin = current_block_.data();
+  setg(begin, begin, begin+current_block_.size());
+  return traits_type::to_int_type(*gptr());
+}
+
+DecompressingStreamBuffer::pos_type DecompressingStreamBuffer::seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode mode) {
+// Only positions relative to the beginning or to the current position are
+// supported (the size of the decompressed content is not known).
+  if (direction == std::ios_base::cur)
+    return seekpos(position_of_current_block_+(gptr()-eback())+offset, mode);
+  if (direction == std::ios_base::beg)
+    return seekpos(offset, mode);
+  return pos_type(off_type(-1));
+}
+
+DecompressingStreamBuffer::pos_type DecompressingStreamBuffer::seekpos(pos_type position, std::ios_base::openmode) {
+// Seeks "position" of the decompressed content: positions behind the current
+// block are reached by skipping the blocks in between, positions in front of
+// it by decompressing the file again from its beginning.
+  const long long target = position;
+  if (target < position_of_current_block_) {
+    Stop();
+    Start();
+  }
+  while (target > position_of_current_block_+(long long) current_block_.size()) {
+    setg(eback(), egptr(), egptr());
+    if (underflow() == traits_type::eof())
+      return pos_type(off_type(-1));
+  }
+  char* begin = current_block_.data();
+  setg(begin, begin+(target-position_of_current_block_), begin+current_block_.size());
+  return position;
+}
+
+InputFileStream::InputFileStream(const std::string& file)
+    : std::istream(NULL) {
+  const Compression compression = GetCompression(file);
+  if (compression == kUncompressed) {
+    file_buffer_.open(file, std::ios_base::in|std::ios_base::binary);
+    rdbuf(&file_buffer_);
+  } else {
+    decompressing_stream_buffer_.reset(new DecompressingStreamBuffer(file, compression));
+    rdbuf(decompressing_stream_buffer_.get());
+  }
+  if (!is_open())
+    setstate(std::ios_base::failbit);
+}
+
+InputFileStream::~InputFileStream() {}
+
+Compression InputFileStream::GetCompression(const std::string& file) {
+// Returns the compression of "file" given by its magic bytes.
+  std::ifstream file_stream(file, std::ios_base::binary);
+  unsigned char magic[4] = {0, 0, 0, 0};
+  file_stream.read((char*) magic, sizeof(magic));
+  if (magic[0] == 0x1F && magic[1] == 0x8B)
+    return kGzip;
+  if (magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD)
+    return kZstd;
+  return kUncompressed;
+}
+
+long long InputFileStream::GetEstimatedSize(const std::string& file) {
+// Returns the size of "file" - or an estimate of its decompressed size if it
+// is compressed (which is not known before it is decompressed completely).
+  const long long size = HashTable::GetFileSize(file);
+  return (size > 0 && GetCompression(file) != kUncompressed)? size*kEstimatedCompressionRatio : size;
+}
@@ -0,0 +1,194 @@
+// delta_segments.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Appending word vectors to hash table files as delta segments and merging
+// the delta segments into the hash table files (see "kDeltaSegmentExtension").
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+bool HashTableWriter::CanBeAppended() {
+// Checks if the word vectors of "input_file_" can be appended to the hash
+// table file "output_file_" is a delta segment of, i.e. if that file is a hash
+// table file containing word vectors of the same size.
+  const std::string hash_table_file = output_file_.substr(0, output_file_.rfind(kDeltaSegmentExtension));
+  const int vector_size = HashTableReader::GetHashTableValues(hash_table_file)[0];
+  if (vector_size < 1) {
+    std::cout << "ERROR: APPENDING TO \"" << hash_table_file << "\" FAILED - it is no hash table file!\n";
+    return false;
+  } else if (vector_size != vector_size_) {
+    std::cout << "ERROR: APPENDING TO \"" << hash_table_file << "\" FAILED - its word vectors have " << vector_size << " dimensions!\n";
+    return false;
+  }
+  return true;
+}
+
+bool HashTableWriter::CompactHashTable(std::ofstream& out) {
+// Merges the delta segments of the hash table file "input_file_" into a fresh
+// hash table file (the word vectors of the delta segments replace those of
+// the same words in "input_file_"); only the delta segments are held on
+// memory. If "input_file_" was written with MurmurHash64A and its number of
+// buckets still keeps the load factor at most "options_.max_load_factor", the
+// buckets are merged in a single pass over "input_file_" (see
+// "MergeBuckets()"); otherwise they are rebuilt (see "RebuildBuckets()").
+  const std::vector<int> hash_table_values = HashTableReader::GetHashTableValues(input_file_);
+  std::unordered_map<std::string, std::string> word_vectors_of_segments;
+  if (!ReadDeltaSegments(word_vectors_of_segments))
+    return false;
+  // Only the words of the delta segments have to be looked up in "input_file_"
+  // to get the number of word vectors of the fresh hash table file.
+  std::vector<std::string> words;
+  for (auto& word_vector : word_vectors_of_segments)
+    words.push_back(word_vector.first);
+  std::unordered_map<std::string, std::pair<std::vector<double>, double>> vectors;
+  HashTableReaderOptions hash_table_reader_options;
+  hash_table_reader_options.vector_cache_size = 0;
+  hash_table_reader_options.read_delta_segments = false;
+  HashTableReader(input_file_, hash_table_reader_options).FetchVectors(words, vectors);
+  vector_num_ = hash_table_values[1]+words.size()-vectors.size();
+  SetHashTableSize(options_.max_load_factor);
+  if (hash_table_values[3] == kMurmurHash64 && hash_table_size_ <= hash_table_values[2]) {
+    hash_table_size_ = hash_table_values[2]; // the buckets of the word vectors do not change
+    std::cout << "\tMerging " << words.size() << " word vectors (" << words.size()-vectors.size() << " of them new) into " << hash_table_size_ << " buckets..." << std::endl;
+    WriteHeader(out);
+    MergeBuckets(out, word_vectors_of_segments);
+    return true;
+  }
+  return RebuildBuckets(out, word_vectors_of_segments);
+}
+
+bool HashTableWriter::ReadDeltaSegments(std::unordered_map<std::string, std::string>& word_vectors_of_segments) {
+// Reads the word vectors of all delta segments of "input_file_" into
+// "word_vectors_of_segments" (the word vectors of newer delta segments replace
+// those of older ones) and returns "false" if there is nothing to merge or if
+// a delta segment does not fit "input_file_".
+  const std::vector<std::string> delta_segments = GetDeltaSegments(input_file_);
+  if (delta_segments.empty()) {
+    std::cout << "\t\"" << input_file_ << "\" has no delta segments to merge.\n";
+    return false;
+  }
+  std::string line;
+  std::vector<std::string> word_vectors;
+  for (auto& delta_segment : delta_segments) {
+    std::ifstream delta_segment_stream(delta_segment, std::ios_base::binary);
+    std::getline(delta_segment_stream, line);
+    if (atoi(line.c_str()) != vector_size_) {
+      std::cout << "ERROR: THE DELTA SEGMENT \"" << delta_segment << "\" DOES NOT FIT \"" << input_file_ << "\"!\n";
+      return false;
+    }
+    while (std::getline(delta_segment_stream, line)) {
+      word_vectors.clear();
+      SplitBucketLine(line, word_vectors);
+      for (auto& word_vector : word_vectors)
+        word_vectors_of_segments[word_vector.substr(0, word_vector.find(' '))] = word_vector;
+    }
+  }
+  std::cout << "\tRead " << word_vectors_of_segments.size() << " word vectors of " << delta_segments.size() << " delta segment(s)." << std::endl;
+  return true;
+}
+
+void HashTableWriter::MergeBuckets(std::ofstream& out, const std::unordered_map<std::string, std::string>& word_vectors_of_segments) {
+// Writes the buckets of "input_file_" without the word vectors replaced by
+// the delta segments and with the word vectors of the delta segments added to
+// their buckets (which are the same as in "input_file_") - in a single pass
+// over "input_file_", whose buckets are already sorted.
+  std::map<int, std::vector<std::string>> word_vectors_of_buckets; // the word vectors of the delta segments
+  for (auto& word_vector : word_vectors_of_segments)
+    word_vectors_of_buckets[GetIndex(word_vector.first)].push_back(word_vector.second);
+  auto next_bucket = word_vectors_of_buckets.begin();
+  std::ifstream input_file_stream(input_file_, std::ios_base::binary);
+  std::string line;
+  std::getline(input_file_stream, line); // skips the first line of the hash table file, which contains no vectors
+  std::vector<std::string> word_vectors;
+  while (true) {
+    const bool line_read = static_cast<bool>(std::getline(input_file_stream, line));
+    const int bucket = line_read? atoi(line.c_str()) : hash_table_size_;
+    for (; next_bucket != word_vectors_of_buckets.end() && next_bucket->first < bucket; ++next_bucket)
+      WriteBuckets(out, next_bucket->second, next_bucket->first, next_bucket->first, true);
+    if (!line_read)
+      break;
+    word_vectors.clear();
+    SplitBucketLine(line, word_vectors);
+    word_vectors.erase(std::remove_if(word_vectors.begin(), word_vectors.end(), [&](const std::string& word_vector) {
+      return word_vectors_of_segments.count(word_vector.substr(0, word_vector.find(' '))) > 0;
+    }), word_vectors.end());
+    if (next_bucket != word_vectors_of_buckets.end() && next_bucket->first == bucket) {
+      word_vectors.insert(word_vectors.end(), next_bucket->second.begin(), next_bucket->second.end());
+      ++next_bucket;
+    }
+    if (!word_vectors.empty())
+      WriteBuckets(out, word_vectors, bucket, bucket, true);
+  }
+  num_of_empty_buckets_ = hash_table_size_;
+  for (auto num_of_buckets : num_of_buckets_per_length_)
+    num_of_empty_buckets_ -= num_of_buckets;
+}
+
+bool HashTableWriter::RebuildBuckets(std::ofstream& out, const std::unordered_map<std::string, std::string>& word_vectors_of_segments) {
+// Distributes the word vectors of "input_file_" (except those replaced by the
+// delta segments) and of the delta segments to spill files by their new
+// buckets (see "CreateHashTableWithSpillFiles()") and writes the buckets
+// afterwards.
+  const int num_of_spill_files = GetNumOfSpillFiles(GetFileSize(input_file_));
+  std::cout << "\tRebuilding the hash table file with " << hash_table_size_ << " buckets using " << num_of_spill_files << " spill files..." << std::endl;
+  std::vector<std::string> spill_files;
+  std::vector<std::ofstream> spill_file_streams;
+  if (!OpenSpillFiles(num_of_spill_files, spill_files, spill_file_streams))
+    return false;
+  std::ifstream input_file_stream(input_file_, std::ios_base::binary);
+  std::string line, word;
+  std::getline(input_file_stream, line); // skips the first line of the hash table file, which contains no vectors
+  std::vector<std::string> word_vectors;
+  while (std::getline(input_file_stream, line)) {
+    word_vectors.clear();
+    SplitBucketLine(line, word_vectors);
+    for (auto& word_vector : word_vectors) {
+      word = word_vector.substr(0, word_vector.find(' '));
+      if (!word_vectors_of_segments.count(word))
+        spill_file_streams[GetSpillFileOfBucket(GetIndex(word), num_of_spill_files)] << word_vector << '\n';
+    }
+  }
+  for (auto& word_vector : word_vectors_of_segments)
+    spill_file_streams[GetSpillFileOfBucket(GetIndex(word_vector.first), num_of_spill_files)] << word_vector.second << '\n';
+  for (auto& spill_file_stream : spill_file_streams)
+    spill_file_stream.close();
+  WriteHeader(out);
+  WriteBucketsFromSpillFiles(out, spill_files, true);
+  return true;
+}
+
+bool HashTableWriter::ReplaceHashTableFile() {
+// Replaces "input_file_" and its offset index file by the compacted hash
+// table file "output_file_" and its offset index file and removes the delta
+// segments (as well as the minimal perfect hash of "input_file_", which is not
+// needed any longer).
+  const std::vector<std::string> delta_segments = GetDeltaSegments(input_file_);
+  if (std::rename(output_file_.c_str(), input_file_.c_str()) != 0 || std::rename((output_file_+kOffsetIndexExtension).c_str(), (input_file_+kOffsetIndexExtension).c_str()) != 0) {
+    std::cout << "ERROR: REPLACING \"" << input_file_ << "\" FAILED!\n";
+    return false;
+  }
+  std::remove((input_file_+kMinimalPerfectHashExtension).c_str());
+  for (auto& delta_segment : delta_segments) {
+    for (auto& extension : {std::string(), kOffsetIndexExtension, kMinimalPerfectHashExtension})
+      std::remove((delta_segment+extension).c_str());
+  }
+  return true;
+}
@@ -0,0 +1,361 @@
+// evaluation.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Evaluation of the word vectors with standard benchmarks.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <math.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+namespace {
+
+const size_t kRowsPerTile = 64;
+const size_t kNumOfQuestionsPerScan = 512; // the number of analogy questions answered by the same scan
+const unsigned kNoAnswer = 0xFFFFFFFF;
+
+typedef std::pair<double, unsigned> Candidate; // a row and its score
+
+std::string ToLowerCase(std::string string) {
+  for (auto& character : string)
+    character = tolower(character);
+  return string;
+}
+
+void KeepBetterCandidate(Candidate& best_candidate, const Candidate& candidate) {
+// Replaces "best_candidate" by "candidate" if the latter has a higher score
+// (or the same score and a smaller row, so that the result does not depend on
+// the number of threads).
+  if (candidate.first > best_candidate.first || (candidate.first == best_candidate.first && candidate.second < best_candidate.second))
+    best_candidate = candidate;
+}
+
+std::vector<double> GetRanks(const std::vector<double>& values) {
+// Returns the ranks of the "values" (1 = the smallest value); tied values get
+// the average of their ranks.
+  std::vector<unsigned> order(values.size());
+  for (unsigned i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&values](const unsigned i, const unsigned j) { return values[i] < values[j]; });
+  std::vector<double> ranks(values.size());
+  for (size_t first = 0, last; first < order.size(); first = last) {
+    for (last = first+1; last < order.size() && values[order[last]] == values[order[first]]; ++last) {}
+    for (size_t i = first; i < last; ++i)
+      ranks[order[i]] = (first+last+1)/2.;
+  }
+  return ranks;
+}
+
+double CalculatePearsonCorrelation(const std::vector<double>& x, const std::vector<double>& y) {
+// Returns the Pearson correlation coefficient of "x" and "y" (NaN if it is
+// undefined, e.g. because one of them is constant).
+  const size_t n = x.size();
+  if (n < 2)
+    return std::numeric_limits<double>::quiet_NaN();
+  double mean_x = 0, mean_y = 0;
+  for (size_t i = 0; i < n; ++i) {
+    mean_x += x[i];
+    mean_y += y[i];
+  }
+  mean_x /= n;
+  mean_y /= n;
+  double covariance = 0, variance_x = 0, variance_y = 0;
+  for (size_t i = 0; i < n; ++i) {
+    covariance += (x[i]-mean_x)*(y[i]-mean_y);
+    variance_x += (x[i]-mean_x)*(x[i]-mean_x);
+    variance_y += (y[i]-mean_y)*(y[i]-mean_y);
+  }
+  return (variance_x > 0 && variance_y > 0)? covariance/std::sqrt(variance_x*variance_y) : std::numeric_limits<double>::quiet_NaN();
+}
+
+struct AnalogySection {
+  std::string name;
+  unsigned num_of_questions = 0, num_of_answered_questions = 0, num_of_correct_answers[2] = {0, 0}; // [0]: 3CosAdd, [1]: 3CosMul
+};
+
+} // namespace
+
+void HashTableOnMemory::EvaluateAnalogies(std::istream& analogies, const AnalogyMethod method, ThreadPool& thread_pool) {
+// Evaluates the word vectors with a word analogy benchmark (e.g. the Google
+// or the MSR analogy set): every line of "analogies" contains a question
+// "a b c d" ("a" is to "b" as "c" is to "d"), lines starting with ':' start a
+// new section. Every question whose words are all stored is answered with
+// "method" (excluding "a", "b" and "c" from the answers), and the accuracy per
+// section and overall is printed. Words are looked up in lower case.
+  if (!HashTableIsValid())
+    return;
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<AnalogySection> sections(1);
+  sections[0].name = "(no section)";
+  std::vector<std::vector<unsigned>> questions; // the rows of "a", "b", "c" and "d"
+  std::vector<unsigned> sections_of_questions;
+  std::string line, word;
+  while (std::getline(analogies, line)) {
+    std::stringstream stream(line);
+    if (!(stream >> word))
+      continue;
+    if (word[0] == ':') {
+      if (sections.back().num_of_questions == 0 && sections.size() == 1) // no questions before the first section
+        sections.pop_back();
+      sections.push_back(AnalogySection());
+      sections.back().name = (word.size() > 1)? word.substr(1) : ((stream >> word)? word : "");
+      continue;
+    }
+    sections.back().num_of_questions++;
+    std::vector<unsigned> question;
+    do {
+      const int row = GetRow(ToLowerCase(word));
+      if (row < 0)
+        break;
+      question.push_back(row);
+    } while (question.size() < 4 && stream >> word);
+    if (question.size() == 4) {
+      questions.push_back(question);
+      sections_of_questions.push_back(sections.size()-1);
+      sections.back().num_of_answered_questions++;
+    }
+  }
+  std::cout << "\tAnswering " << questions.size() << " analogy questions using " << thread_pool.GetNumOfThreads() << " threads..." << std::endl;
+  std::vector<std::vector<unsigned>> block_of_questions, answers;
+  for (size_t first_question = 0; first_question < questions.size(); first_question += kNumOfQuestionsPerScan) {
+    block_of_questions.assign(questions.begin()+first_question, questions.begin()+std::min(questions.size(), first_question+kNumOfQuestionsPerScan));
+    AnswerAnalogies(block_of_questions, method, thread_pool, answers);
+    for (unsigned i = 0; i < block_of_questions.size(); ++i) {
+      for (int j = 0; j < 2; ++j)
+        sections[sections_of_questions[first_question+i]].num_of_correct_answers[j] += (answers[i][j] == block_of_questions[i][3]);
+    }
+  }
+  AnalogySection total;
+  total.name = "Total";
+  for (auto& section : sections) {
+    total.num_of_questions += section.num_of_questions;
+    total.num_of_answered_questions += section.num_of_answered_questions;
+    for (int j = 0; j < 2; ++j)
+      total.num_of_correct_answers[j] += section.num_of_correct_answers[j];
+  }
+  sections.push_back(total);
+  std::cout << "\t---Done (" << std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count() << " s).\n";
+  std::cout << "\tSection\tQuestions\tAnswered" << ((method&k3CosAdd)? "\t3CosAdd" : "") << ((method&k3CosMul)? "\t3CosMul" : "") << '\n';
+  for (auto& section : sections) {
+    std::cout << '\t' << section.name << '\t' << section.num_of_questions << '\t' << section.num_of_answered_questions;
+    for (int j = 0; j < 2; ++j) {
+      if (method&(j+1))
+        std::cout << '\t' << 100*((double) section.num_of_correct_answers[j]/std::max(section.num_of_answered_questions, 1u)) << " %";
+    }
+    std::cout << '\n';
+  }
+}
+
+void HashTableOnMemory::AnswerAnalogies(const std::vector<std::vector<unsigned>>& questions, const AnalogyMethod method, ThreadPool& thread_pool, std::vector<std::vector<unsigned>>& answers) {
+// Answers the "questions" (the rows of "a", "b" and "c" each) with "method"
+// and writes the rows of the answers to "answers" ([0]: 3CosAdd, [1]: 3CosMul;
+// "kNoAnswer" if the method was not used). All questions are answered by a
+// single scan over all rows: the rows are processed in tiles, and the cosine
+// similarities of a tile with the unit-normalized vectors of all distinct
+// question words are calculated at once, so that a word occurring in several
+// questions is compared with every row only once.
+  ParseAllRows();
+  std::vector<unsigned> question_words;
+  std::unordered_map<unsigned, unsigned> index_of_question_word;
+  std::vector<std::vector<unsigned>> indices(questions.size(), std::vector<unsigned>(3));
+  for (unsigned i = 0; i < questions.size(); ++i) {
+    for (int j = 0; j < 3; ++j) {
+      auto inserted = index_of_question_word.insert(std::make_pair(questions[i][j], (unsigned) question_words.size()));
+      if (inserted.second)
+        question_words.push_back(questions[i][j]);
+      indices[i][j] = inserted.first->second;
+    }
+  }
+  const unsigned num_of_question_words = question_words.size();
+  std::vector<double> unit_vectors((size_t) num_of_question_words*vector_size_);
+  for (unsigned i = 0; i < num_of_question_words; ++i) {
+    double* unit_vector = &unit_vectors[(size_t) i*vector_size_];
+    GetVectorOfRow(question_words[i], unit_vector);
+    const double factor = options_.normalize? 1 : ((norms_[question_words[i]] > 0)? 1/norms_[question_words[i]] : 0);
+    for (int j = 0; j < vector_size_; ++j)
+      unit_vector[j] *= factor;
+  }
+  const int num_of_chunks = thread_pool.GetNumOfThreads();
+  const Candidate no_candidate(-std::numeric_limits<double>::infinity(), kNoAnswer);
+  std::vector<std::vector<std::vector<Candidate>>> best_candidates(num_of_chunks, std::vector<std::vector<Candidate>>(2, std::vector<Candidate>(questions.size(), no_candidate)));
+  thread_pool.ParallelFor(GetNumOfRows(), [&](size_t begin, size_t end, int chunk) {
+    std::vector<double> cosine_similarities(kRowsPerTile*num_of_question_words);
+    std::vector<std::vector<Candidate>>& best_candidates_of_chunk = best_candidates[chunk];
+    for (size_t tile = begin; tile < end; tile += kRowsPerTile) {
+      const size_t end_of_tile = std::min(end, tile+kRowsPerTile);
+      for (unsigned i = 0; i < num_of_question_words; ++i) {
+        for (size_t row = tile; row < end_of_tile; ++row)
+          cosine_similarities[(row-tile)*num_of_question_words+i] = (norms_[row] > 0)? GetDotProductWithRow(&unit_vectors[(size_t) i*vector_size_], row)/norms_[row] : 0;
+      }
+      for (unsigned i = 0; i < questions.size(); ++i) {
+        for (size_t row = tile; row < end_of_tile; ++row) {
+          if (row == questions[i][0] || row == questions[i][1] || row == questions[i][2])
+            continue;
+          const double* cosine_similarities_of_row = &cosine_similarities[(row-tile)*num_of_question_words];
+          const double cosine_a = cosine_similarities_of_row[indices[i][0]], cosine_b = cosine_similarities_of_row[indices[i][1]], cosine_c = cosine_similarities_of_row[indices[i][2]];
+          if (method&k3CosAdd)
+            KeepBetterCandidate(best_candidates_of_chunk[0][i], Candidate(cosine_b-cosine_a+cosine_c, row));
+          if (method&k3CosMul)
+            KeepBetterCandidate(best_candidates_of_chunk[1][i], Candidate((cosine_b+1)*(cosine_c+1)/(2*(cosine_a+1)+0.004), row)); // = cos'(b)*cos'(c)/(cos'(a)+0.001)
+        }
+      }
+    }
+  }, num_of_chunks);
+  answers.assign(questions.size(), std::vector<unsigned>(2, kNoAnswer));
+  for (unsigned i = 0; i < questions.size(); ++i) {
+    for (int j = 0; j < 2; ++j) {
+      Candidate best_candidate = no_candidate;
+      for (auto& best_candidates_of_chunk : best_candidates)
+        KeepBetterCandidate(best_candidate, best_candidates_of_chunk[j][i]);
+      answers[i][j] = best_candidate.second;
+    }
+  }
+}
+
+WordSimilarityBenchmarks::WordSimilarityBenchmarks(const std::vector<std::string>& files) {
+  for (auto& file : files) {
+    if (!ReadBenchmark(file))
+      std::cout << "ERROR: OPENING \"" << file << "\" FAILED!\n";
+  }
+}
+
+WordSimilarityBenchmarks::~WordSimilarityBenchmarks() {}
+
+bool WordSimilarityBenchmarks::ReadBenchmark(const std::string& file) {
+// Reads the word pairs and their ratings from "file": every line containing
+// two words followed by a number (separated by whitespaces, tabs or commas)
+// is a rated word pair, all other lines (e.g. headers or comments) are
+// skipped. Returns "false" if "file" couldn't be opened.
+  std::ifstream file_stream(file);
+  if (!file_stream.is_open())
+    return false;
+  Benchmark benchmark;
+  benchmark.name = file.substr(file.find_last_of('/')+1);
+  benchmark.first_pair = word_pairs_.size();
+  std::string line;
+  std::vector<std::string> fields;
+  while (std::getline(file_stream, line)) {
+    fields.clear();
+    for (size_t begin = line.find_first_not_of(" \t\r,"), end; begin != std::string::npos && fields.size() < 3; begin = line.find_first_not_of(" \t\r,", end)) {
+      end = line.find_first_of(" \t\r,", begin);
+      fields.push_back(line.substr(begin, (end == std::string::npos)? std::string::npos : end-begin));
+      if (end == std::string::npos)
+        break;
+    }
+    if (fields.size() < 3)
+      continue;
+    char* end_of_rating;
+    const double rating = strtod(fields[2].c_str(), &end_of_rating);
+    if (*end_of_rating != '\0' || end_of_rating == fields[2].c_str())
+      continue;
+    word_pairs_.push_back(std::make_pair(ToLowerCase(fields[0]), ToLowerCase(fields[1])));
+    ratings_.push_back(rating);
+  }
+  benchmark.end_of_pairs = word_pairs_.size();
+  benchmarks_.push_back(benchmark);
+  return true;
+}
+
+void WordSimilarityBenchmarks::ShowResults(const std::vector<double>& cosine_similarities, const std::vector<std::string>& unknown_words) {
+// Prints for every benchmark the number of word pairs, the number and the
+// share of the pairs whose words were both found, the number of distinct
+// "unknown_words" of the benchmark as well as the Spearman and the Pearson
+// correlation of the "cosine_similarities" of the pairs (NaN if a word of the
+// pair couldn't be found) with the ratings.
+  const std::unordered_set<std::string> set_of_unknown_words(unknown_words.begin(), unknown_words.end());
+  std::cout << "\tBenchmark\tPairs\tFound\tCoverage\tOOV words\tSpearman\tPearson\n";
+  for (auto& benchmark : benchmarks_) {
+    std::vector<double> similarities, ratings;
+    std::unordered_set<std::string> unknown_words_of_benchmark;
+    for (size_t i = benchmark.first_pair; i < benchmark.end_of_pairs; ++i) {
+      if (std::isnan(cosine_similarities[i])) {
+        for (auto& word : {word_pairs_[i].first, word_pairs_[i].second}) {
+          if (set_of_unknown_words.count(word))
+            unknown_words_of_benchmark.insert(word);
+        }
+        continue;
+      }
+      similarities.push_back(cosine_similarities[i]);
+      ratings.push_back(ratings_[i]);
+    }
+    const size_t num_of_pairs = benchmark.end_of_pairs-benchmark.first_pair;
+    std::cout << '\t' << benchmark.name << '\t' << num_of_pairs << '\t' << similarities.size() << '\t' << 100*((double) similarities.size()/std::max(num_of_pairs, (size_t) 1)) << " %\t" << unknown_words_of_benchmark.size() << '\t' << CalculatePearsonCorrelation(GetRanks(similarities), GetRanks(ratings)) << '\t' << CalculatePearsonCorrelation(similarities, ratings) << '\n';
+  }
+}
+
+void HashTableOnMemory::EvaluateWordSimilarities(WordSimilarityBenchmarks& benchmarks, ThreadPool& thread_pool) {
+// Evaluates the word vectors with the word similarity "benchmarks": the
+// cosine similarities of the word pairs of all benchmarks are calculated at
+// once on all threads of "thread_pool".
+  if (!HashTableIsValid())
+    return;
+  const std::vector<std::pair<std::string, std::string>>& word_pairs = benchmarks.GetWordPairs();
+  std::vector<double> cosine_similarities(word_pairs.size());
+  std::vector<std::vector<std::string>> unknown_words_of_chunks(thread_pool.GetNumOfThreads());
+  thread_pool.ParallelFor(word_pairs.size(), [&](size_t begin, size_t end, int chunk) {
+    double euclidean_distance;
+    for (size_t i = begin; i < end; ++i) {
+      const int rows[2] = {GetRow(word_pairs[i].first), GetRow(word_pairs[i].second)};
+      if (rows[0] < 0 || rows[1] < 0) {
+        cosine_similarities[i] = std::numeric_limits<double>::quiet_NaN();
+        for (int j = 0; j < 2; ++j) {
+          if (rows[j] < 0)
+            unknown_words_of_chunks[chunk].push_back((j == 0)? word_pairs[i].first : word_pairs[i].second);
+        }
+      } else
+        GetSimilarityOfRows(rows[0], rows[1], cosine_similarities[i], euclidean_distance);
+    }
+  }, thread_pool.GetNumOfThreads());
+  std::vector<std::string> unknown_words;
+  for (auto& unknown_words_of_chunk : unknown_words_of_chunks)
+    unknown_words.insert(unknown_words.end(), unknown_words_of_chunk.begin(), unknown_words_of_chunk.end());
+  benchmarks.ShowResults(cosine_similarities, unknown_words);
+}
+
+void HashTableReader::EvaluateWordSimilarities(WordSimilarityBenchmarks& benchmarks) {
+// Evaluates the word vectors of the hash table file with the word similarity
+// "benchmarks". The distinct words of all benchmarks are looked up by a single
+// pass over the hash table file (see "FetchVectors()").
+  HashTable hash_table(hash_table_values_[2], GetHashFunction());
+  const std::vector<std::pair<std::string, std::string>>& word_pairs = benchmarks.GetWordPairs();
+  std::vector<std::string> distinct_words;
+  std::unordered_set<std::string> words_seen;
+  for (auto& word_pair : word_pairs) {
+    for (auto& word : {word_pair.first, word_pair.second}) {
+      if (words_seen.insert(word).second)
+        distinct_words.push_back(word);
+    }
+  }
+  std::unordered_map<std::string, std::pair<std::vector<double>, double>> vectors; // the vectors and norms of the words found
+  FetchVectors(distinct_words, vectors);
+  std::vector<double> cosine_similarities(word_pairs.size(), std::numeric_limits<double>::quiet_NaN());
+  for (size_t i = 0; i < word_pairs.size(); ++i) {
+    auto vector_0 = vectors.find(word_pairs[i].first), vector_1 = vectors.find(word_pairs[i].second);
+    if (vector_0 != vectors.end() && vector_1 != vectors.end())
+      cosine_similarities[i] = hash_table.CalculateCosineSimilarity(hash_table.CalculateDotProduct(vector_0->second.first.data(), vector_1->second.first.data(), hash_table_values_[0]), vector_0->second.second, vector_1->second.second);
+  }
+  std::vector<std::string> unknown_words;
+  for (auto& word : distinct_words) {
+    if (!vectors.count(word))
+      unknown_words.push_back(word);
+  }
+  benchmarks.ShowResults(cosine_similarities, unknown_words);
+}
@@ -15,22 +15,74 @@
 // limitations under the License.
 
 #include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <map>
 #include <math.h>
 #include <numeric>
+#include <random>
+#include <sys/mman.h>
+#include <unordered_map>
 
 #include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
 
+namespace {
+
+const size_t kSizeOfChunks = 1 << 26; // the number of bytes of the word vector file "HashTableOnMemory" reads (and parses in parallel) at once
+const int kMaxBucketLengthToShow = 8; // longer chains or probe sequences are shown together by "ShowInfo()" and "PrintInfo()"
+const double kMinMaxLoadFactor = 1e-3; // smaller maximum load factors are raised to it (the number of slots or buckets would explode)
+const double kMaxLoadFactorOfSlots = 0.9; // the open addressing of "HashTableOnMemory" needs empty slots
+const long long kMaxNumOfSpillFiles = 1000; // "HashTableWriter" keeps all spill files open at once (most systems allow 1024 open files per process)
+
+} // namespace
+
+uint64_t GetMurmurHash64(const char* key, const size_t length) {
+// Returns the MurmurHash64A hash of "key" (Austin Appleby, public domain). The
+// blocks of eight characters are read as little-endian numbers on every
+// machine, so that hash table files do not depend on the byte order.
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  const unsigned char* data = (const unsigned char*) key;
+  const unsigned char* end_of_blocks = data+(length&~(size_t) 7);
+  uint64_t hash = 0x9747b28cULL^(length*m);
+  for (; data != end_of_blocks; data += 8) {
+    uint64_t block = 0;
+    for (int i = 7; i >= 0; --i)
+      block = (block << 8)|data[i];
+    block *= m;
+    block ^= block >> r;
+    block *= m;
+    hash ^= block;
+    hash *= m;
+  }
+  if ((length&7) != 0) {
+    for (int i = (length&7)-1; i >= 0; --i)
+      hash ^= (uint64_t) data[i] << (8*i);
+    hash *= m;
+  }
+  hash ^= hash >> r;
+  hash *= m;
+  hash ^= hash >> r;
+  return hash;
+}
+
 // The standard constructor of the "HashTable"
-HashTable::HashTable(const std::string& input_file)
+HashTable::HashTable(const std::string& input_file, const HashFunction hash_function)
     : input_file_(input_file),
+      input_file_info_(WordVectorFileReader::GetInfo(input_file)),
       vector_size_(GetSizeOfVectors()),
-      vector_num_(CountVectors()),
-      hash_table_size_(vector_num_/20) {} // in some cases you may have to adjust the denominator in order to reduce the number of collisions
+      hash_function_(hash_function),
+      minimal_perfect_hash_(NULL), // set by "HashTableWriter" if it is needed
+      vector_num_(0), // "vector_num_" and "hash_table_size_" are set by the derived classes (see "SetHashTableSize()")
+      hash_table_size_(0) {}
 
 // The constructor "HashTableReader" will use.
-HashTable::HashTable(const int hash_table_size)
+HashTable::HashTable(const int hash_table_size, const HashFunction hash_function, const MinimalPerfectHash* minimal_perfect_hash)
     : vector_size_(0), // default initialization of "vector_size_" and "vector_num_" for they are not needed if "HashTableReader" is active
+      hash_function_(hash_function),
+      minimal_perfect_hash_(minimal_perfect_hash),
       vector_num_(0),
       hash_table_size_(hash_table_size) {}
 
@@ -40,7 +92,7 @@ const int HashTable::GetSizeOfVectors() {
 // Returns the number of dimensions of the word vectors found in "input_file_"
 // (assuming that each line of the file contains exactly one vector and that
 // all the word vectors got the same number of dimensions).
-  std::ifstream file_stream(input_file_);
+  InputFileStream file_stream(input_file_);
   if (!file_stream.is_open()) {
     std::cout << "ERROR: OPENING \"" << input_file_ << "\" FAILED!\nMake sure that the file exists and that the path is correct.\n";
     std::cout << "Program terminated.";
@@ -54,38 +106,103 @@ const int HashTable::GetSizeOfVectors() {
   std::cout << "\tChecking the size of the word vectors..." << std::endl;
   std::string line;
   std::getline(file_stream, line);
+  if (file_stream.bad()) {
+    std::cout << "ERROR: \"" << input_file_ << "\" IS CORRUPT - READING IT FAILED BEFORE ITS END!\n";
+    std::cout << "Program terminated.";
+    return -1;
+  }
   std::cout << "\t---Done.\n";
+  if (HashTableOnMemory::IsSnapshotFile(input_file_))
+    return HashTableOnMemory::GetVectorSizeOfSnapshot(input_file_);
+  if (line.find(' ') == std::string::npos && line.find(',') != std::string::npos)
+    return atoi(line.c_str()); // the first line of a hash table file starts with the vector size
+  if (input_file_info_.format != kTextFormat) {
+    std::cout << "\t(" << ((input_file_info_.format == kBinaryFormat)? "Binary" : "Text") << " word vector file with a header: " << input_file_info_.num_of_vectors << " word vectors of size " << input_file_info_.vector_size << ")\n";
+    return input_file_info_.vector_size;
+  }
   return (std::count(line.begin(), line.end(), ' '));
 }
 
 const int HashTable::CountVectors() {
 // Returns the number of word vectors in "input_file_" (assuming that each line
-// of the file contains exactly one vector).
+// of the file contains exactly one vector) or -1 if the file is corrupt.
   if (vector_size_ < 1)
     return -1;
+  if (input_file_info_.num_of_vectors >= 0) // the header of the file tells the number
+    return input_file_info_.num_of_vectors;
   int vector_num = 0;
-  std::ifstream file_stream(input_file_);
+  InputFileStream file_stream(input_file_);
   std::cout << "\tCounting the word vectors..." << std::endl;
   std::string line;
   while (std::getline(file_stream, line))
     vector_num++; // this might cause problems if your "input_file_" is not a valid word vector file because actually lines and not vectors are counted
+  if (file_stream.bad()) {
+    std::cout << "ERROR: \"" << input_file_ << "\" IS CORRUPT - READING IT FAILED BEFORE ITS END!\n";
+    return -1;
+  }
   std::cout << "\t---Done." << std::endl;
   return vector_num;
 }
 
-int HashTable::GetIndex(const std::string& key) { // hash function
-// Returns the "index" of the bucket of the hash table the "key" corresponds to.
-  int hash = 0, j = 1, k = 0;
-  const std::vector<int> primes = {179, 181, 191, 193, 197, 199, 211, 223, 227, 229};
-  for (unsigned i = 0; i < key.length(); ++i) {
-    if (i == (primes.size()*j)) {
+void HashTable::SetHashTableSize(const double max_load_factor) {
+// Sets "hash_table_size_" to the smallest power of two that keeps the load
+// factor (i.e. "vector_num_" per bucket) at most "max_load_factor".
+  const double num_of_buckets = std::max(vector_num_, 1)/std::max(max_load_factor, kMinMaxLoadFactor);
+  hash_table_size_ = 1;
+  while (hash_table_size_ < num_of_buckets && hash_table_size_ < (1 << 30))
+    hash_table_size_ <<= 1;
+}
+
+long long HashTable::GetFileSize(const std::string& file) {
+// Returns the size of "file" in bytes (or -1 if it cannot be opened).
+  std::ifstream file_stream(file, std::ios_base::binary|std::ios_base::ate);
+  if (!file_stream.is_open())
+    return -1;
+  return file_stream.tellg();
+}
+
+std::vector<std::string> HashTable::GetDeltaSegments(const std::string& hash_table_file) {
+// Returns the delta segments of "hash_table_file" (see
+// "kDeltaSegmentExtension"), the oldest one first.
+  std::vector<std::string> delta_segments;
+  while (GetFileSize(hash_table_file+kDeltaSegmentExtension+std::to_string(delta_segments.size()+1)) >= 0)
+    delta_segments.push_back(hash_table_file+kDeltaSegmentExtension+std::to_string(delta_segments.size()+1));
+  return delta_segments;
+}
+
+const char* HashTable::GetNameOfHashFunction(const HashFunction hash_function) {
+  return (hash_function == kPrimeHash)? "prime hash (original)" : ((hash_function == kMinimalPerfectHash)? "minimal perfect hash (BBHash)" : "MurmurHash64A");
+}
+
+uint64_t HashTable::GetHash(const char* key, const size_t length) { // hash function
+// Returns the hash value of the "key" (consisting of "length" characters)
+// calculated with "hash_function_" (MurmurHash64A, on which the minimal
+// perfect hash is based, if "hash_function_" is "kMinimalPerfectHash").
+  if (hash_function_ != kPrimeHash)
+    return GetMurmurHash64(key, length);
+  unsigned hash = 0, j = 1, k = 0;
+  static const int primes[] = {179, 181, 191, 193, 197, 199, 211, 223, 227, 229};
+  const unsigned num_of_primes = sizeof(primes)/sizeof(primes[0]);
+  for (unsigned i = 0; i < length; ++i) {
+    if (i == (num_of_primes*j)) {
       k = 0;
       j++;
     }
     hash += (int) key[i]*primes[k]; // multiplies each ASCII-value of "key" with an element of "primes" (i.e. a prime number)
     k++;
   }
-  const int index = hash%hash_table_size_;
+  return hash;
+}
+
+int HashTable::GetIndex(const std::string& key) {
+// Returns the "index" of the bucket of the hash table the "key" corresponds to
+// (with a minimal perfect hash, a key that is not stored gets an arbitrary
+// bucket, so that the key has to be verified after reading the bucket).
+  if (hash_function_ == kMinimalPerfectHash)
+    return (minimal_perfect_hash_ != NULL)? minimal_perfect_hash_->GetIndex(key.data(), key.length()) : 0;
+  if (hash_function_ == kMurmurHash64)
+    return GetHash(key)%hash_table_size_;
+  const int index = ((int) GetHash(key))%hash_table_size_; // the original hash function may overflow (which leads to bucket 0)
   if (index < 0)
     return 0;
   if (index > (hash_table_size_-1))
@@ -93,323 +210,1283 @@ int HashTable::GetIndex(const std::string& key) { // hash function
   return index;
 }
 
-void HashTable::ShowInfo(const int num_of_empty_buckets, const int highest_num_of_nodes_in_a_bucket) {
-// Prints the most important information regarding the created hash table.
+void HashTable::ShowInfo(const int num_of_empty_buckets, const std::vector<int>& num_of_buckets_per_length) {
+// Prints the most important information regarding the created hash table
+// including the distribution of the chain lengths ("num_of_buckets_per_length"
+// contains the number of buckets containing "i" word vectors).
+  const int highest_num_of_nodes_in_a_bucket = num_of_buckets_per_length.size()-1;
   std::cout << "\tSize of vectors = " << vector_size_ << '\n';
   std::cout << "\tNumber of stored word vectors = " << vector_num_ << '\n';
+  std::cout << "\tHash function = " << GetNameOfHashFunction(hash_function_) << '\n';
   std::cout << "\tNumber of buckets = " << hash_table_size_ << '\n';
   std::cout << "\tLoad factor = " << (double) vector_num_/hash_table_size_ << '\n';
   std::cout << "\tNumber of empty buckets = " << num_of_empty_buckets << '\n';
   std::cout << "\tPercentage of empty buckets = " << 100*((double) num_of_empty_buckets/hash_table_size_) << " %\n";
   std::cout << "\tHighest number of word vectors in a bucket = " << highest_num_of_nodes_in_a_bucket << '\n';
-  std::cout << "\tPercentage of vectors in mostly filled bucket = " << 100*((double) highest_num_of_nodes_in_a_bucket/vector_num_) << '\n';
+  std::cout << "\tPercentage of vectors in mostly filled bucket = " << 100*((double) highest_num_of_nodes_in_a_bucket/std::max(vector_num_, 1)) << '\n';
+  for (int i = 1; i <= kMaxBucketLengthToShow; ++i) {
+    int num_of_buckets = 0;
+    for (int length = i; length < (int) num_of_buckets_per_length.size() && (length == i || i == kMaxBucketLengthToShow); ++length)
+      num_of_buckets += num_of_buckets_per_length[length];
+    std::cout << "\tPercentage of non-empty buckets with " << ((i == kMaxBucketLengthToShow)? ">= " : "") << i << " word vectors = " << 100*((double) num_of_buckets/std::max(hash_table_size_-num_of_empty_buckets, 1)) << " %\n";
+  }
 }
 
-void HashTable::ShowSimilarity(const std::vector<std::string>& words, const std::vector<std::vector<double>>& vectors) {
-// Prints the cosine similarity and the Euclidean distance of two word vectors.
-  std::cout << "\tThe cosine similarity of the word vectors of \"" << words[0] << "\" and \"" << words[1] << "\" =\n\t " << CalculateCosineSimilarity(vectors) << '\n';
-  std::cout << "\tThe Euclidean distance between the word vectors of \"" << words[0] << "\" and \"" << words[1] << "\" =\n\t " << CalculateEuclideanDistance(vectors) << "\n\n";
+void HashTable::ShowSimilarity(const std::vector<std::string>& words, const double dot_product, const double norm_0, const double norm_1) {
+// Prints the cosine similarity and the Euclidean distance of two word vectors
+// given their "dot_product" and their norms.
+  std::cout << "\tThe cosine similarity of the word vectors of \"" << words[0] << "\" and \"" << words[1] << "\" =\n\t " << CalculateCosineSimilarity(dot_product, norm_0, norm_1) << '\n';
+  std::cout << "\tThe Euclidean distance between the word vectors of \"" << words[0] << "\" and \"" << words[1] << "\" =\n\t " << CalculateEuclideanDistance(dot_product, norm_0, norm_1) << "\n\n";
 }
 
-double HashTable::CalculateCosineSimilarity(const std::vector<std::vector<double>>& vectors) {
-// Calculates and returns the cosine similarity of "vectors[0]" and
-// "vectors[1]".
-  return ((std::inner_product(vectors[0].begin(), vectors[0].end(), vectors[1].begin(), 0.))/(CalculateEuclideanNorm(vectors[0])*CalculateEuclideanNorm(vectors[1])));
+double HashTable::CalculateCosineSimilarity(const double dot_product, const double norm_0, const double norm_1) {
+// Calculates and returns the cosine similarity of two vectors given their
+// "dot_product" and their norms.
+  return dot_product/(norm_0*norm_1);
 }
 
-double HashTable::CalculateEuclideanDistance(const std::vector<std::vector<double>>& vectors) {
-// Calculates and returns the Euclidean distance between "vectors[0]" and
-// "vectors[1]".
-  double x = 0;
-  for (unsigned i = 0; i < vectors[0].size(); ++i)
-    x += std::pow((vectors[0][i]-vectors[1][i]), 2);
-  return std::sqrt(x);
+double HashTable::CalculateEuclideanDistance(const double dot_product, const double norm_0, const double norm_1) {
+// Calculates and returns the Euclidean distance between two vectors given
+// their "dot_product" and their norms (using ||a-b||^2 = ||a||^2+||b||^2-2ab;
+// rounding errors may make the radicand slightly negative for (nearly) equal
+// vectors).
+  return std::sqrt(std::max(0., norm_0*norm_0+norm_1*norm_1-2*dot_product));
 }
 
-double HashTable::CalculateEuclideanNorm(const std::vector<double>& vector) {
-// Calculates and returns the Euclidean norm of "vec" (needed in order to
-// calculate the cosine similarity).
-  double x = 0;
-  for (auto& element : vector)
-    x += std::pow(element, 2);
-  return std::sqrt(x);
+double HashTable::CalculateDotProduct(const double* vector_0, const double* vector_1, const int size) {
+// Calculates and returns the dot product of "vector_0" and "vector_1" using
+// the kernel selected at startup (see "similarity_kernels.cc").
+  return kSimilarityKernels.dot_product_f64(vector_0, vector_1, size);
 }
 
-HashTableOnMemory::HashTableOnMemory(const std::string& input_file)
-    : HashTable(input_file) {
-  std::vector<WordVector*> HT(hash_table_size_);
-  hash_table_ = HT;
-  ReadVectorFile();
+double HashTable::CalculateEuclideanNorm(const double* vector, const int size) {
+// Calculates and returns the Euclidean norm of "vector" (needed in order to
+// calculate the cosine similarity and the Euclidean distance).
+  return std::sqrt(CalculateDotProduct(vector, vector, size));
 }
 
-HashTableOnMemory::~HashTableOnMemory() {
-  WordVector* current_word_vector;
-  for (auto& bucket : hash_table_) {
-    while (bucket != NULL) {
-      current_word_vector = bucket;
-      bucket = bucket->next;
-      delete current_word_vector;
-    }
+void HashTable::QuantizeToHalf(double* vector, uint16_t* quantized_vector) {
+// Converts the "vector_size_" values of "vector" to half-precision floats,
+// writes them to "quantized_vector" and replaces the values of "vector" by the
+// values they stand for.
+  for (int i = 0; i < vector_size_; ++i) {
+    quantized_vector[i] = ConvertToHalf(vector[i]);
+    vector[i] = ConvertFromHalf(quantized_vector[i]);
   }
 }
 
-void HashTableOnMemory::ReadVectorFile() {
-// Reads "input_file_" and passes the lines to
-// "HashTableOnMemory::store_vectors()".
-  if (!HashTableIsValid())
+float HashTable::QuantizeToInt8(double* vector, int8_t* quantized_vector) {
+// Converts the "vector_size_" values of "vector" to 8-bit integers (the
+// largest absolute value is mapped to 127), writes them to "quantized_vector"
+// and replaces the values of "vector" by the values they stand for. Returns
+// the scale of the quantized vector.
+  double largest_absolute_value = 0;
+  for (int i = 0; i < vector_size_; ++i)
+    largest_absolute_value = std::max(largest_absolute_value, std::fabs(vector[i]));
+  const float scale = (largest_absolute_value > 0)? largest_absolute_value/127 : 1;
+  for (int i = 0; i < vector_size_; ++i) {
+    quantized_vector[i] = (int8_t) std::max(-127., std::min(127., std::round(vector[i]/scale)));
+    vector[i] = quantized_vector[i]*scale;
+  }
+  return scale;
+}
+
+HashTableOnMemory::HashTableOnMemory(const std::string& input_file, ThreadPool& thread_pool, const HashTableOptions& options)
+    : HashTable(input_file),
+      options_(options),
+      vocabulary_filter_(options.max_words, options.vocabulary_file),
+      num_of_migrated_slots_(0),
+      snapshot_(NULL),
+      size_of_snapshot_(0),
+      is_lazy_(false),
+      mapped_vector_file_(NULL),
+      size_of_mapped_vector_file_(0),
+      lazy_data_(NULL),
+      size_of_lazy_data_(0),
+      num_of_parsed_rows_(0),
+      warm_up_is_stopped_(false) {
+  options_.max_load_factor = std::max(kMinMaxLoadFactor, std::min(options_.max_load_factor, kMaxLoadFactorOfSlots)); // "StoreVectors()" relies on it
+  loaded_data_.word_offsets.assign(1, 0);
+  SetPointersToLoadedData();
+  if (!vocabulary_filter_.IsValid())
+    return; // "HashTableIsValid()" stays "false"
+  if (vocabulary_filter_.IsActive() && !options_.snapshot_file.empty()) {
+    std::cout << "WARNING: SNAPSHOTS CANNOT BE USED WITH \"--max-words\" OR \"--vocabulary\" - the word vector file is loaded.\n";
+    options_.snapshot_file.clear();
+  }
+  // A snapshot given instead of the word vector file is mapped as it is, while
+  // the snapshot file of the options has to fit the word vector file.
+  const bool input_file_is_snapshot = IsSnapshotFile(input_file_);
+  if (input_file_is_snapshot || (!options_.snapshot_file.empty() && vector_size_ > 0 && MapSnapshot(options_.snapshot_file, true))) {
+    if (input_file_is_snapshot && !MapSnapshot(input_file_, false))
+      return; // "HashTableIsValid()" stays "false"
+    if (kStatistics.IsEnabled())
+      ReportMemory();
     return;
-  std::cout << "\tLoading data..." << std::endl;
-  std::string line;
-  std::ifstream vector_file_stream(input_file_);
-  while (std::getline(vector_file_stream, line))
-    StoreVectors(line);
+  }
+  // The number of slots is the smallest power of two that keeps the load
+  // factor for the estimated number of word vectors at most
+  // "options_.max_load_factor" (the slots grow while loading if the estimate
+  // turns out to be too low).
+  vector_num_ = EstimateNumOfVectors();
+  SetHashTableSize(options_.max_load_factor);
+  slot_mask_ = hash_table_size_-1;
+  loaded_data_.slots.assign(hash_table_size_, Slot{0, kEmptySlot});
+  is_lazy_ = (options_.lazy && HashTableIsValid() && MapVectorFile());
+  const bool vector_file_is_read = ReadVectorFile(thread_pool);
+  MigrateSlots(loaded_data_.old_slots.size()); // finishes a growth of the slots that is still in progress
+  SetPointersToLoadedData();
+  vector_num_ = GetNumOfRows(); // words occurring more than once are stored only once
+  if (!vector_file_is_read || (is_lazy_ && !PrepareLazyParsing()))
+    vector_num_ = 0; // "HashTableIsValid()" is "false"
+  if (kStatistics.IsEnabled())
+    ReportMemory();
+  if (HashTableIsValid() && !options_.snapshot_file.empty())
+    SaveSnapshot(options_.snapshot_file);
+}
+
+HashTableOnMemory::~HashTableOnMemory() {
+  StopLazyParsing();
+  if (snapshot_ != NULL)
+    munmap(snapshot_, size_of_snapshot_);
+}
+
+void HashTableOnMemory::SetPointersToLoadedData() {
+// Lets the pointers to the word vectors, norms, words and slots point to
+// "loaded_data_" (which must not change afterwards).
+  vectors_ = loaded_data_.vectors.data();
+  half_vectors_ = loaded_data_.half_vectors.data();
+  int8_vectors_ = loaded_data_.int8_vectors.data();
+  scales_ = loaded_data_.scales.data();
+  norms_ = loaded_data_.norms.data();
+  words_ = loaded_data_.words.data();
+  word_offsets_ = loaded_data_.word_offsets.data();
+  slots_ = loaded_data_.slots.data();
+  num_of_rows_ = loaded_data_.word_offsets.size()-1;
+}
+
+int HashTableOnMemory::EstimateNumOfVectors() {
+// Returns an estimate of the number of word vectors in "input_file_" (its size
+// divided by the length of its first line, or the number its header tells),
+// so that the file does not have to be read an additional time in order to
+// count its lines.
+  if (vector_size_ < 1)
+    return -1;
+  if (input_file_info_.num_of_vectors >= 0)
+    return std::max(1LL, vocabulary_filter_.GetMaxNumOfVectors(input_file_info_.num_of_vectors));
+  InputFileStream file_stream(input_file_);
+  std::string first_line;
+  std::getline(file_stream, first_line);
+  return std::max(1LL, vocabulary_filter_.GetMaxNumOfVectors(InputFileStream::GetEstimatedSize(input_file_)/(long long) (first_line.size()+1)));
+}
+
+bool HashTableOnMemory::ReadVectorFile(ThreadPool& thread_pool) {
+// Reads "input_file_" in chunks of "kSizeOfChunks" bytes (the next chunk is
+// read while the current one is processed). Every chunk is split into one
+// part per thread at line boundaries (or at the boundaries of the word
+// vectors of a binary file), the parts are parsed in parallel and their word
+// vectors are stored in the order of the file. Returns "false" if the file
+// couldn't be read completely because it is corrupt.
+  if (!HashTableIsValid())
+    return false;
+  StatisticsTimer load_timer(Statistics::kLoadTime);
+  std::cout << "\tLoading " << (is_lazy_? "words" : "data") << " using " << thread_pool.GetNumOfThreads() << " threads..." << std::endl;
+  if (is_lazy_) // the word vectors are parsed later (see "lazy_loading.cc")
+    loaded_data_.offsets.reserve(vector_num_);
+  else if (options_.precision == kInt8) {
+    loaded_data_.int8_vectors.reserve((size_t) vector_num_*vector_size_);
+    loaded_data_.scales.reserve(vector_num_);
+  } else if (options_.precision == kFloat16)
+    loaded_data_.half_vectors.reserve((size_t) vector_num_*vector_size_);
+  else
+    loaded_data_.vectors.reserve((size_t) vector_num_*vector_size_);
+  if (!is_lazy_)
+    loaded_data_.norms.reserve(vector_num_);
+  loaded_data_.word_offsets.reserve(vector_num_+1);
+  InputFileStream vector_file_stream(input_file_);
+  vector_file_stream.seekg(input_file_info_.size_of_header);
+  std::vector<char> chunk, next_chunk;
+  std::string rest_of_last_line;
+  std::vector<size_t> binary_vectors, next_binary_vectors;
+  std::vector<ParsedLines> parsed_parts(thread_pool.GetNumOfThreads());
+  long long offset_of_chunk = input_file_info_.size_of_header; // the offset of "chunk" in the word vector file
+  long long num_of_vectors_left = (vocabulary_filter_.GetMaxWords() > 0)? vocabulary_filter_.GetMaxWords() : -1;
+  bool chunk_is_read = ReadChunk(vector_file_stream, chunk, rest_of_last_line, binary_vectors, num_of_vectors_left), next_chunk_is_read;
+  while (chunk_is_read) {
+    std::thread reader([&] { next_chunk_is_read = ReadChunk(vector_file_stream, next_chunk, rest_of_last_line, next_binary_vectors, num_of_vectors_left); });
+    const char* begin_of_chunk = chunk.data();
+    const char* end_of_chunk = begin_of_chunk+chunk.size();
+    for (auto& parsed_part : parsed_parts)
+      parsed_part = ParsedLines();
+    {
+      StatisticsTimer parse_timer(Statistics::kParseTime);
+      if (input_file_info_.format == kBinaryFormat) {
+        thread_pool.ParallelFor(binary_vectors.size(), [&](size_t begin, size_t end, int part) {
+          ParseBinaryVectors(begin_of_chunk, binary_vectors.data()+begin, binary_vectors.data()+end, parsed_parts[part], is_lazy_);
+        }, parsed_parts.size());
+      } else {
+        thread_pool.ParallelFor(chunk.size(), [&](size_t begin, size_t end, int part) {
+          // A line belongs to the part its first character belongs to.
+          const char* begin_of_part = begin_of_chunk+begin;
+          if (begin > 0 && begin_of_part[-1] != '\n')
+            begin_of_part = (const char*) memchr(begin_of_part, '\n', end_of_chunk-begin_of_part)+1;
+          ParseLines(begin_of_part, begin_of_chunk+end, end_of_chunk, parsed_parts[part], is_lazy_);
+        }, parsed_parts.size());
+      }
+    }
+    {
+      StatisticsTimer store_timer(Statistics::kStoreTime);
+      for (auto& parsed_part : parsed_parts)
+        StoreVectors(parsed_part, begin_of_chunk, offset_of_chunk);
+    }
+    if (kStatistics.IsEnabled()) {
+      kStatistics.Add(Statistics::kBytesRead, chunk.size());
+      for (auto& parsed_part : parsed_parts)
+        kStatistics.Add(Statistics::kLinesParsed, parsed_part.norms.size());
+    }
+    offset_of_chunk += chunk.size();
+    reader.join();
+    chunk.swap(next_chunk);
+    binary_vectors.swap(next_binary_vectors);
+    chunk_is_read = next_chunk_is_read;
+  }
+  if (vector_file_stream.bad()) {
+    std::cout << "ERROR: \"" << input_file_ << "\" IS CORRUPT - LOADING IT FAILED BEFORE ITS END!\n";
+    return false;
+  }
   std::cout << "\t---Completed.\n";
+  return true;
 }
 
-void HashTableOnMemory::StoreVectors(const std::string& line) {
-// Stores the word vectors in the hash table on memory.
-  const std::vector<std::string> tokens = SplitLine(line);
+bool HashTableOnMemory::ReadChunk(std::istream& vector_file_stream, std::vector<char>& chunk, std::string& rest_of_last_line, std::vector<size_t>& binary_vectors, long long& num_of_vectors_left) {
+// Reads the next chunk of the word vector file: "chunk" consists of the
+// "rest_of_last_line" of the previous chunk followed by up to "kSizeOfChunks"
+// bytes of the file, and ends with the last complete line (the rest is kept
+// for the next chunk). The word vectors of a binary file cannot be told apart
+// by line breaks: the chunk ends with the last complete word vector instead,
+// and "binary_vectors" gets the offsets of all of them. Unless
+// "num_of_vectors_left" is -1, the chunk ends after at most that many word
+// vectors (lines), which are subtracted from it. Returns "false" if the file
+// is completely read (or corrupt, see "ReadVectorFile()").
+  if (num_of_vectors_left == 0)
+    return false;
+  chunk.assign(rest_of_last_line.begin(), rest_of_last_line.end());
+  const size_t size_of_rest = chunk.size();
+  chunk.resize(size_of_rest+kSizeOfChunks);
+  vector_file_stream.read(chunk.data()+size_of_rest, kSizeOfChunks);
+  chunk.resize(size_of_rest+vector_file_stream.gcount());
+  rest_of_last_line.clear();
+  if (chunk.empty() || vector_file_stream.bad())
+    return false;
+  if (input_file_info_.format == kBinaryFormat) {
+    binary_vectors.clear();
+    const char* begin_of_chunk = chunk.data();
+    const char* end_of_chunk = begin_of_chunk+chunk.size();
+    const char* position = begin_of_chunk;
+    while (true) {
+      while (position < end_of_chunk && *position == '\n') // word2vec ends every word vector with '\n'
+        position++;
+      const char* end_of_vector = WordVectorFileReader::FindEndOfBinaryVector(position, end_of_chunk, vector_size_);
+      if (end_of_vector == NULL)
+        break;
+      binary_vectors.push_back(position-begin_of_chunk);
+      position = end_of_vector;
+    }
+    if (vector_file_stream) // an incomplete word vector at the end of the file is skipped
+      rest_of_last_line.assign(position, end_of_chunk);
+    if (num_of_vectors_left >= 0) {
+      if ((long long) binary_vectors.size() > num_of_vectors_left) {
+        position = begin_of_chunk+binary_vectors[num_of_vectors_left];
+        binary_vectors.resize(num_of_vectors_left);
+      }
+      num_of_vectors_left -= binary_vectors.size();
+    }
+    chunk.resize(position-begin_of_chunk);
+    return true;
+  }
+  if (vector_file_stream) { // if the end of the file is not reached, the last (maybe incomplete) line is kept for the next chunk
+    auto end_of_last_complete_line = std::find(chunk.rbegin(), chunk.rend(), '\n').base();
+    rest_of_last_line.assign(end_of_last_complete_line, chunk.end());
+    chunk.erase(end_of_last_complete_line, chunk.end());
+  } else if (chunk.back() != '\n')
+    chunk.push_back('\n');
+  if (num_of_vectors_left >= 0) {
+    const char* end_of_chunk = chunk.data()+chunk.size();
+    const char* position = chunk.data();
+    for (; num_of_vectors_left > 0 && position < end_of_chunk; num_of_vectors_left--)
+      position = (const char*) memchr(position, '\n', end_of_chunk-position)+1; // every line of the chunk ends with '\n'
+    chunk.resize(position-chunk.data());
+  }
+  return true;
+}
+
+void HashTableOnMemory::ParseLines(const char* begin, const char* end_of_part, const char* end_of_chunk, ParsedLines& parsed_lines, const bool only_words) {
+// Parses the lines of a chunk starting at "begin" up to the last line that
+// starts before "end_of_part" (every line ends with '\n' or at
+// "end_of_chunk"). Each line should contain a word followed by the
+// "vector_size_" values of its vector, all separated by whitespaces; missing
+// values are 0. The values are parsed in place, i.e. without copying the
+// tokens into strings, and quantized if they are not stored as doubles. If
+// "only_words" is "true", only the words and the beginnings of their lines
+// are added to "parsed_lines".
   std::vector<double> vector(vector_size_);
-  const int index = GetIndex(tokens[0]);
-  for (int i = 0; i < vector_size_; ++i)
-    // Converts the (std::string) elements of "tokens" that represent the
-    // values of the word vector into the type "double".
-    vector[i] = atof(tokens[i+1].c_str());
-  if (hash_table_[index] != NULL) { // collisions are handled by chaining using a linked list
-    WordVector* current_word_vector = hash_table_[index];
-    while (current_word_vector->next != NULL)
-      current_word_vector = current_word_vector->next;
-    current_word_vector->next = new WordVector(tokens[0], vector);
+  for (const char* line = begin; line < end_of_part; ) {
+    const char* end_of_line = (const char*) memchr(line, '\n', end_of_chunk-line);
+    if (end_of_line == NULL) // the last line of a mapped word vector file (see "ParseRows()")
+      end_of_line = end_of_chunk;
+    const char* next_line = end_of_line+1;
+    if (end_of_line > line && end_of_line[-1] == '\r')
+      end_of_line--;
+    const char* end_of_word = std::find(line, end_of_line, ' ');
+    if (end_of_word == line || !vocabulary_filter_.Contains(line, end_of_word-line)) { // skips empty lines (and lines without a word) and the words not in the vocabulary
+      line = next_line;
+      continue;
+    }
+    if (only_words) {
+      AddParsedWord(line, end_of_word-line, parsed_lines);
+      line = next_line;
+      continue;
+    }
+    const char* position = end_of_word;
+    for (auto& value : vector) {
+      while (position < end_of_line && (*position == ' ' || *position == '\t'))
+        position++;
+      value = 0;
+      const std::from_chars_result result = std::from_chars(position, end_of_line, value);
+      if (result.ec == std::errc())
+        position = result.ptr;
+      else if (position < end_of_line) { // e.g. a leading '+', which "std::from_chars()" does not accept
+        char* end_of_value;
+        value = strtod(position, &end_of_value);
+        position = std::max(std::min((const char*) end_of_value, end_of_line), position+1);
+      }
+    }
+    AddParsedVector(line, end_of_word-line, vector, parsed_lines);
+    line = next_line;
+  }
+}
+
+void HashTableOnMemory::ParseBinaryVectors(const char* chunk, const size_t* begin, const size_t* end, ParsedLines& parsed_lines, const bool only_words) {
+// Parses the binary word vectors of a chunk starting at the offsets from
+// "begin" to "end" (each a word followed by a space and the "vector_size_"
+// values of its vector as floats, see "ReadChunk()"); the floats are copied
+// without any text parsing. If "only_words" is "true", only the words and the
+// beginnings of their word vectors are added to "parsed_lines".
+  std::vector<float> values(vector_size_);
+  std::vector<double> vector(vector_size_);
+  for (const size_t* offset = begin; offset < end; ++offset) {
+    const char* word = chunk+*offset;
+    size_t length = 0;
+    while (word[length] != ' ') // the space exists (see "ReadChunk()")
+      length++;
+    if (!vocabulary_filter_.Contains(word, length))
+      continue;
+    if (only_words) {
+      AddParsedWord(word, length, parsed_lines);
+      continue;
+    }
+    memcpy(values.data(), word+length+1, vector_size_*sizeof(float));
+    std::copy(values.begin(), values.end(), vector.begin());
+    AddParsedVector(word, length, vector, parsed_lines);
+  }
+}
+
+void HashTableOnMemory::AddParsedVector(const char* word, const size_t length, std::vector<double>& vector, ParsedLines& parsed_lines) {
+// Adds "word" (consisting of "length" characters) and its "vector" to
+// "parsed_lines" - unit-normalized and quantized as given by "options_" - as
+// well as the norm of the vector.
+  AddParsedWord(word, length, parsed_lines);
+  double norm = CalculateEuclideanNorm(vector.data(), vector_size_);
+  if (options_.normalize && norm > 0) {
+    for (auto& value : vector)
+      value /= norm;
+  }
+  const size_t offset = parsed_lines.norms.size()*vector_size_;
+  if (options_.precision == kInt8) {
+    parsed_lines.int8_values.resize(offset+vector_size_);
+    parsed_lines.scales.push_back(QuantizeToInt8(vector.data(), &parsed_lines.int8_values[offset]));
+  } else if (options_.precision == kFloat16) {
+    parsed_lines.half_values.resize(offset+vector_size_);
+    QuantizeToHalf(vector.data(), &parsed_lines.half_values[offset]);
   } else
-    hash_table_[index] = new WordVector(tokens[0], vector);
+    parsed_lines.values.insert(parsed_lines.values.end(), vector.begin(), vector.end());
+  if (options_.precision != kFloat64 && !options_.normalize) // the norm of a quantized vector is the norm of the values it stands for
+    norm = CalculateEuclideanNorm(vector.data(), vector_size_);
+  parsed_lines.norms.push_back(norm);
+}
+
+void HashTableOnMemory::AddParsedWord(const char* word, const size_t length, ParsedLines& parsed_lines) {
+// Adds "word" (consisting of "length" characters) and its hash to
+// "parsed_lines", as well as the beginning of its line (i.e. "word") if the
+// word vectors are parsed lazily.
+  parsed_lines.words.append(word, length);
+  parsed_lines.ends_of_words.push_back(parsed_lines.words.size());
+  parsed_lines.hashes.push_back(GetSlotHash(word, length));
+  if (is_lazy_)
+    parsed_lines.lines.push_back(word);
 }
 
-std::vector<std::string> HashTableOnMemory::SplitLine(const std::string& line) {
-// Splits the lines (strings) of the vector file into their tokens and returns
-// all of those tokens in a std::vector. (The tokens within a "line" should be
-// separated by whitespaces.)
-  std::stringstream stream(line);
-  std::string item;
-  std::vector<std::string> tokens(vector_size_+1);
-  for (auto& token : tokens) {
-    std::getline(stream, item, ' ');
-    token = item;
+void HashTableOnMemory::StoreVectors(const ParsedLines& parsed_lines, const char* begin_of_chunk, const long long offset_of_chunk) {
+// Stores the parsed word vectors as new rows and inserts every row into the
+// first empty slot starting at the slot the word's hash refers to (collisions
+// are handled by linear probing). If a word is already stored (in the current
+// slots or in the old slots of a growth in progress), its vector is skipped.
+// The norms of the word vectors were calculated while parsing them, so that
+// comparisons need only the dot product. If only the words were parsed, the
+// offsets of their word vectors in the word vector file are stored instead
+// (the chunk starting at "begin_of_chunk" starts at "offset_of_chunk").
+  // Every insertion migrates enough old slots to finish a growth before the
+  // load factor reaches "options_.max_load_factor" again.
+  const size_t num_of_slots_to_migrate = (size_t) (1/options_.max_load_factor)+2;
+  std::vector<Slot>& slots = loaded_data_.slots, & old_slots = loaded_data_.old_slots;
+  const std::string& words = loaded_data_.words;
+  const std::vector<size_t>& word_offsets = loaded_data_.word_offsets;
+  size_t begin_of_word = 0;
+  for (unsigned i = 0; i < parsed_lines.hashes.size(); begin_of_word = parsed_lines.ends_of_words[i++]) {
+    const unsigned num_of_rows = word_offsets.size()-1;
+    if ((double) num_of_rows+1 > options_.max_load_factor*slots.size())
+      GrowSlots();
+    else if (!old_slots.empty())
+      MigrateSlots(num_of_slots_to_migrate);
+    const char* word = parsed_lines.words.data()+begin_of_word;
+    const size_t length = parsed_lines.ends_of_words[i]-begin_of_word;
+    const unsigned hash = parsed_lines.hashes[i];
+    auto word_of_row_is = [&](const unsigned row) { // see "WordOfRowIs()"
+      return (word_offsets[row+1]-word_offsets[row] == length && words.compare(word_offsets[row], length, word, length) == 0);
+    };
+    bool is_stored = false;
+    if (!old_slots.empty()) {
+      const unsigned old_slot_mask = old_slots.size()-1;
+      for (unsigned slot = hash&old_slot_mask; old_slots[slot].row != kEmptySlot && !is_stored; slot = (slot+1)&old_slot_mask)
+        is_stored = (old_slots[slot].hash == hash && word_of_row_is(old_slots[slot].row));
+    }
+    unsigned slot = hash&slot_mask_;
+    for (; slots[slot].row != kEmptySlot && !is_stored; slot = (slot+1)&slot_mask_)
+      is_stored = (slots[slot].hash == hash && word_of_row_is(slots[slot].row));
+    if (is_stored)
+      continue;
+    slots[slot] = Slot{hash, num_of_rows};
+    loaded_data_.words.append(word, length);
+    loaded_data_.word_offsets.push_back(words.size());
+    if (is_lazy_) {
+      loaded_data_.offsets.push_back(offset_of_chunk+(parsed_lines.lines[i]-begin_of_chunk));
+      continue;
+    }
+    const size_t offset = (size_t) i*vector_size_;
+    if (options_.precision == kInt8) {
+      loaded_data_.int8_vectors.insert(loaded_data_.int8_vectors.end(), parsed_lines.int8_values.begin()+offset, parsed_lines.int8_values.begin()+offset+vector_size_);
+      loaded_data_.scales.push_back(parsed_lines.scales[i]);
+    } else if (options_.precision == kFloat16)
+      loaded_data_.half_vectors.insert(loaded_data_.half_vectors.end(), parsed_lines.half_values.begin()+offset, parsed_lines.half_values.begin()+offset+vector_size_);
+    else
+      loaded_data_.vectors.insert(loaded_data_.vectors.end(), parsed_lines.values.begin()+offset, parsed_lines.values.begin()+offset+vector_size_);
+    loaded_data_.norms.push_back(parsed_lines.norms[i]);
   }
-  return tokens;
+}
+
+void HashTableOnMemory::GrowSlots() {
+// Doubles the number of slots (which is needed if the number of word vectors
+// was underestimated). The rows are not reinserted at once but incrementally:
+// the old slots are kept unchanged until "StoreVectors()" has migrated all of
+// them (see "MigrateSlots()"), so that loading does not stall.
+  MigrateSlots(loaded_data_.old_slots.size());
+  loaded_data_.old_slots.swap(loaded_data_.slots);
+  num_of_migrated_slots_ = 0;
+  slot_mask_ = 2*loaded_data_.old_slots.size()-1;
+  hash_table_size_ = slot_mask_+1;
+  loaded_data_.slots.assign(hash_table_size_, Slot{0, kEmptySlot});
+}
+
+void HashTableOnMemory::MigrateSlots(size_t num_of_slots) {
+// Reinserts the rows of the next "num_of_slots" old slots into the current
+// slots and releases the old slots once all of them are migrated.
+  std::vector<Slot>& slots = loaded_data_.slots, & old_slots = loaded_data_.old_slots;
+  for (; num_of_slots > 0 && num_of_migrated_slots_ < old_slots.size(); --num_of_slots) {
+    const Slot& old_slot = old_slots[num_of_migrated_slots_++];
+    if (old_slot.row == kEmptySlot)
+      continue;
+    unsigned slot = old_slot.hash&slot_mask_;
+    while (slots[slot].row != kEmptySlot)
+      slot = (slot+1)&slot_mask_;
+    slots[slot] = old_slot;
+  }
+  if (num_of_migrated_slots_ == old_slots.size()) {
+    std::vector<Slot>().swap(old_slots);
+    num_of_migrated_slots_ = 0;
+  }
+}
+
+unsigned HashTableOnMemory::GetSlotHash(const char* word, const size_t length) {
+// Returns the 64-bit hash of "word" folded to 32 bits (enough for the number
+// of slots, which refer to "unsigned" rows).
+  const uint64_t hash = GetHash(word, length);
+  return hash^(hash >> 32);
+}
+
+unsigned HashTableOnMemory::GetProbeLength(const unsigned slot) {
+// Returns the number of slots that have to be probed in order to find the word
+// vector stored in "slot" (1 if it is stored in the slot its hash refers to).
+  return ((slot-(slots_[slot].hash&slot_mask_))&slot_mask_)+1;
 }
 
 void HashTableOnMemory::PrintInfo() {
-// Calculates some of the numeric information of the created hash table and
-// passes them to "ShowInfo()" that prints them.
-  int num_of_empty_buckets = 0, highest_num_of_nodes_in_a_bucket = 0, word_vector_num;
-  for (int i = 0; i < hash_table_size_; ++i) {
-    word_vector_num = GetNumOfWordVectors(i);
-    if (word_vector_num == 0)
-      num_of_empty_buckets++;
-    if (highest_num_of_nodes_in_a_bucket < word_vector_num)
-      highest_num_of_nodes_in_a_bucket = word_vector_num;
-  }
-  ShowInfo(num_of_empty_buckets, highest_num_of_nodes_in_a_bucket);
-}
-
-int HashTableOnMemory::GetNumOfWordVectors(const int index) {
-// Counts the number of word vectors (nodes) in a bucket of the
-// "HashTableOnMemory" and returns this number.
-  int count = 0;
-  if (hash_table_[index] == NULL)
-    return 0;
-  else {
-    for (WordVector* it = hash_table_[index]; it != NULL; it = it->next)
-      count++;
+// Prints the most important information regarding the hash table including
+// the distribution of the probe lengths (i.e. the number of slots that have
+// to be probed in order to find a stored word vector).
+  const unsigned kMaxProbeLengthToShow = kMaxBucketLengthToShow;
+  std::vector<unsigned> probe_lengths(kMaxProbeLengthToShow+1, 0);
+  unsigned long long sum_of_probe_lengths = 0;
+  unsigned highest_probe_length = 0, probe_length;
+  for (unsigned slot = 0; slot <= slot_mask_; ++slot) {
+    if (slots_[slot].row == kEmptySlot)
+      continue;
+    probe_length = GetProbeLength(slot);
+    sum_of_probe_lengths += probe_length;
+    highest_probe_length = std::max(highest_probe_length, probe_length);
+    probe_lengths[std::min(probe_length, kMaxProbeLengthToShow)]++;
+  }
+  std::cout << "\tSize of vectors = " << vector_size_ << '\n';
+  std::cout << "\tNumber of stored word vectors = " << vector_num_ << '\n';
+  std::cout << "\tHash function = " << GetNameOfHashFunction(hash_function_) << '\n';
+  std::cout << "\tNumber of slots = " << hash_table_size_ << '\n';
+  std::cout << "\tLoad factor = " << (double) vector_num_/hash_table_size_ << '\n';
+  std::cout << "\tAverage probe length = " << (double) sum_of_probe_lengths/std::max(vector_num_, 1) << '\n';
+  std::cout << "\tHighest probe length = " << highest_probe_length << '\n';
+  for (unsigned i = 1; i <= kMaxProbeLengthToShow; ++i)
+    std::cout << "\tPercentage of word vectors with probe length " << ((i == kMaxProbeLengthToShow)? ">= " : "") << i << " = " << 100*((double) probe_lengths[i]/std::max(vector_num_, 1)) << " %\n";
+  const size_t bytes_of_vectors = (size_t) GetNumOfRows()*vector_size_*((options_.precision == kInt8)? sizeof(int8_t) : ((options_.precision == kFloat16)? sizeof(uint16_t) : sizeof(double)))+((options_.precision == kInt8)? GetNumOfRows()*sizeof(float) : 0);
+  std::cout << "\tMemory of the word vectors = " << bytes_of_vectors/1048576. << " MB (" << ((options_.precision == kInt8)? "int8" : ((options_.precision == kFloat16)? "fp16" : "f64")) << ((snapshot_ != NULL)? ", mapped from the snapshot" : "") << ")\n";
+  if (is_lazy_)
+    std::cout << "\tParsed word vectors = " << num_of_parsed_rows_.load() << " (the others are parsed when they are needed first)\n";
+}
+
+void HashTableOnMemory::ReportMemory() {
+// Reports the memory needed by the word vectors, the words and the slots (and
+// the norms) to "kStatistics".
+  if (snapshot_ != NULL) {
+    kStatistics.SetMemory("hash_table_on_memory.snapshot", size_of_snapshot_); // mapped, i.e. shared with other processes mapping the snapshot
+    return;
+  }
+  kStatistics.SetMemory("hash_table_on_memory.vectors", loaded_data_.vectors.capacity()*sizeof(double)+loaded_data_.half_vectors.capacity()*sizeof(uint16_t)+loaded_data_.int8_vectors.capacity()*sizeof(int8_t)+loaded_data_.scales.capacity()*sizeof(float));
+  if (is_lazy_)
+    kStatistics.SetMemory("hash_table_on_memory.lazy_vectors", size_of_lazy_data_); // reserved, but only the pages of the parsed word vectors are allocated
+  kStatistics.SetMemory("hash_table_on_memory.keys", loaded_data_.words.capacity()+(loaded_data_.word_offsets.capacity()+loaded_data_.offsets.capacity())*sizeof(size_t));
+  kStatistics.SetMemory("hash_table_on_memory.table", (loaded_data_.slots.capacity()+loaded_data_.old_slots.capacity())*sizeof(Slot)+loaded_data_.norms.capacity()*sizeof(double));
+}
+
+void HashTableOnMemory::ShowQuantizationError(const int num_of_pairs) {
+// Compares the cosine similarities of "num_of_pairs" random pairs of word
+// vectors calculated with the quantized word vectors with those calculated
+// with the full-precision word vectors (read again from "input_file_") and
+// prints the maximum and the mean absolute error.
+  if (options_.precision == kFloat64) {
+    std::cout << "\tThe word vectors are stored with full precision.\n";
+    return;
+  } else if (IsSnapshotFile(input_file_)) {
+    std::cout << "\tThe full-precision word vectors are not contained in the snapshot \"" << input_file_ << "\".\n";
+    return;
+  }
+  if (GetNumOfRows() < 2 || num_of_pairs < 1)
+    return;
+  std::mt19937 generator(100);
+  std::uniform_int_distribution<unsigned> random_row(0, GetNumOfRows()-1);
+  std::vector<std::pair<unsigned, unsigned>> pairs(num_of_pairs);
+  std::unordered_map<std::string, std::vector<double>> full_precision_vectors;
+  for (auto& pair : pairs) {
+    pair.first = random_row(generator);
+    do {
+      pair.second = random_row(generator);
+    } while (pair.second == pair.first);
+    full_precision_vectors[GetWordOfRow(pair.first)];
+    full_precision_vectors[GetWordOfRow(pair.second)];
+    ParseRow(pair.first);
+    ParseRow(pair.second);
+  }
+  std::cout << "\tReading " << full_precision_vectors.size() << " full-precision word vectors..." << std::endl;
+  WordVectorFileReader word_vector_file_reader(input_file_);
+  std::string line;
+  size_t num_of_vectors_read = 0;
+  while (num_of_vectors_read < full_precision_vectors.size() && word_vector_file_reader.ReadLine(line)) {
+    auto full_precision_vector = full_precision_vectors.find(line.substr(0, line.find(' ')));
+    if (full_precision_vector == full_precision_vectors.end() || !full_precision_vector->second.empty()) // only the first vector of a word is stored
+      continue;
+    full_precision_vector->second.resize(vector_size_);
+    const char* value = line.c_str()+line.find(' ');
+    char* end_of_value;
+    for (auto& element : full_precision_vector->second) {
+      element = strtod(value, &end_of_value);
+      value = end_of_value;
+    }
+    num_of_vectors_read++;
   }
-  return count;
+  double highest_error = 0, sum_of_errors = 0;
+  int num_of_compared_pairs = 0;
+  for (auto& pair : pairs) {
+    const std::vector<double>& vector_0 = full_precision_vectors[GetWordOfRow(pair.first)];
+    const std::vector<double>& vector_1 = full_precision_vectors[GetWordOfRow(pair.second)];
+    const double norm_0 = CalculateEuclideanNorm(vector_0.data(), vector_size_), norm_1 = CalculateEuclideanNorm(vector_1.data(), vector_size_);
+    if (norm_0 == 0 || norm_1 == 0 || norms_[pair.first] == 0 || norms_[pair.second] == 0)
+      continue;
+    const double error = std::fabs(CalculateCosineSimilarity(GetDotProductOfRows(pair.first, pair.second), norms_[pair.first], norms_[pair.second])-CalculateCosineSimilarity(CalculateDotProduct(vector_0.data(), vector_1.data(), vector_size_), norm_0, norm_1));
+    highest_error = std::max(highest_error, error);
+    sum_of_errors += error;
+    num_of_compared_pairs++;
+  }
+  std::cout << "\tError of the cosine similarities of " << num_of_compared_pairs << " random pairs of word vectors (" << ((options_.precision == kInt8)? "int8" : "fp16") << " vs. full precision):\n";
+  std::cout << "\t Maximum absolute error = " << highest_error << '\n';
+  std::cout << "\t Mean absolute error = " << sum_of_errors/std::max(num_of_compared_pairs, 1) << '\n';
 }
 
 void HashTableOnMemory::CompareWordVectors(const std::vector<std::string>& words) {
 // Starts searching for the word vectors corresponding to the "words" by
-// passing the "words" to "GetVector()". If a word cannot be found in the
-// "HashTableOnMemory", "GetVector()" returns an empty vector. If so, the
-// method stops by returning. If both word vectors are found, they will be
-// passed to "ShowSimilarity()".
-  std::vector<std::vector<double>> vectors(2, std::vector<double>(vector_size_));
-  for (unsigned i = 0; i < words.size(); ++i) {
-    vectors[i] = GetVector(words[i]);
-    if (vectors[i].empty())
+// passing the "words" to "GetRow()". If a word cannot be found in the
+// "HashTableOnMemory", the method stops by returning. If both word vectors are
+// found, they will be passed to "ShowSimilarity()".
+  int rows[2];
+  for (unsigned i = 0; i < 2; ++i) {
+    rows[i] = GetRow(words[i]);
+    if (rows[i] < 0) {
+      std::cout << "\t\"" << words[i] << "\" couldn't be found in your data! Comparison impossible.\n\n";
       return;
+    }
   }
-  ShowSimilarity(words, vectors);
+  double dot_product;
+  {
+    StatisticsTimer timer(Statistics::kKernelTime, Statistics::kSimilarityOperation);
+    if (kStatistics.IsEnabled())
+      kStatistics.Add(Statistics::kKernelCalls, 1);
+    dot_product = GetDotProductOfRows(rows[0], rows[1]);
+  }
+  ShowSimilarity(words, dot_product, norms_[rows[0]], norms_[rows[1]]);
+}
+
+void HashTableOnMemory::GetSimilarityOfRows(const unsigned row_0, const unsigned row_1, double& cosine_similarity, double& euclidean_distance) {
+// Calculates the cosine similarity and the Euclidean distance of the word
+// vectors of "row_0" and "row_1".
+  StatisticsTimer timer(Statistics::kKernelTime, Statistics::kSimilarityOperation);
+  if (kStatistics.IsEnabled())
+    kStatistics.Add(Statistics::kKernelCalls, 1);
+  const double dot_product = GetDotProductOfRows(row_0, row_1);
+  cosine_similarity = CalculateCosineSimilarity(dot_product, norms_[row_0], norms_[row_1]);
+  euclidean_distance = CalculateEuclideanDistance(dot_product, norms_[row_0], norms_[row_1]);
 }
 
-std::vector<double> HashTableOnMemory::GetVector(const std::string& word) {
-// Given a word (std::string) this method returns the corresponding vector if
-// the word and its vector are stored in the "HashTableOnMemory"; if not, an
-// empty vector will be returned.
-  const int index = GetIndex(word);
-  if (hash_table_[index] != NULL) {
-    for (WordVector* it = hash_table_[index]; it != NULL; it = it->next)
-      if (it->word == word) return it->vector;
+int HashTableOnMemory::GetRow(const std::string& word) {
+// Given a word (std::string) this method returns the row of the corresponding
+// vector if the word and its vector are stored in the "HashTableOnMemory"; if
+// not, -1 will be returned.
+  StatisticsTimer timer(Statistics::kLookupTime, Statistics::kLookupOperation);
+  const unsigned hash = GetSlotHash(word);
+  unsigned slot = hash&slot_mask_;
+  int row = -1;
+  for (; slots_[slot].row != kEmptySlot; slot = (slot+1)&slot_mask_) {
+    if (slots_[slot].hash == hash && WordOfRowIs(slots_[slot].row, word)) {
+      row = slots_[slot].row;
+      ParseRow(row);
+      break;
+    }
+  }
+  if (kStatistics.IsEnabled()) { // the probed slots are the ones from the slot the hash refers to up to "slot"
+    kStatistics.Add(Statistics::kLookups, 1);
+    kStatistics.Add(Statistics::kProbes, ((slot-(hash&slot_mask_))&slot_mask_)+1);
+    if (row < 0)
+      kStatistics.Add(Statistics::kLookupMisses, 1);
   }
-  std::cout << "\t\"" << word << "\" couldn't be found in your data! Comparison impossible.\n\n";
-  return std::vector<double>();
+  return row;
 }
 
-HashTableWriter::HashTableWriter(const std::string& input_file, const std::string& output_file)
-    : HashTable(input_file),
+std::vector<double> HashTableOnMemory::GetVectorOfWord(const std::string& word, double& norm) {
+// Returns the (original, i.e. not normalized) word vector of "word" and sets
+// "norm" to its Euclidean norm; if "word" couldn't be found, an empty
+// std::vector will be returned.
+  const int row = GetRow(word);
+  if (row < 0)
+    return std::vector<double>();
+  std::vector<double> vector(vector_size_);
+  GetVectorOfRow(row, vector.data());
+  norm = norms_[row];
+  if (options_.normalize) {
+    for (auto& element : vector)
+      element *= norm;
+  }
+  return vector;
+}
+
+HashTableWriter::HashTableWriter(const std::string& input_file, const std::string& output_file, const HashTableWriterOptions& options)
+    : HashTable(input_file, (options.minimal_perfect_hash && !options.compact)? kMinimalPerfectHash : kMurmurHash64),
       input_file_(input_file),
-      output_file_(output_file) {
+      output_file_(GetOutputFile(input_file, output_file, options)),
+      options_(options),
+      vocabulary_filter_(options.max_words, options.vocabulary_file),
+      num_of_empty_buckets_(0),
+      num_of_buckets_per_length_(1, 0),
+      bytes_written_(0) {
+  minimal_perfect_hash_ = &minimal_perfect_hash_of_words_;
+  options_.max_load_factor = std::max(kMinMaxLoadFactor, options_.max_load_factor);
   CreateHashTable();
 }
 
 HashTableWriter::~HashTableWriter() {}
 
+std::string HashTableWriter::GetOutputFile(const std::string& input_file, const std::string& output_file, const HashTableWriterOptions& options) {
+// Returns the file the hash table is written to: "output_file", its next
+// delta segment if "options.append" is set or a temporary file replacing the
+// hash table file "input_file" afterwards if "options.compact" is set.
+  if (options.compact)
+    return input_file+".compacting";
+  if (options.append)
+    return output_file+kDeltaSegmentExtension+std::to_string(GetDeltaSegments(output_file).size()+1);
+  return output_file;
+}
+
 void HashTableWriter::CreateHashTable() {
 // Creates a hash table containing the word vectors from the "input_file_" and
-// saves it in the "output_file_".
-  if (!HashTableIsValid())
+// saves it in the "output_file_". If "input_file_" fits into the
+// "options_.memory_budget" it is read only once and its lines are grouped by bucket on
+// memory; otherwise the lines are distributed to spill files each containing
+// a consecutive range of buckets. Either way the running time is linear in the
+// size of "input_file_".
+  if (vector_size_ < 1) // "vector_num_" is not known yet, so that "HashTableIsValid()" cannot be used
     return;
+  StatisticsTimer timer(Statistics::kWriterTime);
+  if ((options_.append && !CanBeAppended()) || !vocabulary_filter_.IsValid())
+    return;
+  const long long input_file_size = InputFileStream::GetEstimatedSize(input_file_);
   std::cout << "Output file (\"hash table file\"): " << output_file_ << '\n';
-  std::cout << "\tCreating hash table file with " << hash_table_size_ << " buckets..." << std::endl;
-  std::string vector_line, current_bucket;
   std::ofstream out;
-  int num_of_empty_buckets = 0, num_of_nodes_in_current_bucket, highest_num_of_nodes_in_a_bucket, flush_interval_factor = 1;
-  out.open(output_file_, std::ios_base::app);
-  out << vector_size_ << ',' << vector_num_ << ',' << hash_table_size_ << '\n';
-  BinaryTree indices;
-  // All vectors of a bucket get connected to a single std::string, which will
-  // be written to the hash table file.
-  for (int bucket_num = 0; bucket_num < hash_table_size_; ++bucket_num) {
-    num_of_nodes_in_current_bucket = 0;
-    std::ifstream input_file_stream(input_file_);
-    current_bucket = std::to_string(bucket_num);
-    // Every word vector (i.e. every line of the "input_file_") gets checked if
-    // it should go into the current bucket.
-    for (int i = 0; i < vector_num_; ++i) {
-      std::getline(input_file_stream, vector_line);
-      // If the "vector_line" (i.e. the word vector) was either already added
-      // to "current_bucket" or already written to the "output_file_" the line
-      // will be skipped.
-      if (!indices.IndexIsAlreadyStored(i) && VectorInCurrentBucket(vector_line, bucket_num)) {
-        current_bucket += ','+vector_line; // collisions are handled by chaining
-        num_of_nodes_in_current_bucket++;
-        // The index of the line gets stored in a binary tree in order to skip
-        // the line next time due to the condition of the if-statement (this
-        // reduces the average running time).
-        indices.AddIndex(i);
-      }
-    }
-    input_file_stream.close();
-    if (num_of_nodes_in_current_bucket > highest_num_of_nodes_in_a_bucket)
-      highest_num_of_nodes_in_a_bucket = num_of_nodes_in_current_bucket;
-    if (current_bucket != std::to_string(bucket_num))
-      out << current_bucket << '\n';
-    else
-      num_of_empty_buckets++;
-    if (bucket_num == (500*flush_interval_factor-1)) { // flushes in an interval of 500 (with respect to "bucket_num")
-      out.flush();
-      std::cout << '\t' << bucket_num+1 << " buckets ready..." << std::endl;
-      flush_interval_factor++;
-    }
+  out.open(output_file_, (options_.compact? std::ios_base::trunc : std::ios_base::app)|std::ios_base::binary);
+  bytes_written_ = std::max(0LL, GetFileSize(output_file_));
+  const bool output_file_is_new = (bytes_written_ == 0);
+  bool created;
+  if (options_.compact)
+    created = CompactHashTable(out);
+  else
+    created = (input_file_size <= options_.memory_budget)? CreateHashTableOnMemory(out) : CreateHashTableWithSpillFiles(out, input_file_size);
+  if (!created) {
+    if (options_.compact || output_file_is_new)
+      std::remove(output_file_.c_str());
+    return;
   }
+  out.close();
+  WriteOffsetIndex();
+  if (options_.compact && !ReplaceHashTableFile())
+    return;
+  if (kStatistics.IsEnabled())
+    kStatistics.Add(Statistics::kBytesWritten, bytes_written_);
   std::cout << "\t---Done.\n";
-  std::cout << "Hash table created and saved (\"" << output_file_ << "\").\n";
-  ShowInfo(num_of_empty_buckets, highest_num_of_nodes_in_a_bucket);
+  std::cout << "Hash table created and saved (\"" << (options_.compact? input_file_ : output_file_) << "\").\n";
+  ShowInfo(num_of_empty_buckets_, num_of_buckets_per_length_);
   std::cout << "Program terminated.";
 }
 
-HashTableReader::HashTableReader(const std::string& hash_table_file)
+int HashTableWriter::CountFilteredVectors() {
+// Returns the number of word vectors of "input_file_" that pass
+// "vocabulary_filter_" (only the first "max_words" ones are counted if there
+// is no vocabulary file) or -1 if the file is corrupt.
+  if (!vocabulary_filter_.HasVocabulary())
+    return vocabulary_filter_.GetMaxNumOfVectors(CountVectors());
+  std::cout << "\tCounting the word vectors of the vocabulary..." << std::endl;
+  int vector_num = 0;
+  std::string line;
+  WordVectorFileReader word_vector_file_reader(input_file_, &vocabulary_filter_);
+  while (word_vector_file_reader.ReadLine(line))
+    vector_num++;
+  if (word_vector_file_reader.IsCorrupt())
+    return -1;
+  std::cout << "\t---Done." << std::endl;
+  return vector_num;
+}
+
+bool HashTableWriter::CreateHashTableOnMemory(std::ofstream& out) {
+// Reads all lines of "input_file_" at once; "vector_num_" and therefore the
+// number of buckets are known afterwards, so that the lines can be grouped and
+// written without reading "input_file_" again.
+  std::cout << "\tLoading data..." << std::endl;
+  std::vector<std::string> lines;
+  if (input_file_info_.num_of_vectors >= 0)
+    lines.reserve(vocabulary_filter_.GetMaxNumOfVectors(input_file_info_.num_of_vectors));
+  std::string line;
+  WordVectorFileReader word_vector_file_reader(input_file_, &vocabulary_filter_);
+  while (word_vector_file_reader.ReadLine(line))
+    lines.push_back(line);
+  if (word_vector_file_reader.IsCorrupt())
+    return false;
+  vector_num_ = lines.size();
+  if (!SetNumOfBuckets(&lines))
+    return false;
+  std::cout << "\tCreating hash table file with " << hash_table_size_ << " buckets..." << std::endl;
+  WriteHeader(out);
+  WriteBuckets(out, lines, 0, hash_table_size_-1);
+  return true;
+}
+
+bool HashTableWriter::CreateHashTableWithSpillFiles(std::ofstream& out, const long long input_file_size) {
+// Distributes the lines of "input_file_" to "num_of_spill_files" temporary
+// files - every spill file gets the lines of a consecutive range of buckets
+// and is small enough to be grouped on memory afterwards. The spill files are
+// processed in the order of their buckets and deleted right after that.
+  if (!options_.minimal_perfect_hash)
+    vector_num_ = vocabulary_filter_.IsActive()? CountFilteredVectors() : CountVectors(); // the number of buckets has to be known before the lines can be distributed
+  if (vector_num_ < 0 || !SetNumOfBuckets(NULL))
+    return false;
+  const int num_of_spill_files = GetNumOfSpillFiles(input_file_size);
+  std::cout << "\tCreating hash table file with " << hash_table_size_ << " buckets using " << num_of_spill_files << " spill files..." << std::endl;
+  std::vector<std::string> spill_files;
+  std::vector<std::ofstream> spill_file_streams;
+  if (!OpenSpillFiles(num_of_spill_files, spill_files, spill_file_streams))
+    return false;
+  std::string line;
+  WordVectorFileReader word_vector_file_reader(input_file_, &vocabulary_filter_);
+  while (word_vector_file_reader.ReadLine(line))
+    spill_file_streams[GetSpillFileOfBucket(GetBucketOfLine(line), num_of_spill_files)] << line << '\n';
+  for (auto& spill_file_stream : spill_file_streams)
+    spill_file_stream.close();
+  if (word_vector_file_reader.IsCorrupt()) {
+    for (auto& spill_file : spill_files)
+      std::remove(spill_file.c_str());
+    return false;
+  }
+  WriteHeader(out);
+  WriteBucketsFromSpillFiles(out, spill_files, false);
+  return true;
+}
+
+int HashTableWriter::GetNumOfSpillFiles(const long long input_file_size) {
+// Returns the number of spill files that keeps the lines of every spill file
+// within "options_.memory_budget" (a budget of 0 bytes or less is treated as
+// 1 byte) - but at most one spill file per bucket and "kMaxNumOfSpillFiles".
+  return std::min({(long long) hash_table_size_, kMaxNumOfSpillFiles, input_file_size/std::max(1LL, options_.memory_budget)+1});
+}
+
+bool HashTableWriter::OpenSpillFiles(const int num_of_spill_files, std::vector<std::string>& spill_files, std::vector<std::ofstream>& spill_file_streams) {
+// Creates "num_of_spill_files" temporary files next to "output_file_" and
+// returns "false" (after removing them again) if that is not possible.
+  spill_files.resize(num_of_spill_files);
+  spill_file_streams.resize(num_of_spill_files);
+  for (int i = 0; i < num_of_spill_files; ++i) {
+    spill_files[i] = output_file_+".spill"+std::to_string(i);
+    spill_file_streams[i].open(spill_files[i], std::ios_base::trunc);
+    if (!spill_file_streams[i].is_open()) {
+      std::cout << "ERROR: CREATING SPILL FILE \"" << spill_files[i] << "\" FAILED!\n";
+      for (int j = 0; j <= i; ++j)
+        std::remove(spill_files[j].c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+void HashTableWriter::WriteBucketsFromSpillFiles(std::ofstream& out, const std::vector<std::string>& spill_files, const bool lines_have_norms) {
+// Writes the buckets of the lines distributed to the "spill_files" (see
+// "GetSpillFileOfBucket()") to "out". The spill files are processed in the
+// order of their buckets and deleted right after that.
+  const int num_of_spill_files = spill_files.size();
+  std::string line;
+  std::vector<std::string> lines;
+  for (int i = 0; i < num_of_spill_files; ++i) {
+    lines.clear();
+    std::ifstream spill_file_stream(spill_files[i]);
+    while (std::getline(spill_file_stream, line))
+      lines.push_back(line);
+    spill_file_stream.close();
+    std::remove(spill_files[i].c_str());
+    // The first bucket of a spill file is the smallest bucket whose lines are
+    // written to it (see "GetSpillFileOfBucket()").
+    const int first_bucket = ((long long) i*hash_table_size_+num_of_spill_files-1)/num_of_spill_files;
+    const int last_bucket = ((long long) (i+1)*hash_table_size_+num_of_spill_files-1)/num_of_spill_files-1;
+    WriteBuckets(out, lines, first_bucket, last_bucket, lines_have_norms);
+    out.flush();
+    std::cout << '\t' << i+1 << " of " << num_of_spill_files << " spill files ready..." << std::endl;
+  }
+}
+
+bool HashTableWriter::SetNumOfBuckets(const std::vector<std::string>* lines) {
+// Sets "hash_table_size_" with respect to "options_.max_load_factor" - or, if
+// "options_.minimal_perfect_hash" is set, to the number of distinct words:
+// the minimal perfect hash is built from the hashes of the words of "lines"
+// (or of "input_file_" if "lines" is NULL, which sets "vector_num_" as well)
+// and saved next to "output_file_". Returns "false" if saving failed (or if
+// "input_file_" is corrupt).
+  if (!options_.minimal_perfect_hash) {
+    SetHashTableSize(options_.max_load_factor);
+    return true;
+  }
+  std::vector<uint64_t> hashes;
+  auto add_hash_of_line = [&](const std::string& line) {
+    hashes.push_back(GetMurmurHash64(line.data(), std::min(line.find(' '), line.size())));
+  };
+  if (lines != NULL) {
+    hashes.reserve(lines->size());
+    for (auto& line : *lines)
+      add_hash_of_line(line);
+  } else {
+    std::cout << "\tHashing the words..." << std::endl;
+    std::string line;
+    WordVectorFileReader word_vector_file_reader(input_file_, &vocabulary_filter_);
+    while (word_vector_file_reader.ReadLine(line))
+      add_hash_of_line(line);
+    if (word_vector_file_reader.IsCorrupt())
+      return false;
+    vector_num_ = hashes.size();
+  }
+  ThreadPool thread_pool(options_.num_of_threads);
+  std::cout << "\tBuilding minimal perfect hash using " << thread_pool.GetNumOfThreads() << " threads..." << std::endl;
+  minimal_perfect_hash_of_words_.Build(hashes, thread_pool);
+  hash_table_size_ = std::max<uint64_t>(1, minimal_perfect_hash_of_words_.GetNumOfKeys());
+  std::cout << "\t---Done (" << 8.0*minimal_perfect_hash_of_words_.GetSizeInBytes()/hash_table_size_ << " bits per word).\n";
+  return minimal_perfect_hash_of_words_.Save(output_file_+kMinimalPerfectHashExtension);
+}
+
+void HashTableWriter::WriteHeader(std::ofstream& out) {
+// Writes the first line of the hash table file containing the most important
+// values of the hash table (see "HashTableReader::GetHashTableValues()").
+  const std::string header = std::to_string(vector_size_)+','+std::to_string(vector_num_)+','+std::to_string(hash_table_size_)+','+std::to_string(hash_function_)+'\n';
+  out << header;
+  bytes_written_ += header.size();
+  bucket_offsets_.assign(hash_table_size_, -1);
+}
+
+void HashTableWriter::WriteBuckets(std::ofstream& out, const std::vector<std::string>& lines, const int first_bucket, const int last_bucket, const bool lines_have_norms) {
+// Writes the buckets "first_bucket" to "last_bucket" containing the "lines"
+// to "out" ("lines_have_norms" is set if the lines are word vectors of a hash
+// table file already). The lines are sorted by their buckets with a counting
+// sort, which keeps the order of the lines within a bucket as in "input_file_".
+  const int num_of_buckets = last_bucket-first_bucket+1;
+  std::vector<int> buckets_of_lines(lines.size());
+  std::vector<unsigned> bucket_starts(num_of_buckets+1, 0);
+  for (unsigned i = 0; i < lines.size(); ++i) {
+    buckets_of_lines[i] = GetBucketOfLine(lines[i])-first_bucket;
+    bucket_starts[buckets_of_lines[i]+1]++;
+  }
+  std::partial_sum(bucket_starts.begin(), bucket_starts.end(), bucket_starts.begin());
+  std::vector<unsigned> sorted_lines(lines.size());
+  std::vector<unsigned> positions(bucket_starts.begin(), bucket_starts.end()-1);
+  for (unsigned i = 0; i < lines.size(); ++i)
+    sorted_lines[positions[buckets_of_lines[i]]++] = i;
+  // All vectors of a bucket get connected to a single line of the hash table
+  // file (collisions are handled by chaining).
+  std::string bucket_line;
+  for (int bucket = 0; bucket < num_of_buckets; ++bucket) {
+    const unsigned num_of_nodes_in_current_bucket = bucket_starts[bucket+1]-bucket_starts[bucket];
+    if (num_of_nodes_in_current_bucket == 0) {
+      num_of_empty_buckets_++;
+      continue;
+    }
+    if (num_of_nodes_in_current_bucket >= num_of_buckets_per_length_.size())
+      num_of_buckets_per_length_.resize(num_of_nodes_in_current_bucket+1, 0);
+    num_of_buckets_per_length_[num_of_nodes_in_current_bucket]++;
+    bucket_line = std::to_string(first_bucket+bucket);
+    for (unsigned i = bucket_starts[bucket]; i < bucket_starts[bucket+1]; ++i)
+      bucket_line += ','+(lines_have_norms? lines[sorted_lines[i]] : GetWordVectorWithNorm(lines[sorted_lines[i]]));
+    bucket_line += '\n';
+    out << bucket_line;
+    bucket_offsets_[first_bucket+bucket] = bytes_written_;
+    bytes_written_ += bucket_line.size();
+  }
+}
+
+std::string HashTableWriter::GetWordVectorWithNorm(const std::string& line) {
+// Returns the word vector of "line" followed by its Euclidean norm, so that
+// "HashTableReader" does not have to calculate the norm for every comparison.
+// If the word vectors are quantized, the values are replaced by "@f16" and the
+// hexadecimal fp16 values or by "@i8", the scale and the hexadecimal int8
+// values (the norm is the norm of the values the quantized vector stands for).
+  const size_t end_of_word = line.find_first_of(' ');
+  const size_t end_of_line = line.find_last_not_of(" \r")+1;
+  const char* value = line.c_str()+end_of_word;
+  char* end_of_value;
+  std::vector<double> vector(vector_size_);
+  for (auto& element : vector) {
+    element = strtod(value, &end_of_value);
+    value = end_of_value;
+  }
+  char norm[32];
+  if (options_.precision == kFloat64) {
+    snprintf(norm, sizeof(norm), " %.17g", CalculateEuclideanNorm(vector.data(), vector_size_));
+    return line.substr(0, end_of_line)+norm;
+  }
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::string word_vector = line.substr(0, end_of_word);
+  if (options_.precision == kInt8) {
+    std::vector<int8_t> quantized_vector(vector_size_);
+    char scale[32];
+    snprintf(scale, sizeof(scale), " @i8 %.9g ", QuantizeToInt8(vector.data(), quantized_vector.data()));
+    word_vector += scale;
+    for (auto& element : quantized_vector) {
+      word_vector += kHexDigits[(uint8_t) element >> 4];
+      word_vector += kHexDigits[(uint8_t) element&15];
+    }
+  } else {
+    std::vector<uint16_t> quantized_vector(vector_size_);
+    QuantizeToHalf(vector.data(), quantized_vector.data());
+    word_vector += " @f16 ";
+    for (auto& element : quantized_vector) {
+      for (int shift = 12; shift >= 0; shift -= 4)
+        word_vector += kHexDigits[(element >> shift)&15];
+    }
+  }
+  snprintf(norm, sizeof(norm), " %.17g", CalculateEuclideanNorm(vector.data(), vector_size_));
+  return word_vector+norm;
+}
+
+void HashTableWriter::WriteOffsetIndex() {
+// Writes the byte offsets of the buckets to the offset index file (see
+// "kOffsetIndexMagic"), which allows "HashTableReader" to jump directly to the
+// buckets in question.
+  std::ofstream out(output_file_+kOffsetIndexExtension, std::ios_base::trunc|std::ios_base::binary);
+  const long long values[2] = {bytes_written_, hash_table_size_};
+  out.write(kOffsetIndexMagic.data(), kOffsetIndexMagic.size());
+  out.write((const char*) values, sizeof(values));
+  out.write((const char*) bucket_offsets_.data(), bucket_offsets_.size()*sizeof(long long));
+  if (!out)
+    std::cout << "WARNING: WRITING THE OFFSET INDEX FILE \"" << output_file_+kOffsetIndexExtension << "\" FAILED!\n";
+}
+
+HashTableReader::HashTableReader(const std::string& hash_table_file, const HashTableReaderOptions& options)
     : hash_table_file_(hash_table_file),
-      hash_table_values_(GetHashTableValues()) {
-  std::cout << "Your hash table file contains\n\t" << hash_table_values_[1] << " word vectors\n\twith " << hash_table_values_[0] << " dimensions in " << hash_table_values_[2] << " buckets.\n";
+      hash_table_values_(GetHashTableValues(hash_table_file)),
+      hash_table_file_stream_(hash_table_file, std::ios_base::binary),
+      vector_cache_(options.vector_cache_size),
+      bucket_cache_(options.bucket_cache_size) {
+  if (GetHashFunction() == kMinimalPerfectHash) {
+    minimal_perfect_hash_.reset(new MinimalPerfectHash());
+    if (!minimal_perfect_hash_->Load(hash_table_file_+kMinimalPerfectHashExtension) || minimal_perfect_hash_->GetNumOfKeys() != (uint64_t) hash_table_values_[2])
+      minimal_perfect_hash_.reset(); // no word can be found then
+  }
+  if (options.read_delta_segments) {
+    std::cout << "Your hash table file contains\n\t" << hash_table_values_[1] << " word vectors\n\twith " << hash_table_values_[0] << " dimensions in " << hash_table_values_[2] << " buckets\n\t(hash function: " << HashTable::GetNameOfHashFunction(GetHashFunction()) << ").\n";
+    OpenDeltaSegments();
+  }
+  LoadOffsetIndex();
 }
 
-HashTableReader::~HashTableReader() {}
+HashTableReader::~HashTableReader() {
+  if (kStatistics.IsEnabled()) {
+    kStatistics.SetMemory("hash_table_reader.vector_cache", vector_cache_.GetSize());
+    kStatistics.SetMemory("hash_table_reader.bucket_cache", bucket_cache_.GetSize());
+    kStatistics.SetMemory("hash_table_reader.offset_index", bucket_offsets_.capacity()*sizeof(long long));
+    if (minimal_perfect_hash_)
+      kStatistics.SetMemory("hash_table_reader.minimal_perfect_hash", minimal_perfect_hash_->GetMemoryUsage());
+  }
+}
 
-std::vector<int> HashTableReader::GetHashTableValues() {
+std::vector<int> HashTableReader::GetHashTableValues(const std::string& hash_table_file) {
 // Reads the first line of the hash table file that contains the most important
 // values of the hash table - they will be returned in a std::vector<int> with
 // the value corresponding to the index 0 being the vector size (i.e. the
 // number of dimensions of the vectors), the value corresponding to the index 1
-// being the number of vectors in the hash table, and the value corresponding
-// to the index 2 being the number of buckets the hash table has.
-  std::ifstream input_file_stream(hash_table_file_);
+// being the number of vectors in the hash table, the value corresponding to
+// the index 2 being the number of buckets the hash table has, and the value
+// corresponding to the index 3 being the hash function (see "HashFunction";
+// files written before the hash function was recorded contain only the first
+// three values and use "kPrimeHash"). All values are 0 if "hash_table_file"
+// cannot be read.
+  std::ifstream input_file_stream(hash_table_file);
   std::string first_line, value;
   std::getline(input_file_stream, first_line);
   std::stringstream stream(first_line);
-  std::vector<int> hash_table_values(3);
+  std::vector<int> hash_table_values(4, kPrimeHash);
   for (auto& hash_table_value : hash_table_values) {
-    std::getline(stream, value, ',');
-    hash_table_value = std::stoi(value);
+    if (!std::getline(stream, value, ','))
+      break;
+    hash_table_value = atoi(value.c_str());
   }
   return hash_table_values;
 }
 
-void HashTableReader::CompareWordVectors(const std::vector<std::string>& words) {
-// Creates a "HashTable" and starts the comparison of the "words".
-  HashTable HT(hash_table_values_[2]);
-  GetVectors(HT, words);
+void HashTableReader::OpenDeltaSegments() {
+// Opens the delta segments of the hash table file (see
+// "kDeltaSegmentExtension"), which are read without caches of their own (the
+// word vectors found in them are cached by this "HashTableReader").
+  HashTableReaderOptions delta_segment_options;
+  delta_segment_options.vector_cache_size = 0;
+  delta_segment_options.read_delta_segments = false;
+  int num_of_word_vectors = 0;
+  for (auto& delta_segment : HashTable::GetDeltaSegments(hash_table_file_)) {
+    std::unique_ptr<HashTableReader> delta_segment_reader(new HashTableReader(delta_segment, delta_segment_options));
+    if (delta_segment_reader->GetVectorSize() != GetVectorSize()) {
+      std::cout << "WARNING: THE DELTA SEGMENT \"" << delta_segment << "\" DOES NOT FIT THE HASH TABLE FILE - it will be ignored.\n";
+      continue;
+    }
+    num_of_word_vectors += delta_segment_reader->hash_table_values_[1];
+    delta_segments_.insert(delta_segments_.begin(), std::move(delta_segment_reader));
+  }
+  if (!delta_segments_.empty())
+    std::cout << "\tIts " << delta_segments_.size() << " delta segment(s) contain " << num_of_word_vectors << " new or updated word vectors.\n";
 }
 
-void HashTableReader::GetVectors(HashTable& hash_table, const std::vector<std::string>& words) {
-// Collects the "vectors" corresponding to both "words" and passes them to
-// "ShowSimilarity()" (if both words were found in the hash table file).
-  std::vector<std::vector<double>> vectors(2, std::vector<double>(hash_table_values_[0], 0)); // every value of both vectors is 0 by default in order to evaluate later if the "words" were found (if not all values stay 0)
-  const std::vector<int> indices = {hash_table.GetIndex(words[0]), hash_table.GetIndex(words[1])};
-  std::string line, word_vector, current_index;
-  std::vector<std::string> word_vectors_of_line;
-  // "loop_forward" helps to make sure (within the for-loop) that the first of
-  // the buckets of interest will be read first (i.e. the bucket with the
-  // smaller index). Therefore, the file will be read only once from its
-  // beginning to its end in the worst case (in order to check if both "words"
-  // are contained in the hash table file and - if so - to return their vectors).
-  const bool loop_forward = (indices[0] < indices[1])? true : false;
-  std::ifstream hash_table_file_stream(hash_table_file_);
-  std::getline(hash_table_file_stream, line); // skips first line of the hash table file, which should contain no vectors
-  for (int i = (loop_forward? 0 : 1); (loop_forward? i < 2 : i > -1); (loop_forward? ++i : --i)) {
-    current_index = std::to_string(indices[i]);
-    while (std::getline(hash_table_file_stream, line)) {
-      if (CheckIndex(current_index, line)) {
-        if (indices[0] == indices[1]) { // if both words are supposed to be in the same bucket
-          GetBothVectors(line, words, vectors);
-          if (!VectorIsValid(words[0], vectors[0]) || !VectorIsValid(words[1], vectors[1])) // if at least one of the words couldn't be found in the hash table file
-            return;
-          i = loop_forward? 2 : -1; // makes sure that "break" (in the next line) affects both loops
-          break;
-        }
-        word_vector = GetWordVectorsFromLine(line, words[i]);
-        if (word_vector != "") // if the word was found in the hash table file
-          vectors[i] = GetVector(word_vector);
-        else { // if at least one of the words (i.e. "words[i]") couldn't be found in the hash table file
-          std::cout << "\t\"" << words[i] << "\" couldn't be found in your data! Comparison impossible.\n\n";
-          return;
-        }
-        break; // if both "words" got different keys ("indices") and the first one was found
-      }
+void HashTableReader::LoadOffsetIndex() {
+// Loads the byte offsets of the buckets from the offset index file written by
+// "HashTableWriter". If there is no such file or if it does not fit the hash
+// table file (e.g. because the latter was changed afterwards),
+// "bucket_offsets_" stays empty and the hash table file will be scanned.
+  std::ifstream index_file_stream(hash_table_file_+kOffsetIndexExtension, std::ios_base::binary);
+  if (!index_file_stream.is_open())
+    return;
+  std::string magic(kOffsetIndexMagic.size(), ' ');
+  long long values[2];
+  index_file_stream.read(&magic[0], magic.size());
+  index_file_stream.read((char*) values, sizeof(values));
+  if (!index_file_stream || magic != kOffsetIndexMagic || values[0] != HashTable::GetFileSize(hash_table_file_) || values[1] != hash_table_values_[2]) {
+    std::cout << "\tThe offset index file does not fit the hash table file and will be ignored.\n";
+    return;
+  }
+  std::vector<long long> bucket_offsets(hash_table_values_[2]);
+  index_file_stream.read((char*) bucket_offsets.data(), bucket_offsets.size()*sizeof(long long));
+  if (index_file_stream)
+    bucket_offsets_.swap(bucket_offsets);
+}
+
+bool HashTableReader::ReadBucket(const int index, std::string& line) {
+// Reads the "line" of the bucket "index" by jumping to its byte offset and
+// returns "true" if the bucket exists and "false" otherwise.
+  if (bucket_offsets_[index] < 0)
+    return false;
+  hash_table_file_stream_.clear();
+  hash_table_file_stream_.seekg(bucket_offsets_[index]);
+  return (std::getline(hash_table_file_stream_, line) && CheckIndex(std::to_string(index), line));
+}
+
+void HashTableReader::ReadBuckets(std::map<int, std::string>& lines) {
+// Sets the values of "lines" to the lines of the buckets given as its keys
+// (buckets that do not exist get an empty line). Buckets cached by
+// "bucket_cache_" are taken from it; all others are read by a single pass over
+// the hash table file: only the buckets in question are read (in the order of
+// the file) if there is an offset index; otherwise the file is read from its
+// beginning to the last bucket in question.
+  std::vector<int> indices_to_read;
+  for (auto& line : lines) {
+    const std::string* cached_line = bucket_cache_.Get(line.first);
+    if (cached_line != NULL)
+      line.second = *cached_line;
+    else
+      indices_to_read.push_back(line.first);
+  }
+  if (indices_to_read.empty())
+    return;
+  size_t bytes_scanned = 0;
+  if (!bucket_offsets_.empty()) {
+    for (auto index : indices_to_read) {
+      if (!ReadBucket(index, lines[index]))
+        lines[index].clear();
+      bytes_scanned += lines[index].size()+1;
+    }
+  } else {
+    std::string line;
+    hash_table_file_stream_.clear();
+    hash_table_file_stream_.seekg(0);
+    std::getline(hash_table_file_stream_, line); // skips the first line of the hash table file, which contains no vectors
+    auto next_index = indices_to_read.begin();
+    while (next_index != indices_to_read.end() && std::getline(hash_table_file_stream_, line)) {
+      bytes_scanned += line.size()+1;
+      const int index = atoi(line.c_str());
+      while (next_index != indices_to_read.end() && *next_index < index)
+        ++next_index;
+      if (next_index != indices_to_read.end() && *next_index == index)
+        lines[*(next_index++)].swap(line);
     }
   }
-  hash_table.ShowSimilarity(words, vectors);
+  for (auto index : indices_to_read)
+    bucket_cache_.Put(index, lines[index], lines[index].size()+64);
+  if (kStatistics.IsEnabled())
+    kStatistics.Add(Statistics::kReaderBytesScanned, bytes_scanned);
 }
 
-void HashTableReader::GetBothVectors(const std::string& line, const std::vector<std::string>& words_to_find, std::vector<std::vector<double>>& vectors) {
-// Searches for the vectors corresponding to both "words_to_find" and
-// overwrites the "vectors" (which contain only zeros by default) with the
-// values found in the line of the hash table file.
-  std::stringstream stream_of_line(line);
-  std::vector<std::string> word_vectors_of_line;
+void HashTableReader::FetchVectors(const std::vector<std::string>& words, std::unordered_map<std::string, std::pair<std::vector<double>, double>>& vectors) {
+// Adds the vectors and norms of all "words" found in the hash table file or
+// in its delta segments to "vectors". Words cached by "vector_cache_" (also
+// words known to be missing) are taken from it; all other words are looked up
+// in the delta segments (the newest one first) and then in the hash table file
+// (see "ReadVectors()"), and their vectors are cached afterwards.
+  StatisticsTimer timer(Statistics::kReaderTime, Statistics::kReaderOperation);
+  if (kStatistics.IsEnabled())
+    kStatistics.Add(Statistics::kReaderQueries, 1);
+  std::vector<std::string> words_to_read;
+  for (auto& word : words) {
+    const std::pair<std::vector<double>, double>* cached_vector = vector_cache_.Get(word);
+    if (cached_vector == NULL)
+      words_to_read.push_back(word);
+    else if (!cached_vector->first.empty())
+      vectors[word] = *cached_vector;
+  }
+  if (words_to_read.empty())
+    return;
+  std::unordered_map<std::string, std::pair<std::vector<double>, double>> vectors_read;
+  for (auto& delta_segment : delta_segments_)
+    delta_segment->ReadVectors(words_to_read, vectors_read);
+  ReadVectors(words_to_read, vectors_read);
+  for (auto& word : words_to_read) {
+    auto vector = vectors_read.find(word);
+    if (vector == vectors_read.end()) {
+      vector_cache_.Put(word, std::pair<std::vector<double>, double>(std::vector<double>(), 0), GetSizeOfCachedVector(word, std::vector<double>())); // the vector stays empty if "word" couldn't be found
+    } else {
+      vectors[word] = vector->second;
+      vector_cache_.Put(word, vector->second, GetSizeOfCachedVector(word, vector->second.first));
+    }
+  }
+}
+
+void HashTableReader::ReadVectors(const std::vector<std::string>& words, std::unordered_map<std::string, std::pair<std::vector<double>, double>>& vectors) {
+// Adds the vectors and norms of those "words" found in the hash table file
+// that are not in "vectors" yet (e.g. because they were found in a newer delta
+// segment) to "vectors". The buckets of the words are read at once (see
+// "ReadBuckets()").
+  HashTable hash_table(hash_table_values_[2], GetHashFunction(), minimal_perfect_hash_.get());
+  std::map<int, std::vector<std::string>> words_of_buckets;
+  for (auto& word : words) {
+    if (!vectors.count(word))
+      words_of_buckets[hash_table.GetIndex(word)].push_back(word);
+  }
+  if (words_of_buckets.empty())
+    return;
+  std::map<int, std::string> lines;
+  for (auto& words_of_bucket : words_of_buckets)
+    lines[words_of_bucket.first];
+  ReadBuckets(lines);
   std::string word_vector;
-  int i = 0, j = 2;
-  while (std::getline(stream_of_line, word_vector, ',')) {
-    for (int k = i; k < j; ++k) {
-      if (word_vector.substr(0, words_to_find[k].length()) == words_to_find[k]) {
-        vectors[k] = GetVector(word_vector);
-        (k == 0)? i = 1 : j = 1; // makes sure that the next "word_vector"s will only be checked for the "word_to_find" that was not found yet
-        break;
+  for (auto& words_of_bucket : words_of_buckets) {
+    for (auto& word : words_of_bucket.second) {
+      word_vector = GetWordVectorsFromLine(lines[words_of_bucket.first], word);
+      if (word_vector != "") {
+        std::pair<std::vector<double>, double>& vector = vectors[word];
+        vector.first = GetVector(word_vector, vector.second);
       }
     }
-    if (i == 1 && j == 1) // if both "words_to_find" were found
-      break;
   }
 }
 
+void HashTableReader::CompareWordVectors(const std::vector<std::string>& words) {
+// Creates a "HashTable" and starts the comparison of the "words".
+  HashTable HT(hash_table_values_[2], GetHashFunction(), minimal_perfect_hash_.get());
+  GetVectors(HT, words);
+}
+
+void HashTableReader::GetVectors(HashTable& hash_table, const std::vector<std::string>& words) {
+// Collects the vectors corresponding to both "words" (see "FetchVectors()")
+// and passes them to "ShowSimilarity()" (if both words were found in the hash
+// table file).
+  std::unordered_map<std::string, std::pair<std::vector<double>, double>> vectors;
+  FetchVectors(words, vectors);
+  for (unsigned i = 0; i < 2; ++i) {
+    if (!vectors.count(words[i])) {
+      std::cout << "\t\"" << words[i] << "\" couldn't be found in your data! Comparison impossible.\n\n";
+      return;
+    }
+  }
+  const std::pair<std::vector<double>, double>& vector_0 = vectors[words[0]], & vector_1 = vectors[words[1]];
+  hash_table.ShowSimilarity(words, hash_table.CalculateDotProduct(vector_0.first.data(), vector_1.first.data(), hash_table_values_[0]), vector_0.second, vector_1.second);
+}
+
+void HashTableReader::ShowCacheInfo() {
+// Shows the number of hits and misses of the caches and what they hold.
+  auto show_cache_info = [](const std::string& name, const uint64_t num_of_hits, const uint64_t num_of_misses, const size_t num_of_entries, const size_t size) {
+    std::cout << "\t" << name << ": " << num_of_hits << " hits, " << num_of_misses << " misses (" << ((num_of_hits+num_of_misses > 0)? 100.0*num_of_hits/(num_of_hits+num_of_misses) : 0.0) << " % hits), " << num_of_entries << " entries (" << size/(1024.0*1024) << " MB)\n";
+  };
+  show_cache_info("Vector cache", vector_cache_.GetNumOfHits(), vector_cache_.GetNumOfMisses(), vector_cache_.GetNumOfEntries(), vector_cache_.GetSize());
+  if (bucket_cache_.GetNumOfHits()+bucket_cache_.GetNumOfMisses() > 0)
+    show_cache_info("Bucket cache", bucket_cache_.GetNumOfHits(), bucket_cache_.GetNumOfMisses(), bucket_cache_.GetNumOfEntries(), bucket_cache_.GetSize());
+}
+
 std::string HashTableReader::GetWordVectorsFromLine(const std::string& line, const std::string& word_to_find) {
 // Searches for the word vector of the "word_to_find" in the "line" and returns
 // it as a string (if the "word_to_find" was found). If the "word_to_find"
@@ -417,23 +1494,59 @@ std::string HashTableReader::GetWordVectorsFromLine(const std::string& line, con
   std::stringstream stream_of_line(line);
   std::vector<std::string> word_vectors_of_line;
   std::string word_vector;
+  uint64_t num_of_steps = 0;
   while (std::getline(stream_of_line, word_vector, ',')) {
-    if (word_vector.substr(0, word_to_find.length()) == word_to_find)
-      return word_vector;
+    ++num_of_steps;
+    if (IsWordVectorOf(word_vector, word_to_find))
+      break;
+    word_vector.clear();
+  }
+  if (kStatistics.IsEnabled()) {
+    kStatistics.Add(Statistics::kChainLookups, 1);
+    kStatistics.Add(Statistics::kChainSteps, num_of_steps);
   }
-  return "";
+  return word_vector;
 }
 
-std::vector<double> HashTableReader::GetVector(const std::string& word_vector) {
+std::vector<double> HashTableReader::GetVector(const std::string& word_vector, double& norm) {
 // Takes the string "word_vector" and returns the actual vector as a
-// std::vector<double>.
+// std::vector<double>. The Euclidean norm of the vector is written to "norm":
+// it is either taken from the "word_vector" (if "HashTableWriter" stored it
+// after the values of the vector) or calculated.
   std::vector<double> vector(hash_table_values_[0]);
   std::stringstream stream(word_vector);
   std::string value;
   std::getline(stream, value, ' '); // skips the first value, which is the "word" of the "word_vector"
+  double x = 0;
+  const bool is_quantized = (stream.peek() == '@');
+  if (is_quantized)
+    DecodeQuantizedVector(stream, vector);
   for (auto& element : vector) {
-    getline(stream, value, ' ');
-    element = atof(value.c_str());
+    if (!is_quantized) {
+      getline(stream, value, ' ');
+      element = atof(value.c_str());
+    }
+    x += element*element;
   }
+  norm = (getline(stream, value, ' ') && !value.empty())? atof(value.c_str()) : std::sqrt(x);
   return vector;
 }
+
+void HashTableReader::DecodeQuantizedVector(std::stringstream& stream, std::vector<double>& vector) {
+// Reads the values of a quantized word vector (see
+// "HashTableWriter::GetWordVectorWithNorm()") from "stream" and writes the
+// values they stand for to "vector". Afterwards only the norm is left in
+// "stream".
+  std::string precision, values;
+  float scale = 1;
+  stream >> precision;
+  if (precision == "@i8")
+    stream >> scale;
+  stream >> values;
+  stream.ignore(1); // skips the whitespace in front of the norm
+  const int digits_per_value = (precision == "@i8")? 2 : 4;
+  for (unsigned i = 0; i < vector.size() && (i+1)*digits_per_value <= values.size(); ++i) {
+    const unsigned long quantized_value = std::stoul(values.substr(i*digits_per_value, digits_per_value), NULL, 16);
+    vector[i] = (precision == "@i8")? (int8_t) quantized_value*scale : ConvertFromHalf(quantized_value);
+  }
+}
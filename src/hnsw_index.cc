@@ -0,0 +1,418 @@
+// hnsw_index.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Approximate nearest neighbour search with a Hierarchical Navigable Small
+// World graph (Malkov & Yashunin, 2016): every word vector is a node with a
+// random highest level; a search descends greedily from the sparse upper
+// levels to the lowest level, which contains all nodes, and explores the
+// neighbourhood there with a candidate list of size "ef_search".
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <math.h>
+#include <random>
+#include <unordered_set>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+namespace {
+
+// The index file starts with "kIndexMagic" and "kIndexVersion", followed by
+// the values checked by "HnswIndex::Load()", the highest level of every node
+// and the links of every node.
+const std::string kIndexMagic = "WVEWHTHN";
+const unsigned kIndexVersion = 1;
+
+} // namespace
+
+HnswIndex::HnswIndex(HashTableOnMemory& hash_table, const Metric metric, const HnswParameters& parameters)
+    : hash_table_(hash_table),
+      metric_(metric),
+      parameters_(parameters),
+      num_of_nodes_(hash_table.GetNumOfRows()),
+      max_links_(std::max(2, parameters.m)),
+      max_links_of_level_0_(2*max_links_),
+      node_mutexes_(new std::mutex[hash_table.GetNumOfRows()]),
+      entry_point_(0),
+      max_level_(-1),
+      building_(false) {
+  hash_table_.ParseAllRows(); // all nodes are compared while building and searching
+}
+
+HnswIndex::~HnswIndex() {}
+
+void HnswIndex::Build(ThreadPool& thread_pool) {
+// Builds the index by inserting all nodes on all threads of "thread_pool".
+// The highest levels of the nodes are drawn (reproducibly) before, so that
+// the memory for their links can be allocated at once.
+  std::cout << "\tBuilding HNSW index (M = " << max_links_ << ", efConstruction = " << parameters_.ef_construction << ") using " << thread_pool.GetNumOfThreads() << " threads..." << std::endl;
+  std::mt19937 generator(100);
+  std::uniform_real_distribution<double> distribution(std::nextafter(0., 1.), 1.);
+  const double level_multiplier = 1/log((double) max_links_);
+  levels_.resize(num_of_nodes_);
+  links_of_level_0_.assign((size_t) num_of_nodes_*(max_links_of_level_0_+1), 0);
+  links_of_upper_levels_.assign(num_of_nodes_, std::vector<unsigned>());
+  for (unsigned node = 0; node < num_of_nodes_; ++node) {
+    levels_[node] = (int) (-log(distribution(generator))*level_multiplier);
+    links_of_upper_levels_[node].assign(levels_[node]*(max_links_+1), 0);
+  }
+  if (num_of_nodes_ == 0)
+    return;
+  building_ = true;
+  entry_point_ = 0;
+  max_level_ = levels_[0];
+  thread_pool.ParallelFor(num_of_nodes_-1, [this](size_t begin, size_t end, int) {
+    for (size_t node = begin; node < end; ++node)
+      Insert(node+1);
+  }, 64*thread_pool.GetNumOfThreads()); // small chunks, so that the threads insert nodes of the whole vocabulary at the same time
+  building_ = false;
+  std::cout << "\t---Done.\n";
+}
+
+void HnswIndex::Insert(const unsigned node) {
+// Inserts "node" into the graph: the nearest node on the levels above the
+// highest level of "node" is found greedily; on every lower level the
+// "ef_construction" nearest nodes are searched and the best of them become
+// the neighbours of "node" (and vice versa).
+  const int level = levels_[node];
+  std::unique_lock<std::mutex> entry_point_lock(entry_point_mutex_);
+  const int max_level = max_level_;
+  unsigned entry_point = entry_point_;
+  if (level <= max_level) // the lock is kept only if "node" will become the new entry point
+    entry_point_lock.unlock();
+  auto distance = [this, node](const unsigned other_node) { return GetDistance(node, other_node); };
+  entry_point = SearchGreedily(entry_point, max_level, level, distance);
+  for (int current_level = std::min(level, max_level); current_level >= 0; --current_level) {
+    std::vector<NodeDistance> candidates = SearchLevel(entry_point, distance(entry_point), parameters_.ef_construction, current_level, distance);
+    entry_point = candidates[0].second;
+    const std::vector<unsigned> neighbours = SelectNeighbours(candidates, max_links_);
+    {
+      std::lock_guard<std::mutex> lock(node_mutexes_[node]);
+      unsigned* links = GetLinks(node, current_level);
+      links[0] = neighbours.size();
+      std::copy(neighbours.begin(), neighbours.end(), links+1);
+    }
+    for (auto& neighbour : neighbours)
+      AddLink(neighbour, node, current_level);
+  }
+  if (level > max_level) {
+    entry_point_ = node;
+    max_level_ = level;
+  }
+}
+
+template <typename Distance>
+unsigned HnswIndex::SearchGreedily(unsigned entry_point, const int from_level, const int to_level, Distance distance) {
+// Moves from "entry_point" to the nearest neighbour as long as there is a
+// nearer one - on every level from "from_level" down to "to_level"+1 - and
+// returns the node reached.
+  double distance_of_entry_point = distance(entry_point), current_distance;
+  std::vector<unsigned> links;
+  for (int level = from_level; level > to_level; --level) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      {
+        std::unique_lock<std::mutex> lock;
+        if (building_)
+          lock = std::unique_lock<std::mutex>(node_mutexes_[entry_point]);
+        const unsigned* entry_point_links = GetLinks(entry_point, level);
+        links.assign(entry_point_links+1, entry_point_links+1+entry_point_links[0]);
+      }
+      for (auto& link : links) {
+        current_distance = distance(link);
+        if (current_distance < distance_of_entry_point) {
+          distance_of_entry_point = current_distance;
+          entry_point = link;
+          changed = true;
+        }
+      }
+    }
+  }
+  return entry_point;
+}
+
+template <typename Distance>
+std::vector<HnswIndex::NodeDistance> HnswIndex::SearchLevel(const unsigned entry_point, const double distance_of_entry_point, const int ef, const int level, Distance distance) {
+// Returns the (at most) "ef" nearest nodes on "level" found by a best-first
+// search starting at "entry_point", the nearest one first.
+  VisitedList* visited_list = GetVisitedList();
+  std::priority_queue<NodeDistance, std::vector<NodeDistance>, std::greater<NodeDistance>> candidates; // the nearest candidate on top
+  std::priority_queue<NodeDistance> nearest_nodes; // the farthest of the nearest nodes on top
+  candidates.push(NodeDistance(distance_of_entry_point, entry_point));
+  nearest_nodes.push(NodeDistance(distance_of_entry_point, entry_point));
+  visited_list->marks[entry_point] = visited_list->generation;
+  std::vector<unsigned> links;
+  double current_distance;
+  while (!candidates.empty()) {
+    const NodeDistance candidate = candidates.top();
+    if (candidate.first > nearest_nodes.top().first && (int) nearest_nodes.size() >= ef)
+      break;
+    candidates.pop();
+    {
+      std::unique_lock<std::mutex> lock;
+      if (building_)
+        lock = std::unique_lock<std::mutex>(node_mutexes_[candidate.second]);
+      const unsigned* candidate_links = GetLinks(candidate.second, level);
+      links.assign(candidate_links+1, candidate_links+1+candidate_links[0]);
+    }
+    for (auto& link : links) {
+      if (visited_list->marks[link] == visited_list->generation)
+        continue;
+      visited_list->marks[link] = visited_list->generation;
+      current_distance = distance(link);
+      if ((int) nearest_nodes.size() < ef || current_distance < nearest_nodes.top().first) {
+        candidates.push(NodeDistance(current_distance, link));
+        nearest_nodes.push(NodeDistance(current_distance, link));
+        if ((int) nearest_nodes.size() > ef)
+          nearest_nodes.pop();
+      }
+    }
+  }
+  ReleaseVisitedList(visited_list);
+  std::vector<NodeDistance> result(nearest_nodes.size());
+  for (int i = result.size()-1; i >= 0; --i) {
+    result[i] = nearest_nodes.top();
+    nearest_nodes.pop();
+  }
+  return result;
+}
+
+std::vector<unsigned> HnswIndex::SelectNeighbours(std::vector<NodeDistance>& candidates, const unsigned max_num_of_neighbours) {
+// Selects at most "max_num_of_neighbours" of the "candidates" (sorted by
+// their distances, the nearest one first) with the heuristic of the HNSW
+// paper: a candidate is skipped if it is nearer to an already selected
+// neighbour than to the node itself, which keeps the graph navigable between
+// clusters.
+  std::vector<unsigned> neighbours;
+  for (auto& candidate : candidates) {
+    if (neighbours.size() == max_num_of_neighbours)
+      break;
+    bool selected = true;
+    for (auto& neighbour : neighbours) {
+      if (GetDistance(candidate.second, neighbour) < candidate.first) {
+        selected = false;
+        break;
+      }
+    }
+    if (selected)
+      neighbours.push_back(candidate.second);
+  }
+  return neighbours;
+}
+
+void HnswIndex::AddLink(const unsigned node, const unsigned new_neighbour, const int level) {
+// Adds a link from "node" to "new_neighbour" on "level"; if "node" has already
+// the maximum number of links, its neighbours are selected again among the
+// old ones and "new_neighbour".
+  const unsigned max_links = (level == 0)? max_links_of_level_0_ : max_links_;
+  std::lock_guard<std::mutex> lock(node_mutexes_[node]);
+  unsigned* links = GetLinks(node, level);
+  if (links[0] < max_links) {
+    links[++links[0]] = new_neighbour;
+    return;
+  }
+  std::vector<NodeDistance> candidates;
+  candidates.push_back(NodeDistance(GetDistance(node, new_neighbour), new_neighbour));
+  for (unsigned i = 1; i <= links[0]; ++i)
+    candidates.push_back(NodeDistance(GetDistance(node, links[i]), links[i]));
+  std::sort(candidates.begin(), candidates.end());
+  const std::vector<unsigned> neighbours = SelectNeighbours(candidates, max_links);
+  links[0] = neighbours.size();
+  std::copy(neighbours.begin(), neighbours.end(), links+1);
+}
+
+std::vector<Neighbour> HnswIndex::Nearest(const std::string& word, const int k) {
+// Returns the (approximately) "k" nearest neighbours of the word vector of
+// "word" (excluding "word" itself), the nearest one first; if "word" couldn't
+// be found, an empty std::vector will be returned.
+  HashTableOnMemory::Query query;
+  std::string name;
+  if (!hash_table_.GetQuery(word, query, name))
+    return std::vector<Neighbour>();
+  return Search(query, k);
+}
+
+std::vector<Neighbour> HnswIndex::Search(const HashTableOnMemory::Query& query, const int k) {
+// Returns the (approximately) "k" nearest neighbours of "query", the nearest
+// one first.
+  std::vector<Neighbour> neighbours;
+  if (max_level_ < 0 || k < 1 || (metric_ == kCosineSimilarity && query.norm == 0))
+    return neighbours;
+  auto distance = [this, &query](const unsigned node) { return GetDistance(query, node); };
+  const unsigned entry_point = SearchGreedily(entry_point_, max_level_, 0, distance);
+  const std::vector<NodeDistance> nearest_nodes = SearchLevel(entry_point, distance(entry_point), std::max(parameters_.ef_search, k+1), 0, distance);
+  for (auto& nearest_node : nearest_nodes) {
+    if ((int) neighbours.size() == k)
+      break;
+    if ((int) nearest_node.second != query.excluded_row)
+      neighbours.push_back(Neighbour{hash_table_.GetWordOfRow(nearest_node.second), GetScore(nearest_node.first)});
+  }
+  return neighbours;
+}
+
+double HnswIndex::GetDistance(const unsigned node_0, const unsigned node_1) {
+// Returns the distance between two nodes the graph is based on: 1 minus the
+// cosine similarity or the squared Euclidean distance.
+  const double dot_product = hash_table_.GetDotProductOfRows(node_0, node_1), norm_0 = hash_table_.norms_[node_0], norm_1 = hash_table_.norms_[node_1];
+  if (metric_ == kCosineSimilarity)
+    return (norm_0 == 0 || norm_1 == 0)? 1 : 1-dot_product/(norm_0*norm_1);
+  return norm_0*norm_0+norm_1*norm_1-2*dot_product;
+}
+
+double HnswIndex::GetDistance(const HashTableOnMemory::Query& query, const unsigned node) {
+// Returns the distance between "query" and "node" (see above).
+  const double dot_product = hash_table_.GetDotProductWithRow(query.vector.data(), node), norm = hash_table_.norms_[node];
+  if (metric_ == kCosineSimilarity)
+    return (norm == 0)? 1 : 1-dot_product/(query.norm*norm);
+  return query.norm*query.norm+norm*norm-2*dot_product;
+}
+
+double HnswIndex::GetScore(const double distance) {
+// Turns a "distance" of the graph into the cosine similarity or the Euclidean
+// distance.
+  return (metric_ == kCosineSimilarity)? 1-distance : std::sqrt(std::max(0., distance));
+}
+
+unsigned long long HnswIndex::GetChecksumOfWords() {
+// Returns the FNV-1a hash of all words of the "HashTableOnMemory" in the order
+// of their rows (an index file fits only a hash table with the same words in
+// the same order).
+  unsigned long long checksum = 14695981039346656037ULL;
+  const unsigned num_of_rows = hash_table_.GetNumOfRows();
+  for (size_t i = 0; i < hash_table_.word_offsets_[num_of_rows]; ++i) {
+    checksum ^= (unsigned char) hash_table_.words_[i];
+    checksum *= 1099511628211ULL;
+  }
+  for (unsigned row = 0; row <= num_of_rows; ++row) {
+    checksum ^= hash_table_.word_offsets_[row];
+    checksum *= 1099511628211ULL;
+  }
+  return checksum;
+}
+
+bool HnswIndex::Save(const std::string& index_file) {
+// Saves the index to "index_file" and returns "true" if that was successful.
+  std::ofstream out(index_file, std::ios_base::trunc|std::ios_base::binary);
+  const unsigned long long values[] = {kIndexVersion, num_of_nodes_, (unsigned long long) hash_table_.vector_size_, (unsigned long long) metric_, max_links_, GetChecksumOfWords(), entry_point_, (unsigned long long) max_level_};
+  out.write(kIndexMagic.data(), kIndexMagic.size());
+  out.write((const char*) values, sizeof(values));
+  out.write((const char*) levels_.data(), levels_.size()*sizeof(int));
+  out.write((const char*) links_of_level_0_.data(), links_of_level_0_.size()*sizeof(unsigned));
+  for (auto& links : links_of_upper_levels_)
+    out.write((const char*) links.data(), links.size()*sizeof(unsigned));
+  if (!out) {
+    std::cout << "WARNING: SAVING THE HNSW INDEX TO \"" << index_file << "\" FAILED!\n";
+    return false;
+  }
+  std::cout << "\tHNSW index saved (\"" << index_file << "\").\n";
+  return true;
+}
+
+bool HnswIndex::Load(const std::string& index_file) {
+// Loads the index from "index_file" and returns "true" if that was successful
+// (i.e. if the file exists and was built with the same parameters over the
+// same words).
+  std::ifstream in(index_file, std::ios_base::binary);
+  if (!in.is_open())
+    return false;
+  std::string magic(kIndexMagic.size(), ' ');
+  unsigned long long values[8];
+  in.read(&magic[0], magic.size());
+  in.read((char*) values, sizeof(values));
+  if (!in || magic != kIndexMagic || values[0] != kIndexVersion || values[1] != num_of_nodes_ || values[2] != (unsigned long long) hash_table_.vector_size_ || values[3] != (unsigned long long) metric_ || values[4] != max_links_ || values[5] != GetChecksumOfWords()) {
+    std::cout << "\tThe HNSW index file \"" << index_file << "\" does not fit the word vectors or the parameters and will be rebuilt.\n";
+    return false;
+  }
+  entry_point_ = values[6];
+  max_level_ = values[7];
+  levels_.resize(num_of_nodes_);
+  in.read((char*) levels_.data(), levels_.size()*sizeof(int));
+  links_of_level_0_.resize((size_t) num_of_nodes_*(max_links_of_level_0_+1));
+  in.read((char*) links_of_level_0_.data(), links_of_level_0_.size()*sizeof(unsigned));
+  links_of_upper_levels_.assign(num_of_nodes_, std::vector<unsigned>());
+  for (unsigned node = 0; node < num_of_nodes_ && in; ++node) {
+    links_of_upper_levels_[node].resize(std::max(0, levels_[node])*(max_links_+1));
+    in.read((char*) links_of_upper_levels_[node].data(), links_of_upper_levels_[node].size()*sizeof(unsigned));
+  }
+  if (!in) {
+    std::cout << "\tThe HNSW index file \"" << index_file << "\" is incomplete and will be rebuilt.\n";
+    max_level_ = -1;
+    return false;
+  }
+  std::cout << "\tHNSW index loaded (\"" << index_file << "\").\n";
+  return true;
+}
+
+void HnswIndex::ShowRecall(const int k, const int num_of_queries, ThreadPool& thread_pool) {
+// Compares the results of the index with the exact results of
+// "HashTableOnMemory" for "num_of_queries" randomly chosen words and prints
+// the recall@k (the share of the exact "k" nearest neighbours found by the
+// index) as well as the average time per query of both searches.
+  const unsigned num = std::min((unsigned) std::max(num_of_queries, 1), num_of_nodes_);
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<unsigned> distribution(0, num_of_nodes_-1);
+  std::vector<HashTableOnMemory::Query> queries(num);
+  std::string name;
+  for (auto& query : queries)
+    hash_table_.GetQuery(hash_table_.GetWordOfRow(distribution(generator)), query, name);
+  std::vector<std::vector<Neighbour>> exact_results, approximate_results(num);
+  auto start = std::chrono::steady_clock::now();
+  hash_table_.ScanNearestRows(queries, k, metric_, thread_pool, exact_results);
+  const double exact_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+  start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < num; ++i) // one query after another in order to measure the latency of a single query
+    approximate_results[i] = Search(queries[i], k);
+  const double approximate_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+  unsigned long long num_of_exact_neighbours = 0, num_of_neighbours_found = 0;
+  std::unordered_set<std::string> exact_neighbours;
+  for (unsigned i = 0; i < num; ++i) {
+    exact_neighbours.clear();
+    for (auto& neighbour : exact_results[i])
+      exact_neighbours.insert(neighbour.word);
+    num_of_exact_neighbours += exact_neighbours.size();
+    for (auto& neighbour : approximate_results[i])
+      num_of_neighbours_found += exact_neighbours.count(neighbour.word);
+  }
+  std::cout << "\tRecall@" << k << " of the HNSW index (efSearch = " << parameters_.ef_search << ", " << num << " queries) = " << (double) num_of_neighbours_found/std::max(num_of_exact_neighbours, 1ULL) << '\n';
+  std::cout << "\tAverage time per query: exact search (" << num << " queries per scan) = " << exact_time/num << " ms, HNSW index = " << approximate_time/num << " ms\n";
+}
+
+HnswIndex::VisitedList* HnswIndex::GetVisitedList() {
+// Returns a visited list that is not used by another search (the lists are
+// reused, so that they do not have to be cleared for every search).
+  VisitedList* visited_list;
+  {
+    std::lock_guard<std::mutex> lock(visited_lists_mutex_);
+    if (free_visited_lists_.empty())
+      visited_list = new VisitedList{std::vector<unsigned>(num_of_nodes_, 0), 0};
+    else {
+      visited_list = free_visited_lists_.back().release();
+      free_visited_lists_.pop_back();
+    }
+  }
+  if (++visited_list->generation == 0) { // after an overflow all marks have to be reset
+    std::fill(visited_list->marks.begin(), visited_list->marks.end(), 0);
+    visited_list->generation = 1;
+  }
+  return visited_list;
+}
+
+void HnswIndex::ReleaseVisitedList(VisitedList* visited_list) {
+  std::lock_guard<std::mutex> lock(visited_lists_mutex_);
+  free_visited_lists_.emplace_back(visited_list);
+}
@@ -0,0 +1,160 @@
+// lazy_loading.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Lazy loading of "HashTableOnMemory" (see "HashTableOptions::lazy"): while
+// loading, only the words are read and the offsets of their word vectors in
+// the word vector file are stored. The word vector file stays mapped, and
+// every word vector is parsed from it when its row is needed first. The
+// parsed word vectors, norms and scales are written to an anonymous mapping
+// that is as large as all of them together, whose pages are only allocated
+// when they are written first.
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+namespace {
+
+const unsigned kRowsPerParsingBatch = 1024; // the number of rows parsed at once by "ParseAllRows()" and the warm-up thread (the lookups wait for a batch at most)
+
+} // namespace
+
+bool HashTableOnMemory::MapVectorFile() {
+// Maps "input_file_" read-only and returns "false" if it cannot be parsed
+// lazily (i.e. if it is compressed or cannot be mapped), so that the word
+// vectors are parsed while loading as usual.
+  if (InputFileStream::GetCompression(input_file_) != kUncompressed) {
+    std::cout << "WARNING: THE COMPRESSED FILE \"" << input_file_ << "\" CANNOT BE READ LAZILY - all word vectors are parsed while loading.\n";
+    return false;
+  }
+  const int file_descriptor = open(input_file_.c_str(), O_RDONLY);
+  struct stat file_status;
+  if (file_descriptor < 0 || fstat(file_descriptor, &file_status) != 0 || file_status.st_size == 0) {
+    std::cout << "WARNING: \"" << input_file_ << "\" CANNOT BE MAPPED - all word vectors are parsed while loading.\n";
+    if (file_descriptor >= 0)
+      close(file_descriptor);
+    return false;
+  }
+  void* mapped_vector_file = mmap(NULL, file_status.st_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+  close(file_descriptor); // the mapping stays valid
+  if (mapped_vector_file == MAP_FAILED) {
+    std::cout << "WARNING: \"" << input_file_ << "\" CANNOT BE MAPPED - all word vectors are parsed while loading.\n";
+    return false;
+  }
+  if (!options_.warm_up)
+    madvise(mapped_vector_file, file_status.st_size, MADV_RANDOM); // no read-ahead for the lines of single lookups
+  mapped_vector_file_ = mapped_vector_file;
+  size_of_mapped_vector_file_ = file_status.st_size;
+  return true;
+}
+
+bool HashTableOnMemory::PrepareLazyParsing() {
+// Reserves the memory of the word vectors, norms and scales of all rows (laid
+// out as [word vectors][norms][scales]), lets the pointers to them point to
+// it and starts the warm-up thread if "options_.warm_up" is "true".
+  const size_t num_of_rows = GetNumOfRows();
+  const size_t size_of_element = (options_.precision == kInt8)? sizeof(int8_t) : ((options_.precision == kFloat16)? sizeof(uint16_t) : sizeof(double));
+  const size_t offset_of_norms = (num_of_rows*vector_size_*size_of_element+sizeof(double)-1)/sizeof(double)*sizeof(double);
+  const size_t offset_of_scales = offset_of_norms+num_of_rows*sizeof(double);
+  size_of_lazy_data_ = std::max((size_t) 1, offset_of_scales+((options_.precision == kInt8)? num_of_rows*sizeof(float) : 0));
+  void* lazy_data = mmap(NULL, size_of_lazy_data_, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (lazy_data == MAP_FAILED) {
+    std::cout << "ERROR: RESERVING " << size_of_lazy_data_/1048576. << " MB FOR THE WORD VECTORS FAILED!\n";
+    size_of_lazy_data_ = 0;
+    return false;
+  }
+  lazy_data_ = lazy_data;
+  const char* begin = (const char*) lazy_data_;
+  vectors_ = (const double*) begin;
+  half_vectors_ = (const uint16_t*) begin;
+  int8_vectors_ = (const int8_t*) begin;
+  norms_ = (const double*) (begin+offset_of_norms);
+  scales_ = (const float*) (begin+offset_of_scales);
+  row_is_parsed_.reset(new std::atomic<bool>[num_of_rows]);
+  for (size_t row = 0; row < num_of_rows; ++row)
+    row_is_parsed_[row].store(false, std::memory_order_relaxed);
+  std::cout << "\t" << num_of_rows << " words loaded; their word vectors are parsed " << (options_.warm_up? "in the background" : "when they are needed first") << ".\n";
+  if (options_.warm_up)
+    warm_up_thread_ = std::thread([this] {
+      for (unsigned row = 0; row < GetNumOfRows() && !warm_up_is_stopped_.load(std::memory_order_relaxed); row += kRowsPerParsingBatch)
+        ParseRows(row, std::min(GetNumOfRows(), row+kRowsPerParsingBatch));
+    });
+  return true;
+}
+
+void HashTableOnMemory::ParseRows(const unsigned first_row, const unsigned end_row) {
+// Parses the word vectors of the rows from "first_row" to "end_row" that have
+// not been parsed yet (from the mapped word vector file) and marks them as
+// parsed. Only one thread parses at once, so that every word vector is parsed
+// exactly once.
+  std::lock_guard<std::mutex> lock(lazy_parsing_mutex_);
+  const char* vector_file = (const char*) mapped_vector_file_;
+  ParsedLines parsed_lines;
+  unsigned num_of_parsed_rows = 0;
+  for (unsigned row = first_row; row < end_row; ++row) {
+    if (row_is_parsed_[row].load(std::memory_order_relaxed))
+      continue;
+    parsed_lines = ParsedLines();
+    const size_t offset = loaded_data_.offsets[row];
+    if (input_file_info_.format == kBinaryFormat)
+      ParseBinaryVectors(vector_file, &offset, &offset+1, parsed_lines);
+    else
+      ParseLines(vector_file+offset, vector_file+offset+1, vector_file+size_of_mapped_vector_file_, parsed_lines);
+    // The pointers to the word vectors, norms and scales point to the writable
+    // anonymous mapping "lazy_data_".
+    const size_t position = (size_t) row*vector_size_;
+    if (options_.precision == kInt8) {
+      memcpy(const_cast<int8_t*>(int8_vectors_+position), parsed_lines.int8_values.data(), vector_size_*sizeof(int8_t));
+      const_cast<float*>(scales_)[row] = parsed_lines.scales[0];
+    } else if (options_.precision == kFloat16)
+      memcpy(const_cast<uint16_t*>(half_vectors_+position), parsed_lines.half_values.data(), vector_size_*sizeof(uint16_t));
+    else
+      memcpy(const_cast<double*>(vectors_+position), parsed_lines.values.data(), vector_size_*sizeof(double));
+    const_cast<double*>(norms_)[row] = parsed_lines.norms[0];
+    row_is_parsed_[row].store(true, std::memory_order_release);
+    num_of_parsed_rows++;
+  }
+  num_of_parsed_rows_ += num_of_parsed_rows;
+  if (kStatistics.IsEnabled())
+    kStatistics.Add(Statistics::kLinesParsed, num_of_parsed_rows);
+}
+
+void HashTableOnMemory::ParseAllRows() {
+// Parses the word vectors of all rows that have not been parsed yet (needed
+// before all rows are compared or saved).
+  if (!is_lazy_ || num_of_parsed_rows_.load() == GetNumOfRows())
+    return;
+  StatisticsTimer parse_timer(Statistics::kParseTime);
+  for (unsigned row = 0; row < GetNumOfRows(); row += kRowsPerParsingBatch)
+    ParseRows(row, std::min(GetNumOfRows(), row+kRowsPerParsingBatch));
+}
+
+void HashTableOnMemory::StopLazyParsing() {
+// Stops the warm-up thread and unmaps the word vector file and the parsed
+// word vectors.
+  warm_up_is_stopped_ = true;
+  if (warm_up_thread_.joinable())
+    warm_up_thread_.join();
+  if (mapped_vector_file_ != NULL)
+    munmap(mapped_vector_file_, size_of_mapped_vector_file_);
+  if (lazy_data_ != NULL)
+    munmap(lazy_data_, size_of_lazy_data_);
+  mapped_vector_file_ = lazy_data_ = NULL;
+}
@@ -14,11 +14,90 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <cerrno>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
+#include <map>
 #include <regex>
 
 #include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
 
+struct NumericOption {
+// A command line option with a numeric value and the range of its valid
+// values.
+  const char* name;
+  double min_value;
+  double max_value;
+  bool is_integer;
+  bool value_is_optional; // if "true", the option may be given without a value (which stands for its default)
+};
+
+const NumericOption kNumericOptions[] = {
+  {"nearest", 1, 1e6, true, true},
+  {"max-load-factor", DBL_MIN, 1e6, false, false}, // any number greater than 0
+  {"threads", 0, 4096, true, false},
+  {"workers", 0, 4096, true, false},
+  {"hnsw-m", 2, 10000, true, false},
+  {"hnsw-ef-construction", 1, 1e6, true, false},
+  {"hnsw-ef-search", 1, 1e6, true, false},
+  {"hnsw-recall", 1, 1e7, true, true},
+  {"cache-size", 0, 1 << 24, true, false}, // megabytes
+  {"bucket-cache-size", 0, 1 << 24, true, false}, // megabytes
+  {"memory-budget", 1, 1 << 24, true, false}, // megabytes
+  {"pq-subspaces", 0, 10000, true, false},
+  {"pq-centroids", 1, 256, true, false},
+  {"pq-sample", 1, 1e9, true, false},
+  {"pq-shortlist", 0, 1e7, true, false},
+  {"quantization-error", 1, 1e9, true, true},
+  {"max-words", 0, 1e15, true, false}
+};
+
+bool ParseNumericOption(const NumericOption& option, const std::string& text, double& value) {
+// Parses "text" as the value of "option" and returns "false" if it is no
+// number, no integer although "option" needs one or out of its range.
+  if (text.empty() || isspace((unsigned char) text[0]))
+    return false;
+  char* end;
+  errno = 0;
+  value = strtod(text.c_str(), &end);
+  return (*end == '\0' && errno != ERANGE && std::isfinite(value) && (!option.is_integer || value == std::floor(value)) && value >= option.min_value && value <= option.max_value);
+}
+
+bool NumericOptionsAreValid(std::map<std::string, std::string>& options) {
+// Checks the values of all numeric options given and shows an error for the
+// first invalid one.
+  double value;
+  for (auto& option : kNumericOptions) {
+    auto given_option = options.find(option.name);
+    if (given_option == options.end() || (given_option->second.empty() && option.value_is_optional) || ParseNumericOption(option, given_option->second, value))
+      continue;
+    std::cout << "ERROR: INVALID VALUE \"" << given_option->second << "\" OF \"--" << option.name << "\" - it must be ";
+    if (option.is_integer)
+      std::cout << "an integer from " << (long long) option.min_value << " to " << (long long) option.max_value << "!\n";
+    else
+      std::cout << "a number greater than 0 and at most " << (long long) option.max_value << "!\n";
+    return false;
+  }
+  return true;
+}
+
+double GetNumericOption(std::map<std::string, std::string>& options, const std::string& name, const double default_value) {
+// Returns the value of the numeric option "name" (see "kNumericOptions"),
+// which is checked by "NumericOptionsAreValid()" before, or "default_value" if
+// the option is missing or given without a value.
+  auto given_option = options.find(name);
+  if (given_option == options.end() || given_option->second.empty())
+    return default_value;
+  double value = default_value;
+  for (auto& option : kNumericOptions) {
+    if (name == option.name && !ParseNumericOption(option, given_option->second, value))
+      return default_value;
+  }
+  return value;
+}
+
 std::string SetToLowerCase(std::string string) {
 // Sets every character of a string to lower case and returns the string as a
 // whole.
@@ -45,6 +124,212 @@ void StartComparing(T& hash_table) {
   }
 }
 
+template <typename T>
+void StartSearchingNearestNeighbours(T& hash_table, const int k, const Metric metric, ThreadPool& thread_pool, HnswIndex* hnsw_index, const bool scores_are_approximate = false) {
+// Allows the user to enter words whose "k" nearest neighbours will be shown
+// (found by "hnsw_index" if it is given and by the search of "hash_table"
+// otherwise). "scores_are_approximate" labels the shown scores as approximate
+// (e.g. those of a "PqTable" without re-ranking).
+  std::string word;
+  while (true) {
+    std::cout << "Enter a word whose " << k << " nearest neighbours you want to find (enter 'x' to terminate the program):\n";
+    if (!(std::cin >> word))
+      return;
+    // See "StartComparing()".
+    word = SetToLowerCase(word);
+    if (word == "x")
+      return;
+    const std::vector<Neighbour> neighbours = (hnsw_index != NULL)? hnsw_index->Nearest(word, k) : hash_table.Nearest(word, k, metric, thread_pool);
+    if (neighbours.empty()) {
+      std::cout << "\t\"" << word << "\" couldn't be found in your data!\n\n";
+      continue;
+    }
+    std::cout << "\tThe nearest neighbours of \"" << word << "\" (" << (scores_are_approximate? "approximate " : "") << ((metric == kCosineSimilarity)? "cosine similarity" : "Euclidean distance") << "):\n";
+    for (unsigned i = 0; i < neighbours.size(); ++i)
+      std::cout << "\t " << i+1 << ". " << neighbours[i].word << " (" << neighbours[i].score << ")\n";
+    std::cout << '\n';
+  }
+}
+
+int GetNearestK(std::map<std::string, std::string>& options) {
+// Returns the number of nearest neighbours given with "--nearest" (10 if no
+// number is given).
+  return GetNumericOption(options, "nearest", 10);
+}
+
+Metric GetMetric(std::map<std::string, std::string>& options) {
+// Returns the metric given with "--metric" (the cosine similarity by default).
+  return (options.count("metric") && SetToLowerCase(options["metric"]) == "euclidean")? kEuclideanDistance : kCosineSimilarity;
+}
+
+VectorPrecision GetPrecision(std::map<std::string, std::string>& options) {
+// Returns the precision given with "--precision" (doubles by default).
+  const std::string precision = SetToLowerCase(options["precision"]);
+  return (precision == "int8")? kInt8 : ((precision == "fp16" || precision == "f16")? kFloat16 : kFloat64);
+}
+
+double GetMaxLoadFactor(std::map<std::string, std::string>& options, const double default_max_load_factor) {
+// Returns the maximum load factor given with "--max-load-factor" (or
+// "default_max_load_factor" if the option is missing).
+  return GetNumericOption(options, "max-load-factor", default_max_load_factor);
+}
+
+int GetNumOfThreads(std::map<std::string, std::string>& options) {
+// Returns the number of threads given with "--threads" (0 if the option is
+// missing, which means as many threads as the hardware supports).
+  return GetNumericOption(options, "threads", 0);
+}
+
+std::unique_ptr<HnswIndex> CreateHnswIndex(HashTableOnMemory& hash_table, const std::string& input_file, std::map<std::string, std::string>& options, ThreadPool& thread_pool) {
+// Loads the HNSW index from the file given with "--hnsw" (by default the
+// input file followed by ".hnsw") or - if that is not possible - builds the
+// index and saves it to that file.
+  HnswParameters parameters;
+  parameters.m = GetNumericOption(options, "hnsw-m", parameters.m);
+  parameters.ef_construction = GetNumericOption(options, "hnsw-ef-construction", parameters.ef_construction);
+  parameters.ef_search = GetNumericOption(options, "hnsw-ef-search", parameters.ef_search);
+  std::unique_ptr<HnswIndex> hnsw_index(new HnswIndex(hash_table, GetMetric(options), parameters));
+  const std::string index_file = (options["hnsw"] == "")? input_file+".hnsw" : options["hnsw"];
+  if (!hnsw_index->Load(index_file)) {
+    hnsw_index->Build(thread_pool);
+    hnsw_index->Save(index_file);
+  }
+  if (options.count("hnsw-recall"))
+    hnsw_index->ShowRecall(GetNearestK(options), GetNumericOption(options, "hnsw-recall", 1000), thread_pool);
+  return hnsw_index;
+}
+
+HashTableReaderOptions GetHashTableReaderOptions(std::map<std::string, std::string>& options) {
+// Returns the options of "HashTableReader" given with "--cache-size" and
+// "--bucket-cache-size" (in megabytes).
+  HashTableReaderOptions hash_table_reader_options;
+  if (options.count("cache-size"))
+    hash_table_reader_options.vector_cache_size = (long long) GetNumericOption(options, "cache-size", 0)*1024*1024;
+  if (options.count("bucket-cache-size"))
+    hash_table_reader_options.bucket_cache_size = (long long) GetNumericOption(options, "bucket-cache-size", 0)*1024*1024;
+  return hash_table_reader_options;
+}
+
+bool OpenBatchFiles(std::map<std::string, std::string>& options, std::ifstream& batch_file_stream, std::ofstream& output_file_stream) {
+// Opens the file given with "--batch" (unless it is "-", i.e. the standard
+// input) and the file given with "--output" (if that option is given) and
+// returns "false" if that is not possible.
+  if (options["batch"] != "-") {
+    batch_file_stream.open(options["batch"]);
+    if (!batch_file_stream.is_open()) {
+      std::cout << "ERROR: OPENING \"" << options["batch"] << "\" FAILED!\n";
+      return false;
+    }
+  }
+  if (options.count("output")) {
+    output_file_stream.open(options["output"], std::ios_base::trunc);
+    if (!output_file_stream.is_open()) {
+      std::cout << "ERROR: OPENING \"" << options["output"] << "\" FAILED!\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+int StartBatchComparison(HashTableOnMemory& hash_table, std::map<std::string, std::string>& options, std::streambuf* stdout_buffer, ThreadPool& thread_pool, HnswIndex* hnsw_index) {
+// Compares the word pairs of the file given with "--batch" ("-" = standard
+// input) - or finds the nearest neighbours of its queries if "--nearest" is
+// given - and writes the results to the file given with "--output" (or to the
+// standard output if that option is missing).
+  std::ifstream word_pairs_file_stream;
+  std::ofstream output_file_stream;
+  if (!OpenBatchFiles(options, word_pairs_file_stream, output_file_stream))
+    return -1;
+  std::ostream standard_output(stdout_buffer);
+  std::istream& in = word_pairs_file_stream.is_open()? word_pairs_file_stream : std::cin;
+  std::ostream& out = options.count("output")? output_file_stream : standard_output;
+  if (options.count("nearest")) {
+    std::cout << "\tFinding nearest neighbours using " << thread_pool.GetNumOfThreads() << " threads..." << std::endl;
+    hash_table.FindNearestNeighbours(in, out, GetNearestK(options), GetMetric(options), thread_pool, hnsw_index);
+  } else {
+    std::cout << "\tComparing word pairs using " << thread_pool.GetNumOfThreads() << " threads..." << std::endl;
+    hash_table.CompareWordPairs(in, out, thread_pool);
+  }
+  std::cout << "\t---Done.\n";
+  return 0;
+}
+
+int StartProductQuantizedSearch(const std::string& input_file, std::map<std::string, std::string>& options, std::streambuf* stdout_buffer, ThreadPool& thread_pool) {
+// Finds nearest neighbours with a "PqTable": "input_file" is either a table
+// file or a word vector file, in which case the table is loaded from the file
+// given with "--pq" (by default the input file followed by ".pq") or - if that
+// is not possible - built and saved to that file. The queries are entered by
+// the user or read from the file given with "--batch".
+  PqParameters parameters;
+  parameters.num_of_subspaces = GetNumericOption(options, "pq-subspaces", parameters.num_of_subspaces);
+  parameters.num_of_centroids = GetNumericOption(options, "pq-centroids", parameters.num_of_centroids);
+  parameters.sample_size = GetNumericOption(options, "pq-sample", parameters.sample_size);
+  PqTable pq_table(parameters);
+  if (PqTable::IsPqFile(input_file))
+    pq_table.Load(input_file);
+  else {
+    const std::string pq_file = (options["pq"] == "")? input_file+".pq" : options["pq"];
+    if (!pq_table.Load(pq_file, input_file) && pq_table.Build(input_file, thread_pool))
+      pq_table.Save(pq_file);
+  }
+  if (!pq_table.PqTableIsValid())
+    return -1;
+  std::unique_ptr<HashTableReader> reranking_table;
+  if (options.count("pq-rerank")) {
+    reranking_table.reset(new HashTableReader(options["pq-rerank"], GetHashTableReaderOptions(options)));
+    pq_table.SetReranking(reranking_table.get(), GetNumericOption(options, "pq-shortlist", 0));
+  }
+  if (!pq_table.ScoresAreExact())
+    std::cout << "\tThe scores are approximated with the centroids of the word vectors (use \"--pq-rerank\" to get exact scores).\n";
+  if (options.count("batch")) {
+    std::ifstream queries_file_stream;
+    std::ofstream output_file_stream;
+    if (!OpenBatchFiles(options, queries_file_stream, output_file_stream))
+      return -1;
+    std::ostream standard_output(stdout_buffer);
+    std::cout << "\tFinding nearest neighbours using " << thread_pool.GetNumOfThreads() << " threads..." << std::endl;
+    pq_table.FindNearestNeighbours(queries_file_stream.is_open()? queries_file_stream : std::cin, options.count("output")? output_file_stream : standard_output, GetNearestK(options), GetMetric(options), thread_pool);
+    std::cout << "\t---Done.\n";
+    if (reranking_table)
+      reranking_table->ShowCacheInfo();
+    return 0;
+  }
+  StartSearchingNearestNeighbours(pq_table, GetNearestK(options), GetMetric(options), thread_pool, NULL, !pq_table.ScoresAreExact());
+  if (reranking_table)
+    reranking_table->ShowCacheInfo();
+  std::cout << "\nProgram terminated.";
+  return 0;
+}
+
+AnalogyMethod GetAnalogyMethod(std::map<std::string, std::string>& options) {
+// Returns the method given with "--analogy-method" (both methods by default).
+  const std::string method = SetToLowerCase(options["analogy-method"]);
+  return (method == "3cosadd")? k3CosAdd : ((method == "3cosmul")? k3CosMul : kBothAnalogyMethods);
+}
+
+int StartAnalogyEvaluation(HashTableOnMemory& hash_table, std::map<std::string, std::string>& options, ThreadPool& thread_pool) {
+// Evaluates the word vectors with the analogy questions of the file given with
+// "--analogy".
+  std::ifstream analogies_file_stream(options["analogy"]);
+  if (!analogies_file_stream.is_open()) {
+    std::cout << "ERROR: OPENING \"" << options["analogy"] << "\" FAILED!\n";
+    return -1;
+  }
+  hash_table.EvaluateAnalogies(analogies_file_stream, GetAnalogyMethod(options), thread_pool);
+  return 0;
+}
+
+std::vector<std::string> GetSimilarityBenchmarkFiles(std::map<std::string, std::string>& options) {
+// Returns the comma-separated files given with "--similarity".
+  std::vector<std::string> files;
+  std::stringstream stream(options["similarity"]);
+  std::string file;
+  while (std::getline(stream, file, ','))
+    if (!file.empty())
+      files.push_back(file);
+  return files;
+}
+
 bool IsInteger(const std::string& string_to_check) {
 // Returns "true" if "string_to_check" equals an integer and "false" otherwise.
   for (auto& character : string_to_check) {
@@ -57,8 +342,9 @@ bool IsInteger(const std::string& string_to_check) {
 bool IsHashTableFile(const std::string& file_to_check) {
 // Checks if the given file is a hash table file or a "normal" word vector file
 // by reading the first line. If the file is a hash table file created by this
-// program, the first line contains only three integers separated by ',' - if
-// that is the case "true" will be returned and "false" otherwise.
+// program, the first line contains only three or four integers separated by
+// ',' (the fourth one being the hash function) - if that is the case "true"
+// will be returned and "false" otherwise.
   std::ifstream file_stream(file_to_check);
   std::string first_line, value;
   std::getline(file_stream, first_line);
@@ -66,12 +352,12 @@ bool IsHashTableFile(const std::string& file_to_check) {
   std::vector<std::string> check_vector;
   int vector_size_count = 0;
   while (std::getline(stream, value, ',')) {
-    if (vector_size_count == 3)
+    if (vector_size_count == 4)
       return false;
     check_vector.push_back(value);
     vector_size_count++;
   }
-  if (vector_size_count != 3)
+  if (vector_size_count < 3)
     return false;
   for (auto& value : check_vector) {
     if (!IsInteger(value))
@@ -80,6 +366,54 @@ bool IsHashTableFile(const std::string& file_to_check) {
   return true;
 }
 
+void SplitArguments(int argc, char* argv[], std::vector<std::string>& files, std::map<std::string, std::string>& options) {
+// Separates the "options" (arguments starting with "--", given either as
+// "--option" or as "--option=value") from the "files" given as arguments.
+  std::string argument;
+  for (int i = 1; i < argc; ++i) {
+    argument = argv[i];
+    if (argument.compare(0, 2, "--") == 0) {
+      const size_t equals_sign = argument.find('=');
+      if (equals_sign == std::string::npos)
+        options[argument.substr(2)] = "";
+      else
+        options[argument.substr(2, equals_sign-2)] = argument.substr(equals_sign+1);
+    } else
+      files.push_back(argument);
+  }
+}
+
+class StatisticsReporter {
+// Enables "kStatistics" if "--stats" or "--stats-json=FILE" is given and shows
+// or saves them when the program terminates (i.e. when the reporter is
+// destroyed, after everything constructed later in "main()").
+ public:
+  StatisticsReporter(std::map<std::string, std::string>& options)
+      : show_report_(options.count("stats") > 0),
+        json_file_(options.count("stats-json")? options["stats-json"] : "") {
+    if (show_report_ || !json_file_.empty())
+      kStatistics.Enable();
+  }
+
+  ~StatisticsReporter() {
+    if (show_report_)
+      kStatistics.ShowReport();
+    if (!json_file_.empty() && !kStatistics.SaveJson(json_file_))
+      std::cout << "ERROR: WRITING THE STATISTICS TO \"" << json_file_ << "\" FAILED!\n";
+  }
+
+ private:
+  const bool show_report_;
+  const std::string json_file_;
+};
+
+void ShowUsage() {
+// Shows how to use the program (after a wrong argument).
+  std::cout << "Style of usage:\n\t.\\wvewht [input_file_containing_word_vectors] [output_file (optional; if this argument is given, the hash table will be written to that \"output_file\")] [--memory-budget=MB (optional; only used when writing a hash table file)] [--max-load-factor=F (optional; the maximum number of word vectors per slot or bucket)] [--mph (optional; writes the hash table file with a minimal perfect hash)] [--append (optional; writes the word vectors to a new delta segment of the existing \"output_file\")] [--cache-size=MB [--bucket-cache-size=MB] (optional; only used when reading a hash table file)] [--normalize (optional; stores the word vectors unit-normalized on memory)] [--precision=f64|fp16|int8 [--quantization-error[=N]] (optional; stores the word vectors quantized)] [--snapshot[=SNAPSHOT_FILE] [--verify-snapshot] (optional; maps the word vectors from a binary snapshot or saves them to it)] [--lazy [--warm-up] (optional; parses every word vector when it is needed first)] [--max-words=N (optional; reads only the first N word vectors)] [--vocabulary=VOCABULARY_FILE (optional; reads only the word vectors of the words in the file)] [--batch=WORD_PAIRS_FILE [--output=FILE] [--threads=N] (optional; compares all word pairs of the file at once)] [--nearest[=K] [--metric=cosine|euclidean] [--hnsw[=INDEX_FILE]] [--pq[=PQ_FILE] [--pq-rerank=HASH_TABLE_FILE]] (optional; finds nearest neighbours instead of comparing word pairs)] [--analogy=ANALOGIES_FILE [--analogy-method=3cosadd|3cosmul|both] (optional; evaluates the word vectors with analogy questions)] [--similarity=BENCHMARK_FILE[,BENCHMARK_FILE...] (optional; evaluates the word vectors with word similarity benchmarks)] [--serve=unix:PATH|tcp:PORT [--workers=N] (optional; answers the requests of clients)] [--stats] [--stats-json=FILE (optional; shows or saves statistics of the hot paths)]\n\t.\\wvewht [hash_table_file] --compact (merges the delta segments of the hash table file into it)\n\t.\\wvewht --connect=unix:PATH|tcp:PORT [REQUEST] (sends a request - or every line of the standard input - to a server)\n";
+  std::cout << "Example usage:\n\t.\\wvewht my_word_vectors.txt my_word_vector_hash_table.csv\n";
+  std::cout << "\nProgram terminated.";
+}
+
 int main(int argc, char* argv[]) {
 // At least one additional argument is needed.
 // Case 1: If you want to create a hash table only on memory, a word vector
@@ -88,32 +422,224 @@ int main(int argc, char* argv[]) {
 //  saved in a file, that hash table file has to be the additional argument.
 // Case 3: If you want to save a hash table containing your word vectors in a
 //  file, both a word vector file and an output file are needed as arguments.
-  if (argc == 2) { // if one file is given as argument
-    if (IsHashTableFile(argv[1])) { // checks if the given file is a hash table file or a "normal" word vector file
-      HashTableReader hash_table_reader(argv[1]);
+// A word vector file may be a text file with one word vector per line (e.g.
+// GloVe), the same with a header line containing the number of word vectors
+// and their size (e.g. fastText ".vec") or a binary word2vec file; the format
+// is detected automatically. Word vector files compressed with gzip or zstd
+// (which needs the program "zstd") are decompressed while they are read.
+// Options:
+//  --memory-budget=MB: the number of megabytes of the word vector file
+//   "HashTableWriter" may hold on memory at once (default: 1024).
+//  --max-load-factor=F: the maximum number of word vectors per slot of
+//   "HashTableOnMemory" (default: 0.5, at most 0.9) or per bucket of
+//   "HashTableWriter" (default: 1); the number of slots or buckets is the
+//   smallest power of two that keeps the load factor at most F.
+//  --mph: "HashTableWriter" gives every word a bucket of its own with a
+//   minimal perfect hash (saved next to the hash table file with the
+//   extension ".mph"), which is built on "--threads" threads; a lookup is
+//   then one hash, one bucket read and one comparison of the word.
+//  --append: "HashTableWriter" writes the word vectors to a new delta segment
+//   of the hash table file given as output file (which has to exist) instead
+//   of to that file, so that adding or updating words costs time proportional
+//   to their number; "HashTableReader" prefers the word vectors of the delta
+//   segments (the newest one first).
+//  --compact: given with a hash table file only, merges its delta segments
+//   into a fresh hash table file (written with MurmurHash64A) replacing it; if
+//   the number of buckets need not grow, in a single pass over the file.
+//  --cache-size=MB: the number of megabytes of recently read word vectors
+//   "HashTableReader" keeps on memory (default: 64; 0 = no cache), so that
+//   repeated words are not read from the hash table file again.
+//  --bucket-cache-size=MB: the number of megabytes of recently read buckets
+//   (lines of the hash table file) "HashTableReader" keeps on memory (default:
+//   0, i.e. no bucket cache).
+//  --normalize: "HashTableOnMemory" stores the word vectors unit-normalized.
+//  --precision=f64|fp16|int8: the precision the word vectors are stored with
+//   by "HashTableOnMemory" and "HashTableWriter" (default: f64); fp16 and int8
+//   need 4 and 8 times less memory (similarities are calculated directly on
+//   the quantized values). "--quantization-error[=N]" compares the cosine
+//   similarities of N (default: 10000) random pairs of quantized word vectors
+//   with those of the full-precision word vectors.
+//  --snapshot[=FILE]: "HashTableOnMemory" maps its word vectors, words and
+//   slots read-only from the binary snapshot "FILE" (by default the word
+//   vector file followed by ".snapshot") instead of parsing the word vector
+//   file, or saves them to "FILE" after parsing it if the snapshot is missing
+//   or does not fit the word vector file (its size and modification time),
+//   "--precision" or "--normalize". A snapshot can also be given instead of
+//   the word vector file. "--verify-snapshot" verifies the checksum of the
+//   word vectors of the snapshot as well (otherwise only the checksums of its
+//   header, slots and words are verified).
+//  --lazy: "HashTableOnMemory" reads only the words while loading and parses
+//   every word vector (from the mapped word vector file) when it is needed
+//   first, so that the first comparisons start much earlier; finding nearest
+//   neighbours or answering analogies parses all of them at once. Compressed
+//   word vector files are parsed completely while loading. "--warm-up" parses
+//   all word vectors in the background after loading.
+//  --max-words=N: "HashTableOnMemory" and "HashTableWriter" only read the
+//   first N word vectors of the word vector file (which is usually sorted by
+//   the frequency of the words).
+//  --vocabulary=FILE: "HashTableOnMemory" and "HashTableWriter" only read the
+//   word vectors of the words in "FILE" (the first token of every line); the
+//   other lines are skipped before their values are parsed. The hash table is
+//   sized for the words that are read, and snapshots are not used.
+//  --kernels=NAME: uses the similarity kernels "NAME" ("scalar", "sse2",
+//   "avx2" or "avx512") instead of the best ones the CPU supports.
+//  --batch=FILE: compares the word pairs (two tab-separated words per line)
+//   of "FILE" ("-" = standard input) with "HashTableOnMemory" instead of
+//   starting the interactive comparison; the results are written as
+//   tab-separated lines to the file given with "--output=FILE" or to the
+//   standard output (all other messages are then written to the standard
+//   error output).
+//  --nearest[=K]: finds the K (default: 10) nearest neighbours of the words
+//   entered by the user - or of the queries of the batch file (a word or the
+//   values of a vector per line) - instead of comparing word pairs.
+//  --metric=cosine|euclidean: the measurement the nearest neighbours are
+//   found with (default: cosine).
+//  --hnsw[=FILE]: nearest neighbours are found approximately with an HNSW
+//   index, which is loaded from "FILE" (by default the word vector file
+//   followed by ".hnsw") or built and saved to "FILE" if that is not possible.
+//   The index is configured with "--hnsw-m=M" (default: 16),
+//   "--hnsw-ef-construction=N" (default: 200) and "--hnsw-ef-search=N"
+//   (default: 64); "--hnsw-recall[=N]" compares it with the exact search for N
+//   (default: 1000) random words and prints the recall@k.
+//  --pq[=FILE]: nearest neighbours are found approximately with a
+//   product-quantized table instead of "HashTableOnMemory"; the table is
+//   loaded from "FILE" (by default the word vector file followed by ".pq") or
+//   built and saved to "FILE" if that is not possible (a table file can also
+//   be given instead of the word vector file). The table is configured with
+//   "--pq-subspaces=M" (the bytes per word vector; default: a quarter of the
+//   vector size), "--pq-centroids=K" (per subspace; default and maximum: 256)
+//   and "--pq-sample=N" (the number of word vectors the codebooks are trained
+//   on; default: 20000). "--pq-rerank=HASH_TABLE_FILE" re-ranks the best
+//   "--pq-shortlist=N" (default: ten times the number of nearest neighbours)
+//   candidates with the exact vectors of a hash table file; without it, the
+//   scores are only approximated with the centroids and labelled as such.
+//  --analogy=FILE: evaluates the word vectors with the analogy questions of
+//   "FILE" (lines "a b c d", sections started by lines beginning with ':') and
+//   prints the accuracy per section; "--analogy-method=3cosadd|3cosmul|both"
+//   selects the method(s) the questions are answered with (default: both).
+//  --similarity=FILE[,FILE...]: evaluates the word vectors with word
+//   similarity benchmarks (lines "word_0 word_1 rating") and prints the
+//   Spearman and Pearson correlations of the cosine similarities with the
+//   ratings, the coverage and the number of unknown words per benchmark (also
+//   possible with a hash table file, which is then read in a single pass).
+//  --serve=ADDRESS: "HashTableOnMemory" answers the requests of clients on
+//   "ADDRESS" ("unix:PATH" for a Unix domain socket or "tcp:PORT" for a TCP
+//   port of localhost) instead of starting the interactive comparison; the
+//   requests are answered concurrently by "--workers=N" threads (default: as
+//   many as the hardware supports). See "server.cc" for the protocol.
+//  --connect=ADDRESS [REQUEST...]: sends the request given by the remaining
+//   arguments - or every line of the standard input - to the server listening
+//   on "ADDRESS", writes the responses to the standard output and the
+//   round-trip latency percentiles to the standard error output ("batch FILE"
+//   sends the word pairs of "FILE"); no input file is needed.
+//  --stats: counts and times the hot paths (loading, lookups and their probes,
+//   similarity kernels, reading and writing hash table files) and prints
+//   the counters, timers, latency percentiles and a memory breakdown when the
+//   program terminates; "--stats-json=FILE" writes them to "FILE" as a JSON
+//   object. Without these options the hot paths only check whether the
+//   statistics are enabled.
+//  --threads=N: the number of threads used for loading word vector files,
+//   batch processing, nearest neighbour searches, evaluations and building
+//   HNSW indices, product-quantized tables and minimal perfect hashes
+//   (default: as many as the hardware supports).
+  std::vector<std::string> files;
+  std::map<std::string, std::string> options;
+  SplitArguments(argc, argv, files, options);
+  if (!NumericOptionsAreValid(options)) {
+    ShowUsage();
+    return -1;
+  }
+  if (options.count("connect")) // the remaining arguments are the request
+    return StartClient(options["connect"], files);
+  StatisticsReporter statistics_reporter(options);
+  if (options.count("kernels") && !SelectSimilarityKernels(options["kernels"]))
+    std::cout << "WARNING: THE SIMILARITY KERNELS \"" << options["kernels"] << "\" ARE NOT SUPPORTED - \"" << kSimilarityKernels.name << "\" will be used.\n";
+  if (files.size() == 1 && !options.count("compact")) { // if one file is given as argument
+    if (IsHashTableFile(files[0])) { // checks if the given file is a hash table file or a "normal" word vector file
+      HashTableReader hash_table_reader(files[0], GetHashTableReaderOptions(options));
+      if (options.count("similarity")) {
+        WordSimilarityBenchmarks benchmarks(GetSimilarityBenchmarkFiles(options));
+        if (!benchmarks.BenchmarksAreValid())
+          return -1;
+        hash_table_reader.EvaluateWordSimilarities(benchmarks);
+        return 0;
+      }
       StartComparing(hash_table_reader);
+      hash_table_reader.ShowCacheInfo();
     } else {
-      HashTableOnMemory hash_table_on_memory(argv[1]);
+      HashTableOptions hash_table_options;
+      hash_table_options.normalize = (options.count("normalize") > 0);
+      hash_table_options.precision = GetPrecision(options);
+      hash_table_options.max_load_factor = GetMaxLoadFactor(options, hash_table_options.max_load_factor); // at most 0.9 is used (open addressing needs empty slots)
+      if (options.count("snapshot"))
+        hash_table_options.snapshot_file = (options["snapshot"] == "")? files[0]+".snapshot" : options["snapshot"];
+      hash_table_options.verify_snapshot = (options.count("verify-snapshot") > 0);
+      hash_table_options.lazy = (options.count("lazy") > 0);
+      hash_table_options.warm_up = (options.count("warm-up") > 0);
+      hash_table_options.max_words = GetNumericOption(options, "max-words", 0);
+      hash_table_options.vocabulary_file = options.count("vocabulary")? options["vocabulary"] : "";
+      if (options.count("batch"))
+        std::ios_base::sync_with_stdio(false);
+      std::streambuf* stdout_buffer = std::cout.rdbuf();
+      if (options.count("batch") && !options.count("output")) // the standard output is reserved for the results
+        std::cout.rdbuf(std::cerr.rdbuf());
+      ThreadPool thread_pool(GetNumOfThreads(options));
+      if (options.count("pq") || PqTable::IsPqFile(files[0]))
+        return StartProductQuantizedSearch(files[0], options, stdout_buffer, thread_pool);
+      HashTableOnMemory hash_table_on_memory(files[0], thread_pool, hash_table_options);
       if (!hash_table_on_memory.HashTableIsValid())
         return -1;
+      if (options.count("quantization-error"))
+        hash_table_on_memory.ShowQuantizationError(GetNumericOption(options, "quantization-error", 10000));
+      std::unique_ptr<HnswIndex> hnsw_index;
+      if (options.count("hnsw"))
+        hnsw_index = CreateHnswIndex(hash_table_on_memory, files[0], options, thread_pool);
+      if (options.count("similarity")) {
+        WordSimilarityBenchmarks benchmarks(GetSimilarityBenchmarkFiles(options));
+        if (!benchmarks.BenchmarksAreValid())
+          return -1;
+        hash_table_on_memory.EvaluateWordSimilarities(benchmarks, thread_pool);
+      }
+      if (options.count("analogy"))
+        return StartAnalogyEvaluation(hash_table_on_memory, options, thread_pool);
+      if (options.count("similarity"))
+        return 0;
+      if (options.count("serve")) {
+        QueryServer query_server(hash_table_on_memory, thread_pool, GetNumericOption(options, "workers", 0));
+        return query_server.Serve(options["serve"]);
+      }
+      if (options.count("batch"))
+        return StartBatchComparison(hash_table_on_memory, options, stdout_buffer, thread_pool, hnsw_index.get());
       std::string answer;
-      std::cout << "Enter \"prinfo\" to show information about the hash table (number of buckets, number of word vectors in the buckets and load factor); enter anything else to skip:\n";
+      std::cout << "Enter \"prinfo\" to show information about the hash table (number of slots, load factor and probe lengths); enter anything else to skip:\n";
       std::cin >> answer;
       if (std::regex_match(SetToLowerCase(answer), (std::regex) "prinfo|((print|show)_?info)"))
         hash_table_on_memory.PrintInfo();
-      StartComparing(hash_table_on_memory);
+      if (options.count("nearest"))
+        StartSearchingNearestNeighbours(hash_table_on_memory, GetNearestK(options), GetMetric(options), thread_pool, hnsw_index.get());
+      else
+        StartComparing(hash_table_on_memory);
     }
     std::cout << "\nProgram terminated.";
     return 0;
-  } else if (argc == 3) { // if two files are given as arguments: a hash table will be created and saved in a file
-    HashTableWriter HTW(argv[1], argv[2]);
+  } else if (files.size() == 2 || (files.size() == 1 && options.count("compact"))) { // if two files are given as arguments: a hash table will be created and saved in a file
+    HashTableWriterOptions hash_table_writer_options;
+    if (options.count("memory-budget"))
+      hash_table_writer_options.memory_budget = (long long) GetNumericOption(options, "memory-budget", 1024)*1024*1024;
+    hash_table_writer_options.precision = GetPrecision(options);
+    hash_table_writer_options.max_load_factor = GetMaxLoadFactor(options, hash_table_writer_options.max_load_factor);
+    hash_table_writer_options.minimal_perfect_hash = (options.count("mph") > 0);
+    hash_table_writer_options.num_of_threads = GetNumOfThreads(options);
+    hash_table_writer_options.append = (options.count("append") > 0);
+    hash_table_writer_options.compact = (options.count("compact") > 0);
+    hash_table_writer_options.max_words = GetNumericOption(options, "max-words", 0);
+    hash_table_writer_options.vocabulary_file = options.count("vocabulary")? options["vocabulary"] : "";
+    HashTableWriter HTW(files[0], files.back(), hash_table_writer_options);
     return 0;
-  } else if (argc == 1)
+  } else if (files.empty())
     std::cout << "ERROR: MISSING ARGUMENT - No input file given!\n";
   else
     std::cout << "ERROR: TOO MANY ARGUMENTS - Only one input file needed!\n";
-  std::cout << "Style of usage:\n\t.\\wvewht [input_file_containing_word_vectors] [output_file (optional; if this argument is given, the hash table will be written to that \"output_file\")]\n";
-  std::cout << "Example usage:\n\t.\\wvewht my_word_vectors.txt my_word_vector_hash_table.csv\n";
-  std::cout << "\nProgram terminated.";
+  ShowUsage();
   return -1;
 }
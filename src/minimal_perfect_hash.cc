@@ -0,0 +1,199 @@
+// minimal_perfect_hash.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Minimal perfect hashing with BBHash (Limasset et al., 2017): every level is
+// a bit array of "kGamma" bits per key that is still unplaced; every key sets
+// the bit its hash (for the level) refers to, keys that share a bit with
+// another key are passed on to the next level, and all other keys are placed.
+// The number of a key is the number of set bits before its bit (its rank), so
+// that the numbers of all keys are distinct and smaller than the number of
+// keys. Only the 64-bit hashes of the keys are needed to build the function.
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+namespace {
+
+// The minimal perfect hash file starts with "kMinimalPerfectHashMagic" and
+// "kMinimalPerfectHashVersion", followed by the number of keys, the number of
+// levels, the number of keys placed by the fallback, the offsets of the levels
+// (in bits), the bits of all levels and the fallback (pairs of a hash and its
+// number).
+const std::string kMinimalPerfectHashMagic = "WVEWHTMP";
+const unsigned kMinimalPerfectHashVersion = 1;
+const double kGamma = 2.0; // the number of bits per unplaced key of a level (more bits need more memory but fewer levels)
+const int kMaxNumOfLevels = 32; // keys left after the last level are placed by a fallback std::unordered_map
+const unsigned kWordsPerRankBlock = 8; // a rank is stored for every 512 bits
+
+uint64_t GetPositionInLevel(const uint64_t hash, const int level, const uint64_t num_of_bits) {
+// Returns the bit of "level" (consisting of "num_of_bits" bits) the key with
+// "hash" refers to: the hash is mixed with the level (the finalizer of
+// SplitMix64) and mapped to the bits without a division.
+  uint64_t mixed_hash = hash+(level+1)*0x9e3779b97f4a7c15ULL;
+  mixed_hash = (mixed_hash^(mixed_hash >> 30))*0xbf58476d1ce4e5b9ULL;
+  mixed_hash = (mixed_hash^(mixed_hash >> 27))*0x94d049bb133111ebULL;
+  mixed_hash ^= mixed_hash >> 31;
+  return ((unsigned __int128) mixed_hash*num_of_bits) >> 64;
+}
+
+} // namespace
+
+MinimalPerfectHash::MinimalPerfectHash()
+    : num_of_keys_(0),
+      level_offsets_(1, 0) {}
+
+MinimalPerfectHash::~MinimalPerfectHash() {}
+
+void MinimalPerfectHash::Build(std::vector<uint64_t>& hashes, ThreadPool& thread_pool) {
+// Builds the function for the keys with the given "hashes" on all threads of
+// "thread_pool" (keys with equal hashes get the same number, so that the
+// number of keys is the number of distinct hashes). "hashes" is reused for the
+// keys that are still unplaced, which keeps the memory needed at about eight
+// bytes per key plus "kGamma" bits per key for the levels.
+  std::sort(hashes.begin(), hashes.end());
+  hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+  num_of_keys_ = hashes.size();
+  bits_.clear();
+  level_offsets_.assign(1, 0);
+  fallback_.clear();
+  const int num_of_chunks = thread_pool.GetNumOfThreads();
+  std::vector<std::vector<uint64_t>> unplaced_keys_of_chunks(num_of_chunks);
+  for (int level = 0; level < kMaxNumOfLevels && !hashes.empty(); ++level) {
+    const uint64_t num_of_words = std::max<uint64_t>(1, (uint64_t) (kGamma*hashes.size()+63)/64), num_of_bits = 64*num_of_words;
+    std::unique_ptr<std::atomic<uint64_t>[]> set_bits(new std::atomic<uint64_t>[num_of_words]), collisions(new std::atomic<uint64_t>[num_of_words]);
+    for (uint64_t word = 0; word < num_of_words; ++word) {
+      set_bits[word].store(0, std::memory_order_relaxed);
+      collisions[word].store(0, std::memory_order_relaxed);
+    }
+    thread_pool.ParallelFor(hashes.size(), [&](size_t begin, size_t end, int) {
+      for (size_t i = begin; i < end; ++i) {
+        const uint64_t position = GetPositionInLevel(hashes[i], level, num_of_bits), bit = 1ULL << (position&63);
+        if (set_bits[position >> 6].fetch_or(bit, std::memory_order_relaxed)&bit)
+          collisions[position >> 6].fetch_or(bit, std::memory_order_relaxed);
+      }
+    });
+    bits_.resize(bits_.size()+num_of_words);
+    uint64_t* level_bits = &bits_[level_offsets_.back()/64];
+    for (uint64_t word = 0; word < num_of_words; ++word)
+      level_bits[word] = set_bits[word].load(std::memory_order_relaxed)&~collisions[word].load(std::memory_order_relaxed);
+    thread_pool.ParallelFor(hashes.size(), [&](size_t begin, size_t end, int chunk) {
+      unplaced_keys_of_chunks[chunk].clear();
+      for (size_t i = begin; i < end; ++i) {
+        const uint64_t position = GetPositionInLevel(hashes[i], level, num_of_bits);
+        if ((level_bits[position >> 6] >> (position&63)&1) == 0)
+          unplaced_keys_of_chunks[chunk].push_back(hashes[i]);
+      }
+    }, num_of_chunks);
+    level_offsets_.push_back(level_offsets_.back()+num_of_bits);
+    size_t num_of_unplaced_keys = 0;
+    for (int chunk = 0; chunk < num_of_chunks && chunk < (int) hashes.size(); ++chunk) {
+      std::copy(unplaced_keys_of_chunks[chunk].begin(), unplaced_keys_of_chunks[chunk].end(), hashes.begin()+num_of_unplaced_keys);
+      num_of_unplaced_keys += unplaced_keys_of_chunks[chunk].size();
+    }
+    hashes.resize(num_of_unplaced_keys);
+  }
+  SetRanks();
+  const uint64_t num_of_placed_keys = num_of_keys_-hashes.size();
+  for (size_t i = 0; i < hashes.size(); ++i)
+    fallback_[hashes[i]] = num_of_placed_keys+i;
+  std::vector<uint64_t>().swap(hashes);
+}
+
+void MinimalPerfectHash::SetRanks() {
+// Stores the number of set bits before every block of "kWordsPerRankBlock"
+// words of "bits_".
+  ranks_.assign(bits_.size()/kWordsPerRankBlock+1, 0);
+  uint64_t rank = 0;
+  for (size_t word = 0; word < bits_.size(); ++word) {
+    if (word%kWordsPerRankBlock == 0)
+      ranks_[word/kWordsPerRankBlock] = rank;
+    rank += __builtin_popcountll(bits_[word]);
+  }
+}
+
+uint64_t MinimalPerfectHash::GetRank(const uint64_t position) const {
+// Returns the number of set bits of "bits_" before "position".
+  const uint64_t word = position >> 6;
+  uint64_t rank = ranks_[word/kWordsPerRankBlock];
+  for (uint64_t i = word-word%kWordsPerRankBlock; i < word; ++i)
+    rank += __builtin_popcountll(bits_[i]);
+  return rank+__builtin_popcountll(bits_[word]&((1ULL << (position&63))-1));
+}
+
+uint64_t MinimalPerfectHash::GetIndex(const char* key, const size_t length) const {
+// Returns the number of "key" (smaller than the number of keys). Keys the
+// function was not built for get an arbitrary number, so that the caller has
+// to verify the key found under the number.
+  const uint64_t hash = GetMurmurHash64(key, length);
+  for (size_t level = 0; level+1 < level_offsets_.size(); ++level) {
+    const uint64_t position = level_offsets_[level]+GetPositionInLevel(hash, level, level_offsets_[level+1]-level_offsets_[level]);
+    if (bits_[position >> 6] >> (position&63)&1)
+      return GetRank(position);
+  }
+  const auto fallback = fallback_.find(hash);
+  return (fallback != fallback_.end())? fallback->second : 0;
+}
+
+bool MinimalPerfectHash::Save(const std::string& file) {
+// Saves the function to "file" and returns "true" if that was successful.
+  std::ofstream out(file, std::ios_base::trunc|std::ios_base::binary);
+  const uint64_t values[] = {kMinimalPerfectHashVersion, num_of_keys_, level_offsets_.size()-1, fallback_.size()};
+  out.write(kMinimalPerfectHashMagic.data(), kMinimalPerfectHashMagic.size());
+  out.write((const char*) values, sizeof(values));
+  out.write((const char*) level_offsets_.data(), level_offsets_.size()*sizeof(uint64_t));
+  out.write((const char*) bits_.data(), bits_.size()*sizeof(uint64_t));
+  for (auto& key : fallback_) {
+    const uint64_t pair[2] = {key.first, key.second};
+    out.write((const char*) pair, sizeof(pair));
+  }
+  if (!out) {
+    std::cout << "ERROR: WRITING THE MINIMAL PERFECT HASH FILE \"" << file << "\" FAILED!\n";
+    return false;
+  }
+  return true;
+}
+
+bool MinimalPerfectHash::Load(const std::string& file) {
+// Loads the function from "file" and returns "true" if that was successful.
+  std::ifstream in(file, std::ios_base::binary);
+  std::string magic(kMinimalPerfectHashMagic.size(), ' ');
+  uint64_t values[4];
+  in.read(&magic[0], magic.size());
+  in.read((char*) values, sizeof(values));
+  if (!in || magic != kMinimalPerfectHashMagic || values[0] != kMinimalPerfectHashVersion) {
+    std::cout << "ERROR: READING THE MINIMAL PERFECT HASH FILE \"" << file << "\" FAILED!\n";
+    return false;
+  }
+  num_of_keys_ = values[1];
+  level_offsets_.resize(values[2]+1);
+  in.read((char*) level_offsets_.data(), level_offsets_.size()*sizeof(uint64_t));
+  bits_.resize(level_offsets_.back()/64);
+  in.read((char*) bits_.data(), bits_.size()*sizeof(uint64_t));
+  fallback_.clear();
+  uint64_t pair[2];
+  for (uint64_t i = 0; i < values[3] && in.read((char*) pair, sizeof(pair)); ++i)
+    fallback_[pair[0]] = pair[1];
+  if (!in) {
+    std::cout << "ERROR: THE MINIMAL PERFECT HASH FILE \"" << file << "\" IS INCOMPLETE!\n";
+    num_of_keys_ = 0;
+    return false;
+  }
+  SetRanks();
+  return true;
+}
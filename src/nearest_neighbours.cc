@@ -0,0 +1,233 @@
+// nearest_neighbours.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Exact nearest neighbour search: all stored word vectors are scanned (split
+// into one chunk per thread) and every chunk keeps a bounded heap of the best
+// rows per query. The rows are processed in tiles, so that a tile stays in the
+// cache while it is compared with all queries of a batch.
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+namespace {
+
+const size_t kRowsPerTile = 64;
+const size_t kNumOfQueriesPerScan = 256; // the number of queries of a batch file that are answered by the same scan
+const std::string kOutOfVocabulary = "OOV";
+
+typedef std::pair<double, unsigned> Candidate; // a row and its key (the higher the key, the nearer the row)
+
+void AddCandidate(std::vector<Candidate>& heap, const size_t k, const Candidate& candidate) {
+// Adds "candidate" to "heap" (a min-heap of at most "k" candidates) if it is
+// better than the worst candidate so far.
+  if (heap.size() < k) {
+    heap.push_back(candidate);
+    std::push_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+  } else if (candidate.first > heap.front().first) {
+    std::pop_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+    heap.back() = candidate;
+    std::push_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+  }
+}
+
+bool IsBetterCandidate(const Candidate& candidate_0, const Candidate& candidate_1) {
+  return (candidate_0.first > candidate_1.first || (candidate_0.first == candidate_1.first && candidate_0.second < candidate_1.second));
+}
+
+} // namespace
+
+std::vector<Neighbour> HashTableOnMemory::Nearest(const std::string& word, const int k, const Metric metric, ThreadPool& thread_pool) {
+// Returns the "k" nearest neighbours of the word vector of "word" (excluding
+// "word" itself), the nearest one first; if "word" couldn't be found, an empty
+// std::vector will be returned.
+  std::vector<Query> queries(1);
+  std::string name;
+  std::vector<std::vector<Neighbour>> results;
+  if (!GetQuery(word, queries[0], name))
+    return std::vector<Neighbour>();
+  ScanNearestRows(queries, k, metric, thread_pool, results);
+  return results[0];
+}
+
+std::vector<Neighbour> HashTableOnMemory::Nearest(const std::vector<double>& query_vector, const int k, const Metric metric, ThreadPool& thread_pool) {
+// Returns the "k" nearest neighbours of "query_vector" (which has to have
+// "vector_size_" dimensions), the nearest one first.
+  std::vector<Query> queries(1);
+  queries[0].vector = query_vector;
+  queries[0].vector.resize(vector_size_, 0);
+  queries[0].norm = CalculateEuclideanNorm(queries[0].vector.data(), vector_size_);
+  queries[0].excluded_row = -1;
+  std::vector<std::vector<Neighbour>> results;
+  ScanNearestRows(queries, k, metric, thread_pool, results);
+  return results[0];
+}
+
+void HashTableOnMemory::FindNearestNeighbours(std::istream& queries, std::ostream& out, const int k, const Metric metric, ThreadPool& thread_pool, HnswIndex* hnsw_index) {
+// Finds the "k" nearest neighbours of every query given as a line of
+// "queries" (either a word or the "vector_size_" values of a vector) and
+// writes one tab-separated line per query to "out": the query (the word or
+// "vector" followed by the number of the line) followed by the neighbours and
+// their scores ("kOutOfVocabulary" if the word couldn't be found). Several
+// queries are answered by the same scan - or in parallel by "hnsw_index" if
+// an approximate search is wanted.
+  if (!HashTableIsValid())
+    return;
+  std::vector<Query> block_of_queries;
+  std::vector<std::string> names;
+  std::vector<int> query_of_line; // the query of every line of the block (-1 if the word couldn't be found)
+  std::vector<std::vector<Neighbour>> results;
+  std::string line, name;
+  Query query;
+  unsigned long long line_num = 0;
+  char score[32];
+  bool end_of_queries = false;
+  while (!end_of_queries) {
+    block_of_queries.clear();
+    names.clear();
+    query_of_line.clear();
+    while (block_of_queries.size() < kNumOfQueriesPerScan) {
+      if (!std::getline(queries, line)) {
+        end_of_queries = true;
+        break;
+      }
+      line_num++;
+      if (line.find_first_not_of(" \t\r") == std::string::npos)
+        continue;
+      const bool found = GetQuery(line, query, name);
+      names.push_back((name == "")? "vector"+std::to_string(line_num) : name);
+      query_of_line.push_back(found? (int) block_of_queries.size() : -1);
+      if (found)
+        block_of_queries.push_back(query);
+    }
+    if (hnsw_index != NULL) {
+      results.assign(block_of_queries.size(), std::vector<Neighbour>());
+      thread_pool.ParallelFor(block_of_queries.size(), [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i)
+          results[i] = hnsw_index->Search(block_of_queries[i], k);
+      });
+    } else
+      ScanNearestRows(block_of_queries, k, metric, thread_pool, results);
+    for (unsigned i = 0; i < names.size(); ++i) {
+      out << names[i];
+      if (query_of_line[i] < 0)
+        out << '\t' << kOutOfVocabulary;
+      else {
+        for (auto& neighbour : results[query_of_line[i]]) {
+          snprintf(score, sizeof(score), "\t%.9g", neighbour.score);
+          out << '\t' << neighbour.word << score;
+        }
+      }
+      out << '\n';
+    }
+  }
+  out.flush();
+}
+
+bool HashTableOnMemory::GetQuery(const std::string& line, Query& query, std::string& name) {
+// Turns "line" into a "query": if "line" consists of "vector_size_" numbers,
+// they are the query vector (and "name" will be empty); otherwise the first
+// token of "line" is the query word (and "name"). Returns "false" if the word
+// couldn't be found.
+  std::stringstream stream(line);
+  std::vector<std::string> tokens;
+  std::string token;
+  while (stream >> token)
+    tokens.push_back(token);
+  if (tokens.empty())
+    return false;
+  query.vector.resize(vector_size_);
+  if ((int) tokens.size() == vector_size_) {
+    bool all_numbers = true;
+    char* end_of_number;
+    for (int i = 0; i < vector_size_ && all_numbers; ++i) {
+      query.vector[i] = strtod(tokens[i].c_str(), &end_of_number);
+      all_numbers = (*end_of_number == '\0');
+    }
+    if (all_numbers) {
+      name = "";
+      query.norm = CalculateEuclideanNorm(query.vector.data(), vector_size_);
+      query.excluded_row = -1;
+      return true;
+    }
+  }
+  name = tokens[0];
+  query.excluded_row = GetRow(name);
+  if (query.excluded_row < 0)
+    return false;
+  GetVectorOfRow(query.excluded_row, query.vector.data());
+  query.norm = norms_[query.excluded_row];
+  if (options_.normalize) { // the query vector is always the original (i.e. not normalized) word vector
+    for (auto& element : query.vector)
+      element *= query.norm;
+  }
+  return true;
+}
+
+void HashTableOnMemory::ScanNearestRows(const std::vector<Query>& queries, const int k, const Metric metric, ThreadPool& thread_pool, std::vector<std::vector<Neighbour>>& results) {
+// Finds the "k" nearest neighbours of every query of "queries" by comparing
+// them with all stored word vectors and writes them to "results" (the nearest
+// one first). The rows are ranked by a key that needs only the dot product
+// and the norm of the row: dot/|row| for the cosine similarity (the norm of
+// the query is the same for all rows) and 2*dot-|row|^2 for the Euclidean
+// distance (which is |query|^2 minus the squared distance).
+  const int num_of_chunks = thread_pool.GetNumOfThreads();
+  std::vector<std::vector<std::vector<Candidate>>> heaps(num_of_chunks, std::vector<std::vector<Candidate>>(queries.size()));
+  results.assign(queries.size(), std::vector<Neighbour>());
+  if (queries.empty() || k < 1)
+    return;
+  ParseAllRows();
+  StatisticsTimer timer(Statistics::kKernelTime, Statistics::kScanOperation);
+  if (kStatistics.IsEnabled())
+    kStatistics.Add(Statistics::kKernelCalls, (uint64_t) GetNumOfRows()*queries.size());
+  thread_pool.ParallelFor(GetNumOfRows(), [&](size_t begin, size_t end, int chunk) {
+    std::vector<std::vector<Candidate>>& heaps_of_chunk = heaps[chunk];
+    double dot_product, key;
+    for (size_t tile = begin; tile < end; tile += kRowsPerTile) {
+      const size_t end_of_tile = std::min(end, tile+kRowsPerTile);
+      for (unsigned i = 0; i < queries.size(); ++i) {
+        for (size_t row = tile; row < end_of_tile; ++row) {
+          if ((int) row == queries[i].excluded_row)
+            continue;
+          dot_product = GetDotProductWithRow(queries[i].vector.data(), row);
+          if (metric == kCosineSimilarity) {
+            if (norms_[row] == 0) // the cosine similarity of a zero vector is undefined
+              continue;
+            key = dot_product/norms_[row];
+          } else
+            key = 2*dot_product-norms_[row]*norms_[row];
+          AddCandidate(heaps_of_chunk[i], k, Candidate(key, row));
+        }
+      }
+    }
+  }, num_of_chunks);
+  std::vector<Candidate> candidates;
+  for (unsigned i = 0; i < queries.size(); ++i) {
+    if (metric == kCosineSimilarity && queries[i].norm == 0)
+      continue;
+    candidates.clear();
+    for (auto& heaps_of_chunk : heaps)
+      candidates.insert(candidates.end(), heaps_of_chunk[i].begin(), heaps_of_chunk[i].end());
+    std::sort(candidates.begin(), candidates.end(), IsBetterCandidate);
+    candidates.resize(std::min(candidates.size(), (size_t) k));
+    for (auto& candidate : candidates) {
+      const double score = (metric == kCosineSimilarity)? candidate.first/queries[i].norm : std::sqrt(std::max(0., queries[i].norm*queries[i].norm-candidate.first));
+      results[i].push_back(Neighbour{GetWordOfRow(candidate.second), score});
+    }
+  }
+}
@@ -0,0 +1,599 @@
+// product_quantization.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Product quantization (Jégou, Douze & Schmid, 2011): the dimensions of the
+// word vectors are split into subspaces, a codebook of centroids is trained
+// for every subspace by k-means on a sample of the word vectors, and every
+// word vector is stored as the numbers of its nearest centroids. A query is
+// compared with all centroids once (asymmetric distance tables), so that the
+// approximate similarity of the query and an encoded word vector is the sum
+// of one table value per subspace.
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+namespace {
+
+// The table file starts with "kPqMagic" and "kPqVersion", followed by the
+// values checked by "PqTable::Load()", the centroids, the norms and the codes
+// of the word vectors, the offsets of the words and the words themselves (all
+// numbers in the byte order of the machine that wrote the file).
+const std::string kPqMagic = "WVEWHTPQ";
+const unsigned kPqVersion = 1;
+const int kNumOfKMeansIterations = 16;
+const size_t kLinesPerBlock = 1 << 16; // the number of lines of the word vector file encoded (in parallel) at once
+const std::string kOutOfVocabulary = "OOV";
+
+typedef std::pair<double, size_t> Candidate; // a row and its key (the higher the key, the nearer the row)
+
+bool IsBetterCandidate(const Candidate& candidate_0, const Candidate& candidate_1) {
+  return (candidate_0.first > candidate_1.first || (candidate_0.first == candidate_1.first && candidate_0.second < candidate_1.second));
+}
+
+size_t GetEndOfWord(const std::string& line) {
+// Returns the position of the first whitespace of "line" (i.e. the length of
+// its word).
+  return std::min(line.find(' '), line.size());
+}
+
+unsigned CountValues(const std::string& line) {
+// Returns the number of values following the word of "line".
+  unsigned num_of_values = 0;
+  for (size_t i = GetEndOfWord(line); i < line.size(); ++i) {
+    if (line[i] != ' ' && line[i] != '\t' && (line[i-1] == ' ' || line[i-1] == '\t'))
+      num_of_values++;
+  }
+  return num_of_values;
+}
+
+void ParseValues(const std::string& line, double* vector, const unsigned size) {
+// Parses the "size" values following the word of "line" into "vector"
+// (missing values are 0).
+  const char* position = line.data()+GetEndOfWord(line);
+  const char* end_of_line = line.data()+line.size();
+  for (unsigned i = 0; i < size; ++i) {
+    while (position < end_of_line && (*position == ' ' || *position == '\t'))
+      position++;
+    vector[i] = 0;
+    const std::from_chars_result result = std::from_chars(position, end_of_line, vector[i]);
+    if (result.ec == std::errc())
+      position = result.ptr;
+    else if (position < end_of_line) { // e.g. a leading '+', which "std::from_chars()" does not accept
+      char* end_of_value;
+      vector[i] = strtod(position, &end_of_value);
+      position = std::max(std::min((const char*) end_of_value, end_of_line), position+1);
+    }
+  }
+}
+
+bool ReadLine(WordVectorFileReader& word_vector_file_reader, std::string& line) {
+// Reads the next line of a word vector file that contains a word (without a
+// trailing '\r') and returns "false" at the end of the file.
+  while (word_vector_file_reader.ReadLine(line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (!line.empty() && line[0] != ' ')
+      return true;
+  }
+  return false;
+}
+
+} // namespace
+
+PqTable::PqTable(const PqParameters& parameters)
+    : parameters_(parameters),
+      vector_size_(0),
+      num_of_subspaces_(0),
+      num_of_centroids_(0),
+      num_of_vectors_(0),
+      size_of_word_vector_file_(-1),
+      slot_mask_(0),
+      reranking_table_(NULL),
+      shortlist_size_(0) {}
+
+PqTable::~PqTable() {}
+
+bool PqTable::IsPqFile(const std::string& file) {
+// Returns "true" if "file" starts with "kPqMagic".
+  std::ifstream file_stream(file, std::ios_base::binary);
+  std::string magic(kPqMagic.size(), ' ');
+  file_stream.read(&magic[0], magic.size());
+  return (file_stream && magic == kPqMagic);
+}
+
+void PqTable::SetSubspaces(const int num_of_subspaces, const int num_of_centroids) {
+// Splits the "vector_size_" dimensions as evenly as possible into
+// "num_of_subspaces" subspaces (a quarter of "vector_size_" if it is 0).
+  num_of_subspaces_ = (num_of_subspaces > 0)? std::min((unsigned) num_of_subspaces, vector_size_) : std::max(1u, (vector_size_+3)/4);
+  num_of_centroids_ = std::max(1, std::min(num_of_centroids, 256));
+  subspace_offsets_.resize(num_of_subspaces_+1);
+  for (unsigned subspace = 0; subspace <= num_of_subspaces_; ++subspace)
+    subspace_offsets_[subspace] = (unsigned long long) vector_size_*subspace/num_of_subspaces_;
+}
+
+bool PqTable::Build(const std::string& word_vector_file, ThreadPool& thread_pool) {
+// Builds the table from "word_vector_file" in two passes: the first one draws
+// a uniform sample of "parameters_.sample_size" word vectors (reservoir
+// sampling) the codebooks are trained on, the second one encodes all word
+// vectors in blocks of lines on all threads of "thread_pool" (the first
+// occurrence of a word is kept). Returns "false" if the file couldn't be read
+// (completely).
+  WordVectorFileReader word_vector_file_reader(word_vector_file);
+  if (!word_vector_file_reader.IsOpen()) {
+    std::cout << "ERROR: OPENING \"" << word_vector_file << "\" FAILED!\n";
+    return false;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  std::cout << "\tBuilding product-quantized table using " << thread_pool.GetNumOfThreads() << " threads..." << std::endl;
+  const size_t sample_size = std::max(1, parameters_.sample_size);
+  std::vector<std::string> sample_lines;
+  std::mt19937_64 generator(100);
+  size_t num_of_lines = 0;
+  std::string line;
+  vector_size_ = 0;
+  while (ReadLine(word_vector_file_reader, line)) {
+    if (num_of_lines++ == 0)
+      vector_size_ = CountValues(line);
+    if (sample_lines.size() < sample_size)
+      sample_lines.push_back(line);
+    else {
+      const size_t replaced_line = std::uniform_int_distribution<size_t>(0, num_of_lines-1)(generator);
+      if (replaced_line < sample_size)
+        sample_lines[replaced_line].swap(line);
+    }
+  }
+  if (word_vector_file_reader.IsCorrupt())
+    return false;
+  if (vector_size_ == 0) {
+    std::cout << "ERROR: \"" << word_vector_file << "\" CONTAINS NO WORD VECTORS - BUILDING THE PRODUCT-QUANTIZED TABLE FAILED!\n";
+    return false;
+  }
+  SetSubspaces(parameters_.num_of_subspaces, parameters_.num_of_centroids);
+  std::cout << "\tTraining " << num_of_subspaces_ << " codebooks of " << num_of_centroids_ << " centroids on " << sample_lines.size() << " word vectors..." << std::endl;
+  std::vector<double> sample(sample_lines.size()*vector_size_);
+  thread_pool.ParallelFor(sample_lines.size(), [&](size_t begin, size_t end, int) {
+    for (size_t i = begin; i < end; ++i)
+      ParseValues(sample_lines[i], &sample[i*vector_size_], vector_size_);
+  });
+  centroids_.assign((size_t) num_of_centroids_*vector_size_, 0);
+  thread_pool.ParallelFor(num_of_subspaces_, [&](size_t begin, size_t end, int) {
+    for (size_t subspace = begin; subspace < end; ++subspace)
+      TrainCodebook(subspace, sample, sample_lines.size());
+  }, num_of_subspaces_);
+  std::vector<std::string>().swap(sample_lines);
+  std::vector<double>().swap(sample);
+  std::cout << "\tEncoding the word vectors..." << std::endl;
+  word_vector_file_reader.Rewind();
+  ResizeSlots(num_of_lines);
+  codes_.clear();
+  codes_.reserve(num_of_lines*num_of_subspaces_);
+  norms_.clear();
+  norms_.reserve(num_of_lines);
+  words_.clear();
+  word_offsets_.assign(1, 0);
+  std::vector<std::string> block(kLinesPerBlock);
+  std::vector<uint8_t> block_codes(kLinesPerBlock*num_of_subspaces_);
+  std::vector<float> block_norms(kLinesPerBlock);
+  while (true) {
+    size_t num_of_lines_in_block = 0;
+    while (num_of_lines_in_block < kLinesPerBlock && ReadLine(word_vector_file_reader, block[num_of_lines_in_block]))
+      num_of_lines_in_block++;
+    if (num_of_lines_in_block == 0)
+      break;
+    thread_pool.ParallelFor(num_of_lines_in_block, [&](size_t begin, size_t end, int) {
+      std::vector<double> vector(vector_size_);
+      for (size_t i = begin; i < end; ++i) {
+        ParseValues(block[i], vector.data(), vector_size_);
+        block_norms[i] = sqrt(kSimilarityKernels.dot_product_f64(vector.data(), vector.data(), vector_size_));
+        Encode(vector.data(), &block_codes[i*num_of_subspaces_]);
+      }
+    });
+    for (size_t i = 0; i < num_of_lines_in_block; ++i) {
+      if (!AddWord(block[i].data(), GetEndOfWord(block[i])))
+        continue;
+      codes_.insert(codes_.end(), &block_codes[i*num_of_subspaces_], &block_codes[(i+1)*num_of_subspaces_]);
+      norms_.push_back(block_norms[i]);
+    }
+  }
+  if (word_vector_file_reader.IsCorrupt())
+    return false; // "PqTableIsValid()" stays "false"
+  num_of_vectors_ = norms_.size();
+  size_of_word_vector_file_ = HashTable::GetFileSize(word_vector_file);
+  std::cout << "\t---Done: " << num_of_vectors_ << " word vectors encoded in " << num_of_subspaces_ << " bytes each (" << std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count() << " s).\n";
+  if (kStatistics.IsEnabled())
+    ReportMemory();
+  return true;
+}
+
+void PqTable::TrainCodebook(const unsigned subspace, const std::vector<double>& sample, const size_t sample_size) {
+// Trains the centroids of "subspace" by k-means (Lloyd's algorithm) on the
+// "sample_size" word vectors of "sample". The centroids start as distinct
+// random word vectors of the sample; a centroid losing all its word vectors
+// is moved to a random word vector.
+  const unsigned offset = subspace_offsets_[subspace], size = GetSizeOfSubspace(subspace);
+  float* centroids = &centroids_[(size_t) num_of_centroids_*offset];
+  std::mt19937 generator(100+subspace);
+  std::vector<size_t> order(sample_size);
+  for (size_t i = 0; i < sample_size; ++i)
+    order[i] = i;
+  std::shuffle(order.begin(), order.end(), generator);
+  for (unsigned centroid = 0; centroid < num_of_centroids_; ++centroid) {
+    const double* vector = &sample[order[centroid%sample_size]*vector_size_+offset];
+    std::copy(vector, vector+size, &centroids[centroid*size]);
+  }
+  std::vector<unsigned> assignments(sample_size, num_of_centroids_);
+  std::vector<double> sums((size_t) num_of_centroids_*size);
+  std::vector<size_t> counts(num_of_centroids_);
+  for (int iteration = 0; iteration < kNumOfKMeansIterations; ++iteration) {
+    bool changed = false;
+    std::fill(sums.begin(), sums.end(), 0);
+    std::fill(counts.begin(), counts.end(), 0);
+    for (size_t i = 0; i < sample_size; ++i) {
+      const double* vector = &sample[i*vector_size_+offset];
+      unsigned nearest_centroid = 0;
+      double smallest_distance = std::numeric_limits<double>::max();
+      for (unsigned centroid = 0; centroid < num_of_centroids_; ++centroid) {
+        double distance = 0;
+        for (unsigned j = 0; j < size; ++j) {
+          const double difference = vector[j]-centroids[centroid*size+j];
+          distance += difference*difference;
+        }
+        if (distance < smallest_distance) {
+          smallest_distance = distance;
+          nearest_centroid = centroid;
+        }
+      }
+      changed |= (assignments[i] != nearest_centroid);
+      assignments[i] = nearest_centroid;
+      counts[nearest_centroid]++;
+      for (unsigned j = 0; j < size; ++j)
+        sums[nearest_centroid*size+j] += vector[j];
+    }
+    if (!changed)
+      break;
+    for (unsigned centroid = 0; centroid < num_of_centroids_; ++centroid) {
+      if (counts[centroid] == 0) {
+        const double* vector = &sample[std::uniform_int_distribution<size_t>(0, sample_size-1)(generator)*vector_size_+offset];
+        std::copy(vector, vector+size, &centroids[centroid*size]);
+        continue;
+      }
+      for (unsigned j = 0; j < size; ++j)
+        centroids[centroid*size+j] = sums[centroid*size+j]/counts[centroid];
+    }
+  }
+}
+
+void PqTable::Encode(const double* vector, uint8_t* code) {
+// Writes the nearest centroid of every subspace of "vector" to "code".
+  for (unsigned subspace = 0; subspace < num_of_subspaces_; ++subspace) {
+    const unsigned size = GetSizeOfSubspace(subspace);
+    const double* subvector = vector+subspace_offsets_[subspace];
+    unsigned nearest_centroid = 0;
+    double smallest_distance = std::numeric_limits<double>::max();
+    for (unsigned centroid = 0; centroid < num_of_centroids_; ++centroid) {
+      const float* values = GetCentroid(subspace, centroid);
+      double distance = 0;
+      for (unsigned j = 0; j < size; ++j) {
+        const double difference = subvector[j]-values[j];
+        distance += difference*difference;
+      }
+      if (distance < smallest_distance) {
+        smallest_distance = distance;
+        nearest_centroid = centroid;
+      }
+    }
+    code[subspace] = nearest_centroid;
+  }
+}
+
+void PqTable::Decode(const unsigned row, double* vector) {
+// Writes the approximation of the word vector of "row" (i.e. its centroids)
+// to "vector".
+  const uint8_t* code = &codes_[(size_t) row*num_of_subspaces_];
+  for (unsigned subspace = 0; subspace < num_of_subspaces_; ++subspace) {
+    const float* values = GetCentroid(subspace, code[subspace]);
+    std::copy(values, values+GetSizeOfSubspace(subspace), vector+subspace_offsets_[subspace]);
+  }
+}
+
+void PqTable::ResizeSlots(const size_t num_of_words) {
+// Creates (at least) twice as many empty slots as there are "num_of_words".
+  size_t num_of_slots = 2;
+  while (num_of_slots < 2*num_of_words)
+    num_of_slots *= 2;
+  slots_.assign(num_of_slots, kEmptySlot);
+  slot_mask_ = num_of_slots-1;
+}
+
+bool PqTable::AddWord(const char* word, const size_t length) {
+// Adds "word" as a new row and returns "true" - or "false" if "word" has
+// already been added.
+  size_t slot = GetMurmurHash64(word, length)&slot_mask_;
+  for (; slots_[slot] != kEmptySlot; slot = (slot+1)&slot_mask_) {
+    const unsigned row = slots_[slot];
+    if (word_offsets_[row+1]-word_offsets_[row] == length && words_.compare(word_offsets_[row], length, word, length) == 0)
+      return false;
+  }
+  slots_[slot] = word_offsets_.size()-1;
+  words_.append(word, length);
+  word_offsets_.push_back(words_.size());
+  return true;
+}
+
+int PqTable::GetRow(const std::string& word) {
+// Returns the row of "word" or -1 if it couldn't be found.
+  for (size_t slot = GetMurmurHash64(word.data(), word.length())&slot_mask_; slots_[slot] != kEmptySlot; slot = (slot+1)&slot_mask_) {
+    const unsigned row = slots_[slot];
+    if (word_offsets_[row+1]-word_offsets_[row] == word.length() && words_.compare(word_offsets_[row], word.length(), word) == 0)
+      return row;
+  }
+  return -1;
+}
+
+bool PqTable::Save(const std::string& pq_file) {
+// Saves the table to "pq_file" and returns "true" if that was successful.
+  std::ofstream out(pq_file, std::ios_base::trunc|std::ios_base::binary);
+  const unsigned long long values[] = {kPqVersion, num_of_vectors_, vector_size_, num_of_subspaces_, num_of_centroids_, (unsigned long long) size_of_word_vector_file_, words_.size()};
+  out.write(kPqMagic.data(), kPqMagic.size());
+  out.write((const char*) values, sizeof(values));
+  out.write((const char*) centroids_.data(), centroids_.size()*sizeof(float));
+  out.write((const char*) norms_.data(), norms_.size()*sizeof(float));
+  out.write((const char*) codes_.data(), codes_.size());
+  out.write((const char*) word_offsets_.data(), word_offsets_.size()*sizeof(size_t));
+  out.write(words_.data(), words_.size());
+  if (!out) {
+    std::cout << "WARNING: SAVING THE PRODUCT-QUANTIZED TABLE TO \"" << pq_file << "\" FAILED!\n";
+    return false;
+  }
+  std::cout << "\tProduct-quantized table saved (\"" << pq_file << "\", " << out.tellp()/(1024.0*1024.0) << " MB).\n";
+  return true;
+}
+
+bool PqTable::Load(const std::string& pq_file, const std::string& word_vector_file) {
+// Loads the table from "pq_file" and returns "true" if that was successful.
+// If "word_vector_file" is given, the table has to be built from a word vector
+// file of the same size and with the same subspaces and centroids as given by
+// "parameters_"; otherwise it will be rebuilt.
+  std::ifstream in(pq_file, std::ios_base::binary);
+  if (!in.is_open())
+    return false;
+  std::string magic(kPqMagic.size(), ' ');
+  unsigned long long values[7];
+  in.read(&magic[0], magic.size());
+  in.read((char*) values, sizeof(values));
+  if (!in || magic != kPqMagic || values[0] != kPqVersion) {
+    std::cout << "\t\"" << pq_file << "\" is no product-quantized table file of this version.\n";
+    return false;
+  }
+  vector_size_ = values[2];
+  SetSubspaces(values[3], values[4]);
+  if (word_vector_file != "" && ((long long) values[5] != HashTable::GetFileSize(word_vector_file) || (unsigned long long) parameters_.num_of_centroids != values[4] || (parameters_.num_of_subspaces > 0 && (unsigned long long) parameters_.num_of_subspaces != values[3]))) {
+    std::cout << "\tThe product-quantized table file \"" << pq_file << "\" does not fit the word vectors or the parameters and will be rebuilt.\n";
+    return false;
+  }
+  num_of_vectors_ = values[1];
+  size_of_word_vector_file_ = values[5];
+  centroids_.resize((size_t) num_of_centroids_*vector_size_);
+  norms_.resize(num_of_vectors_);
+  codes_.resize(num_of_vectors_*num_of_subspaces_);
+  word_offsets_.resize(num_of_vectors_+1);
+  words_.resize(values[6]);
+  in.read((char*) centroids_.data(), centroids_.size()*sizeof(float));
+  in.read((char*) norms_.data(), norms_.size()*sizeof(float));
+  in.read((char*) codes_.data(), codes_.size());
+  in.read((char*) word_offsets_.data(), word_offsets_.size()*sizeof(size_t));
+  in.read(&words_[0], words_.size());
+  if (!in || word_offsets_.back() != words_.size()) {
+    std::cout << "\tThe product-quantized table file \"" << pq_file << "\" is incomplete.\n";
+    num_of_vectors_ = 0;
+    return false;
+  }
+  ResizeSlots(num_of_vectors_);
+  for (size_t row = 0; row < num_of_vectors_; ++row) {
+    size_t slot = GetMurmurHash64(&words_[word_offsets_[row]], word_offsets_[row+1]-word_offsets_[row])&slot_mask_;
+    while (slots_[slot] != kEmptySlot)
+      slot = (slot+1)&slot_mask_;
+    slots_[slot] = row;
+  }
+  std::cout << "\tProduct-quantized table loaded (\"" << pq_file << "\": " << num_of_vectors_ << " word vectors of size " << vector_size_ << " encoded in " << num_of_subspaces_ << " bytes each).\n";
+  if (kStatistics.IsEnabled())
+    ReportMemory();
+  return true;
+}
+
+void PqTable::ReportMemory() {
+// Reports the memory needed by the codes (and codebooks), the words and the
+// slots (and the norms) to "kStatistics".
+  kStatistics.SetMemory("pq_table.vectors", codes_.capacity()+centroids_.capacity()*sizeof(float));
+  kStatistics.SetMemory("pq_table.keys", words_.capacity()+word_offsets_.capacity()*sizeof(size_t));
+  kStatistics.SetMemory("pq_table.table", slots_.capacity()*sizeof(unsigned)+norms_.capacity()*sizeof(float));
+}
+
+void PqTable::SetReranking(HashTableReader* reranking_table, const int shortlist_size) {
+// Re-ranks the "shortlist_size" (at least "k"; 10*"k" if it is 0) best
+// candidates of every search with the exact vectors of "reranking_table"
+// (which has to contain word vectors of the same size).
+  if (reranking_table != NULL && reranking_table->GetVectorSize() != (int) vector_size_) {
+    std::cout << "WARNING: THE HASH TABLE FILE CONTAINS VECTORS OF ANOTHER SIZE - the candidates will not be re-ranked.\n";
+    reranking_table = NULL;
+  }
+  reranking_table_ = reranking_table;
+  shortlist_size_ = shortlist_size;
+}
+
+std::vector<Neighbour> PqTable::Nearest(const std::string& word, const int k, const Metric metric, ThreadPool& thread_pool) {
+// Returns the "k" nearest neighbours of the word vector of "word" (excluding
+// "word" itself), the nearest one first; if "word" couldn't be found, an empty
+// std::vector will be returned.
+  std::vector<double> query_vector;
+  int excluded_row;
+  std::string name;
+  if (!GetQueryVector(word, query_vector, excluded_row, name))
+    return std::vector<Neighbour>();
+  return Search(query_vector, excluded_row, k, metric, thread_pool);
+}
+
+void PqTable::FindNearestNeighbours(std::istream& queries, std::ostream& out, const int k, const Metric metric, ThreadPool& thread_pool) {
+// Finds the "k" nearest neighbours of every query given as a line of
+// "queries" and writes one tab-separated line per query to "out" (see
+// "HashTableOnMemory::FindNearestNeighbours()").
+  std::vector<double> query_vector;
+  int excluded_row;
+  std::string line, name;
+  unsigned long long line_num = 0;
+  char score[32];
+  while (std::getline(queries, line)) {
+    line_num++;
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+      continue;
+    const bool found = GetQueryVector(line, query_vector, excluded_row, name);
+    out << ((name == "")? "vector"+std::to_string(line_num) : name);
+    if (!found)
+      out << '\t' << kOutOfVocabulary;
+    else {
+      for (auto& neighbour : Search(query_vector, excluded_row, k, metric, thread_pool)) {
+        snprintf(score, sizeof(score), "\t%.9g", neighbour.score);
+        out << '\t' << neighbour.word << score;
+      }
+    }
+    out << '\n';
+  }
+  out.flush();
+}
+
+bool PqTable::GetQueryVector(const std::string& line, std::vector<double>& query_vector, int& excluded_row, std::string& name) {
+// Turns "line" into a query (see "HashTableOnMemory::GetQuery()"). The vector
+// of a query word is read from the hash table file used for re-ranking if
+// there is one and approximated by its centroids otherwise. Returns "false" if
+// the word couldn't be found.
+  std::stringstream stream(line);
+  std::vector<std::string> tokens;
+  std::string token;
+  while (stream >> token)
+    tokens.push_back(token);
+  name = "";
+  if (tokens.empty())
+    return false;
+  query_vector.assign(vector_size_, 0);
+  if (tokens.size() == vector_size_) {
+    bool all_numbers = true;
+    char* end_of_number;
+    for (unsigned i = 0; i < vector_size_ && all_numbers; ++i) {
+      query_vector[i] = strtod(tokens[i].c_str(), &end_of_number);
+      all_numbers = (*end_of_number == '\0');
+    }
+    if (all_numbers) {
+      excluded_row = -1;
+      return true;
+    }
+  }
+  name = tokens[0];
+  excluded_row = GetRow(name);
+  if (excluded_row < 0)
+    return false;
+  if (reranking_table_ != NULL) {
+    std::unordered_map<std::string, std::pair<std::vector<double>, double>> vectors;
+    reranking_table_->FetchVectors(std::vector<std::string>(1, name), vectors);
+    if (vectors.count(name)) {
+      query_vector = vectors[name].first;
+      return true;
+    }
+  }
+  Decode(excluded_row, query_vector.data());
+  return true;
+}
+
+std::vector<Neighbour> PqTable::Search(const std::vector<double>& query_vector, const int excluded_row, const int k, const Metric metric, ThreadPool& thread_pool) {
+// Scans the codes of all word vectors (split into one chunk per thread) with
+// asymmetric distance tables: the dot products (cosine similarity) or squared
+// Euclidean distances of every subspace of "query_vector" and all centroids of
+// the subspace. If "reranking_table_" is set, the best candidates are
+// re-ranked with their exact vectors.
+  std::vector<Neighbour> neighbours;
+  const double query_norm = sqrt(kSimilarityKernels.dot_product_f64(query_vector.data(), query_vector.data(), vector_size_));
+  if (k < 1 || (metric == kCosineSimilarity && query_norm == 0))
+    return neighbours;
+  std::vector<float> distance_table((size_t) num_of_subspaces_*num_of_centroids_);
+  for (unsigned subspace = 0; subspace < num_of_subspaces_; ++subspace) {
+    const double* subvector = &query_vector[subspace_offsets_[subspace]];
+    for (unsigned centroid = 0; centroid < num_of_centroids_; ++centroid) {
+      const float* values = GetCentroid(subspace, centroid);
+      double value = 0;
+      for (unsigned j = 0; j < GetSizeOfSubspace(subspace); ++j)
+        value += (metric == kCosineSimilarity)? subvector[j]*values[j] : (subvector[j]-values[j])*(subvector[j]-values[j]);
+      distance_table[(size_t) subspace*num_of_centroids_+centroid] = value;
+    }
+  }
+  const size_t num_of_candidates = (reranking_table_ != NULL)? std::max(k, (shortlist_size_ > 0)? shortlist_size_ : 10*k) : k;
+  std::vector<std::vector<Candidate>> heaps(thread_pool.GetNumOfThreads());
+  thread_pool.ParallelFor(num_of_vectors_, [&](size_t begin, size_t end, int chunk) {
+    std::vector<Candidate>& heap = heaps[chunk];
+    for (size_t row = begin; row < end; ++row) {
+      if ((int) row == excluded_row || (metric == kCosineSimilarity && norms_[row] == 0))
+        continue;
+      const uint8_t* code = &codes_[row*num_of_subspaces_];
+      const float* table = distance_table.data();
+      float sum = 0;
+      for (unsigned subspace = 0; subspace < num_of_subspaces_; ++subspace, table += num_of_centroids_)
+        sum += table[code[subspace]];
+      const Candidate candidate((metric == kCosineSimilarity)? sum/(norms_[row]*query_norm) : -sum, row);
+      if (heap.size() < num_of_candidates) {
+        heap.push_back(candidate);
+        std::push_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+      } else if (candidate.first > heap.front().first) {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+        heap.back() = candidate;
+        std::push_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+      }
+    }
+  }, heaps.size());
+  std::vector<Candidate> candidates;
+  for (auto& heap : heaps)
+    candidates.insert(candidates.end(), heap.begin(), heap.end());
+  std::sort(candidates.begin(), candidates.end(), IsBetterCandidate);
+  candidates.resize(std::min(candidates.size(), num_of_candidates));
+  if (reranking_table_ != NULL) {
+    std::vector<std::string> words;
+    for (auto& candidate : candidates)
+      words.push_back(GetWordOfRow(candidate.second));
+    std::unordered_map<std::string, std::pair<std::vector<double>, double>> vectors;
+    reranking_table_->FetchVectors(words, vectors);
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      auto vector = vectors.find(words[i]);
+      if (vector == vectors.end())
+        continue; // keeps the approximate key of a word missing in the hash table file
+      const double dot_product = kSimilarityKernels.dot_product_f64(query_vector.data(), vector->second.first.data(), vector_size_);
+      if (metric == kCosineSimilarity)
+        candidates[i].first = (vector->second.second > 0)? dot_product/(vector->second.second*query_norm) : -1;
+      else
+        candidates[i].first = -(query_norm*query_norm-2*dot_product+vector->second.second*vector->second.second);
+    }
+    std::sort(candidates.begin(), candidates.end(), IsBetterCandidate);
+    candidates.resize(std::min(candidates.size(), (size_t) k));
+  }
+  for (auto& candidate : candidates)
+    neighbours.push_back(Neighbour{GetWordOfRow(candidate.second), (metric == kCosineSimilarity)? candidate.first : sqrt(std::max(0.0, -candidate.first))});
+  return neighbours;
+}
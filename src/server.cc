@@ -0,0 +1,451 @@
+// server.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Server mode: the word vectors are loaded once and requests of many clients
+// are answered concurrently. Requests and responses are frames consisting of
+// the length of the payload (4 bytes, big-endian) followed by the payload, a
+// text:
+//  "similarity WORD_0 WORD_1" -> "OK\t<cosine similarity>\t<Euclidean distance>"
+//  "lookup WORD"              -> "OK\t<norm>\t<values separated by spaces>"
+//  "nearest WORD [K] [cosine|euclidean]" -> "OK\t<word>\t<score>..." (K nearest neighbours)
+//  "batch\n<word pairs>"      -> "OK\n<one line per pair as written by --batch>"
+//  "stats"                    -> "OK\n<latency percentiles per request type>"
+//  "shutdown"                 -> "OK" (the server stops after answering it)
+// Unknown words are answered with "OOV" and invalid requests with "ERROR\t...".
+// The connections are watched by a single thread ("Serve()"), which hands a
+// connection with a pending request to a worker and gets it back after the
+// request was answered, so that the requests of a connection are answered in
+// order while the requests of different connections are answered in parallel.
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+namespace {
+
+const std::string kOutOfVocabulary = "OOV";
+const uint32_t kMaxFrameSize = 1u << 30; // larger frames are rejected
+const int kDefaultNumOfNeighbours = 10;
+const char* const kNamesOfRequestTypes[] = {"similarity", "lookup", "nearest", "batch", "other"};
+
+enum ServerMessageType {
+  kConnectionReady, // the request of the connection was answered
+  kConnectionClosed, // the connection was closed (by the client or because of an error)
+  kStopServer
+};
+
+struct ServerMessage {
+// Message to "QueryServer::Serve()" written to its wake-up pipe (smaller than
+// "PIPE_BUF", so that every message is written at once).
+  int type;
+  int connection;
+};
+
+int wake_up_fd = -1; // the write end of the wake-up pipe of the running server (used by "StopServer()")
+
+void StopServer(int) {
+// Asks the running server to stop (also the handler of SIGINT and SIGTERM).
+  const ServerMessage message = {kStopServer, -1};
+  if (wake_up_fd >= 0 && write(wake_up_fd, &message, sizeof(message)) < 0)
+    return;
+}
+
+bool GetSocketAddress(const std::string& address, sockaddr_storage& socket_address, socklen_t& length) {
+// Converts "address" ("unix:PATH" for a Unix domain socket, "tcp:PORT" or
+// "PORT" for a TCP port of localhost) to "socket_address" and returns "false"
+// if that is not possible.
+  std::memset(&socket_address, 0, sizeof(socket_address));
+  if (address.compare(0, 5, "unix:") == 0) {
+    sockaddr_un* unix_address = (sockaddr_un*) &socket_address;
+    const std::string path = address.substr(5);
+    if (path.empty() || path.size() >= sizeof(unix_address->sun_path))
+      return false;
+    unix_address->sun_family = AF_UNIX;
+    std::memcpy(unix_address->sun_path, path.c_str(), path.size()+1);
+    length = sizeof(sockaddr_un);
+    return true;
+  }
+  const std::string port = (address.compare(0, 4, "tcp:") == 0)? address.substr(4) : address;
+  if (port.empty() || port.size() > 5 || port.find_first_not_of("0123456789") != std::string::npos || std::stoi(port) > 65535)
+    return false;
+  sockaddr_in* tcp_address = (sockaddr_in*) &socket_address;
+  tcp_address->sin_family = AF_INET;
+  tcp_address->sin_port = htons(std::stoi(port));
+  tcp_address->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  length = sizeof(sockaddr_in);
+  return true;
+}
+
+int OpenSocket(const std::string& address, const bool listening) {
+// Returns a socket listening on "address" (if "listening" is "true") or
+// connected to "address" (-1 if that is not possible).
+  sockaddr_storage socket_address;
+  socklen_t length;
+  if (!GetSocketAddress(address, socket_address, length)) {
+    std::cout << "ERROR: \"" << address << "\" IS NOT A VALID ADDRESS (\"unix:PATH\" or \"tcp:PORT\")!\n";
+    return -1;
+  }
+  const int socket_fd = socket(socket_address.ss_family, SOCK_STREAM, 0);
+  if (socket_fd < 0) {
+    std::cout << "ERROR: CREATING A SOCKET FAILED!\n";
+    return -1;
+  }
+  bool successful;
+  if (listening) {
+    const int reuse_address = 1;
+    struct stat file_status;
+    if (socket_address.ss_family == AF_UNIX && stat(((sockaddr_un*) &socket_address)->sun_path, &file_status) == 0 && S_ISSOCK(file_status.st_mode))
+      unlink(((sockaddr_un*) &socket_address)->sun_path); // left over by a server that wasn't stopped properly
+    if (socket_address.ss_family == AF_INET)
+      setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse_address, sizeof(reuse_address));
+    successful = (bind(socket_fd, (sockaddr*) &socket_address, length) == 0 && listen(socket_fd, SOMAXCONN) == 0);
+  } else
+    successful = (connect(socket_fd, (sockaddr*) &socket_address, length) == 0);
+  if (!successful) {
+    std::cout << "ERROR: " << (listening? "LISTENING ON" : "CONNECTING TO") << " \"" << address << "\" FAILED (" << std::strerror(errno) << ")!\n";
+    close(socket_fd);
+    return -1;
+  }
+  return socket_fd;
+}
+
+bool ReadFully(const int fd, char* buffer, size_t length) {
+// Reads exactly "length" bytes and returns "false" if that is not possible
+// (e.g. because the connection was closed).
+  while (length > 0) {
+    const ssize_t num_of_bytes = read(fd, buffer, length);
+    if (num_of_bytes < 0 && errno == EINTR)
+      continue;
+    if (num_of_bytes <= 0)
+      return false;
+    buffer += num_of_bytes;
+    length -= num_of_bytes;
+  }
+  return true;
+}
+
+bool WriteFully(const int fd, const char* buffer, size_t length) {
+// Writes exactly "length" bytes to the socket "fd" and returns "false" if
+// that is not possible.
+  while (length > 0) {
+    const ssize_t num_of_bytes = send(fd, buffer, length, MSG_NOSIGNAL);
+    if (num_of_bytes < 0 && errno == EINTR)
+      continue;
+    if (num_of_bytes <= 0)
+      return false;
+    buffer += num_of_bytes;
+    length -= num_of_bytes;
+  }
+  return true;
+}
+
+bool ReceiveFrame(const int fd, std::string& payload) {
+// Receives a frame and stores its payload in "payload".
+  unsigned char header[4];
+  if (!ReadFully(fd, (char*) header, sizeof(header)))
+    return false;
+  const uint32_t length = (uint32_t) header[0] << 24|(uint32_t) header[1] << 16|(uint32_t) header[2] << 8|header[3];
+  if (length > kMaxFrameSize)
+    return false;
+  payload.resize(length);
+  return ReadFully(fd, &payload[0], length);
+}
+
+bool SendFrame(const int fd, const std::string& payload) {
+// Sends "payload" as a frame.
+  if (payload.size() > kMaxFrameSize)
+    return false;
+  const uint32_t length = payload.size();
+  std::string frame(4, '\0');
+  for (int i = 0; i < 4; ++i)
+    frame[i] = (char) (length >> (24-8*i));
+  frame += payload;
+  return WriteFully(fd, frame.data(), frame.size());
+}
+
+bool ReadRequest(const std::string& line, std::string& request) {
+// Converts a "line" entered by the user to "request": "batch FILE" sends the
+// word pairs of "FILE" (all other lines are sent as they are). Returns
+// "false" if the file couldn't be read.
+  std::stringstream stream(line);
+  std::string command, file;
+  stream >> command >> file;
+  if (command != "batch" || file.empty()) {
+    request = line;
+    return true;
+  }
+  std::ifstream file_stream(file);
+  if (!file_stream.is_open()) {
+    std::cerr << "ERROR: OPENING \"" << file << "\" FAILED!\n";
+    return false;
+  }
+  std::stringstream word_pairs;
+  word_pairs << file_stream.rdbuf();
+  request = "batch\n"+word_pairs.str();
+  return true;
+}
+
+} // namespace
+
+QueryServer::QueryServer(HashTableOnMemory& hash_table, ThreadPool& thread_pool, const int num_of_workers)
+    : hash_table_(hash_table),
+      thread_pool_(thread_pool),
+      workers_(num_of_workers) {
+  wake_up_pipe_[0] = wake_up_pipe_[1] = -1;
+}
+
+QueryServer::~QueryServer() {}
+
+int QueryServer::Serve(const std::string& address) {
+// Listens on "address" ("unix:PATH" or "tcp:PORT") and answers requests until
+// a "shutdown" request, SIGINT or SIGTERM is received. Returns 0 if the server
+// was stopped properly and -1 if it couldn't be started.
+  const int listener = OpenSocket(address, true);
+  if (listener < 0)
+    return -1;
+  if (pipe(wake_up_pipe_) != 0) {
+    std::cout << "ERROR: CREATING THE WAKE-UP PIPE OF THE SERVER FAILED!\n";
+    close(listener);
+    return -1;
+  }
+  wake_up_fd = wake_up_pipe_[1];
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = StopServer;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  std::cout << "\tServing on \"" << address << "\" with " << workers_.GetNumOfThreads() << " workers (send \"shutdown\" or press Ctrl+C to stop)..." << std::endl;
+  std::vector<int> idle_connections, still_idle_connections;
+  std::vector<pollfd> poll_fds;
+  int num_of_busy_connections = 0;
+  bool stop = false;
+  while (!stop || num_of_busy_connections > 0) {
+    poll_fds.assign(1, {wake_up_pipe_[0], POLLIN, 0});
+    if (!stop) {
+      poll_fds.push_back({listener, POLLIN, 0});
+      for (auto connection : idle_connections)
+        poll_fds.push_back({connection, POLLIN, 0});
+    }
+    if (poll(poll_fds.data(), poll_fds.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cout << "ERROR: WAITING FOR REQUESTS FAILED (" << std::strerror(errno) << ")!\n";
+      stop = true;
+      continue;
+    }
+    still_idle_connections.clear();
+    ServerMessage message;
+    if ((poll_fds[0].revents&POLLIN) && ReadFully(wake_up_pipe_[0], (char*) &message, sizeof(message))) {
+      if (message.type == kStopServer)
+        stop = true;
+      else {
+        --num_of_busy_connections;
+        if (message.type == kConnectionReady)
+          still_idle_connections.push_back(message.connection);
+      }
+    }
+    if (poll_fds.size() > 1 && (poll_fds[1].revents&POLLIN)) {
+      const int connection = accept(listener, NULL, NULL);
+      if (connection >= 0)
+        still_idle_connections.push_back(connection);
+    }
+    for (size_t i = 2; i < poll_fds.size(); ++i) {
+      if (poll_fds[i].revents == 0)
+        still_idle_connections.push_back(poll_fds[i].fd);
+      else { // a request or the end of the connection
+        const int connection = poll_fds[i].fd;
+        ++num_of_busy_connections;
+        workers_.Submit([this, connection] { AnswerRequest(connection); });
+      }
+    }
+    if (poll_fds.size() > 1)
+      idle_connections.swap(still_idle_connections);
+    else // the idle connections weren't watched after the stop request
+      idle_connections.insert(idle_connections.end(), still_idle_connections.begin(), still_idle_connections.end());
+  }
+  for (auto connection : idle_connections)
+    close(connection);
+  close(listener);
+  if (address.compare(0, 5, "unix:") == 0)
+    unlink(address.substr(5).c_str());
+  action.sa_handler = SIG_DFL;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  wake_up_fd = -1;
+  close(wake_up_pipe_[0]);
+  close(wake_up_pipe_[1]);
+  std::cout << "\tServer stopped. Latencies of the requests:\n" << GetStatistics();
+  return 0;
+}
+
+void QueryServer::AnswerRequest(const int connection) {
+// Answers the pending request of "connection" (run by a worker) and hands the
+// connection back to "Serve()" (or closes it if it was closed by the client).
+  std::string request;
+  ServerMessage message = {kConnectionClosed, connection};
+  if (ReceiveFrame(connection, request)) {
+    const auto start = std::chrono::steady_clock::now();
+    RequestType type;
+    const std::string response = GetResponse(request, type);
+    latencies_[type].Add(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()-start).count());
+    if (SendFrame(connection, response))
+      message.type = kConnectionReady;
+    if (request == "shutdown")
+      StopServer(0);
+  }
+  if (message.type == kConnectionClosed)
+    close(connection);
+  if (write(wake_up_pipe_[1], &message, sizeof(message)) < 0)
+    std::cout << "ERROR: HANDING A CONNECTION BACK TO THE SERVER FAILED!\n";
+}
+
+std::string QueryServer::GetResponse(const std::string& request, RequestType& type) {
+// Returns the response to "request" and sets "type" to its type. The word
+// vectors are only read, so that no locks are needed.
+  const size_t end_of_first_line = request.find('\n');
+  std::stringstream first_line(request.substr(0, end_of_first_line));
+  std::string command, words[2], argument;
+  first_line >> command;
+  type = kOtherRequest;
+  if (command == "similarity") {
+    type = kSimilarityRequest;
+    if (!(first_line >> words[0] >> words[1]))
+      return "ERROR\tUSAGE: similarity WORD_0 WORD_1";
+    const int rows[2] = {hash_table_.GetRow(words[0]), hash_table_.GetRow(words[1])};
+    if (rows[0] < 0 || rows[1] < 0)
+      return kOutOfVocabulary;
+    double cosine_similarity, euclidean_distance;
+    char similarities[64];
+    hash_table_.GetSimilarityOfRows(rows[0], rows[1], cosine_similarity, euclidean_distance);
+    snprintf(similarities, sizeof(similarities), "OK\t%.9g\t%.9g", cosine_similarity, euclidean_distance);
+    return similarities;
+  }
+  if (command == "lookup") {
+    type = kLookupRequest;
+    if (!(first_line >> words[0]))
+      return "ERROR\tUSAGE: lookup WORD";
+    double norm;
+    const std::vector<double> vector = hash_table_.GetVectorOfWord(words[0], norm);
+    if (vector.empty())
+      return kOutOfVocabulary;
+    char value[32];
+    snprintf(value, sizeof(value), "OK\t%.9g\t", norm);
+    std::string response = value;
+    for (size_t i = 0; i < vector.size(); ++i) {
+      snprintf(value, sizeof(value), (i == 0)? "%.9g" : " %.9g", vector[i]);
+      response += value;
+    }
+    return response;
+  }
+  if (command == "nearest") {
+    type = kNearestRequest;
+    int k = kDefaultNumOfNeighbours;
+    Metric metric = kCosineSimilarity;
+    if (!(first_line >> words[0]))
+      return "ERROR\tUSAGE: nearest WORD [K] [cosine|euclidean]";
+    while (first_line >> argument) {
+      if (argument == "euclidean")
+        metric = kEuclideanDistance;
+      else if (argument == "cosine")
+        metric = kCosineSimilarity;
+      else if (!argument.empty() && argument.size() < 10 && argument.find_first_not_of("0123456789") == std::string::npos && std::stoi(argument) > 0)
+        k = std::stoi(argument);
+      else
+        return "ERROR\tUSAGE: nearest WORD [K] [cosine|euclidean]";
+    }
+    if (hash_table_.GetRow(words[0]) < 0)
+      return kOutOfVocabulary;
+    std::string response = "OK";
+    char score[32];
+    for (auto& neighbour : hash_table_.Nearest(words[0], k, metric, thread_pool_)) {
+      snprintf(score, sizeof(score), "\t%.9g", neighbour.score);
+      response += '\t'+neighbour.word+score;
+    }
+    return response;
+  }
+  if (command == "batch") {
+    type = kBatchRequest;
+    std::stringstream word_pairs((end_of_first_line == std::string::npos)? "" : request.substr(end_of_first_line+1)), results;
+    hash_table_.CompareWordPairs(word_pairs, results, thread_pool_);
+    return "OK\n"+results.str();
+  }
+  if (command == "stats")
+    return "OK\n"+GetStatistics();
+  if (command == "shutdown")
+    return "OK";
+  return "ERROR\tUNKNOWN REQUEST \""+command+"\" (similarity, lookup, nearest, batch, stats or shutdown)";
+}
+
+std::string QueryServer::GetStatistics() {
+// Returns the latency percentiles of every request type (one line per type
+// that was requested).
+  std::string statistics;
+  for (int type = 0; type < kNumOfRequestTypes; ++type) {
+    if (latencies_[type].GetCount() > 0)
+      statistics += std::string("\t")+kNamesOfRequestTypes[type]+'\t'+latencies_[type].GetSummary()+'\n';
+  }
+  return statistics;
+}
+
+int StartClient(const std::string& address, const std::vector<std::string>& request) {
+// Sends requests to the server listening on "address" and writes the
+// responses to the standard output: the words of "request" joined by spaces
+// or - if "request" is empty - every line of the standard input. The
+// round-trip latencies are written to the standard error output if more than
+// one request was sent.
+  const int connection = OpenSocket(address, false);
+  if (connection < 0)
+    return -1;
+  LatencyHistogram latencies;
+  std::string line, payload, response;
+  bool successful = true;
+  for (size_t i = 0; successful; ++i) {
+    if (!request.empty()) {
+      if (i > 0)
+        break;
+      line = request[0];
+      for (size_t j = 1; j < request.size(); ++j)
+        line += ' '+request[j];
+    } else if (!std::getline(std::cin, line))
+      break;
+    if (line.empty() || !ReadRequest(line, payload))
+      continue;
+    const auto start = std::chrono::steady_clock::now();
+    successful = (SendFrame(connection, payload) && ReceiveFrame(connection, response));
+    if (!successful) {
+      std::cerr << "ERROR: THE CONNECTION TO \"" << address << "\" WAS CLOSED!\n";
+      break;
+    }
+    latencies.Add(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()-start).count());
+    std::cout << response;
+    if (response.empty() || response.back() != '\n')
+      std::cout << '\n';
+  }
+  std::cout.flush();
+  close(connection);
+  if (latencies.GetCount() > 1)
+    std::cerr << "Round-trip latencies:\t" << latencies.GetSummary() << '\n';
+  return successful? 0 : -1;
+}
@@ -0,0 +1,519 @@
+// similarity_kernels.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The kernels every similarity calculation of this program is based on (dot
+// product, squared Euclidean distance and Euclidean norm). There is a scalar
+// version of every kernel and - on x86 - an SSE2, an AVX2 and an AVX-512
+// version; the best version the CPU supports is selected at startup (see
+// "SelectSimilarityKernels()"), so that the same binary can be used on every
+// machine. The dot products of quantized vectors (fp16 or int8, see
+// "VectorPrecision") work directly on the quantized values with a wider
+// accumulator; there are scalar and AVX2 versions of them.
+
+#include <cstring>
+#include <math.h>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WVEWHT_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+
+template <typename T>
+T DotProductScalar(const T* vector_0, const T* vector_1, const int size) {
+  T x = 0;
+  for (int i = 0; i < size; ++i)
+    x += vector_0[i]*vector_1[i];
+  return x;
+}
+
+template <typename T>
+T SquaredDistanceScalar(const T* vector_0, const T* vector_1, const int size) {
+  T x = 0, difference;
+  for (int i = 0; i < size; ++i) {
+    difference = vector_0[i]-vector_1[i];
+    x += difference*difference;
+  }
+  return x;
+}
+
+double DotProductScalar(const double* vector_0, const uint16_t* vector_1, const int size) {
+  double x = 0;
+  for (int i = 0; i < size; ++i)
+    x += vector_0[i]*ConvertFromHalf(vector_1[i]);
+  return x;
+}
+
+float DotProductScalar(const uint16_t* vector_0, const uint16_t* vector_1, const int size) {
+  float x = 0;
+  for (int i = 0; i < size; ++i)
+    x += ConvertFromHalf(vector_0[i])*ConvertFromHalf(vector_1[i]);
+  return x;
+}
+
+double DotProductScalar(const double* vector_0, const int8_t* vector_1, const int size) {
+  double x = 0;
+  for (int i = 0; i < size; ++i)
+    x += vector_0[i]*vector_1[i];
+  return x;
+}
+
+int DotProductScalar(const int8_t* vector_0, const int8_t* vector_1, const int size) {
+  int x = 0;
+  for (int i = 0; i < size; ++i)
+    x += vector_0[i]*vector_1[i];
+  return x;
+}
+
+#ifdef WVEWHT_X86_KERNELS
+
+// SSE2 (two doubles or four floats per register; two accumulators hide the
+// latency of the additions).
+
+__attribute__((target("sse2"))) double DotProductSse2(const double* vector_0, const double* vector_1, const int size) {
+  __m128d sum_0 = _mm_setzero_pd(), sum_1 = _mm_setzero_pd();
+  int i = 0;
+  for (; i+4 <= size; i += 4) {
+    sum_0 = _mm_add_pd(sum_0, _mm_mul_pd(_mm_loadu_pd(vector_0+i), _mm_loadu_pd(vector_1+i)));
+    sum_1 = _mm_add_pd(sum_1, _mm_mul_pd(_mm_loadu_pd(vector_0+i+2), _mm_loadu_pd(vector_1+i+2)));
+  }
+  double sums[2];
+  _mm_storeu_pd(sums, _mm_add_pd(sum_0, sum_1));
+  double x = sums[0]+sums[1];
+  for (; i < size; ++i)
+    x += vector_0[i]*vector_1[i];
+  return x;
+}
+
+__attribute__((target("sse2"))) double SquaredDistanceSse2(const double* vector_0, const double* vector_1, const int size) {
+  __m128d sum_0 = _mm_setzero_pd(), sum_1 = _mm_setzero_pd(), difference_0, difference_1;
+  int i = 0;
+  for (; i+4 <= size; i += 4) {
+    difference_0 = _mm_sub_pd(_mm_loadu_pd(vector_0+i), _mm_loadu_pd(vector_1+i));
+    difference_1 = _mm_sub_pd(_mm_loadu_pd(vector_0+i+2), _mm_loadu_pd(vector_1+i+2));
+    sum_0 = _mm_add_pd(sum_0, _mm_mul_pd(difference_0, difference_0));
+    sum_1 = _mm_add_pd(sum_1, _mm_mul_pd(difference_1, difference_1));
+  }
+  double sums[2];
+  _mm_storeu_pd(sums, _mm_add_pd(sum_0, sum_1));
+  double x = sums[0]+sums[1], difference;
+  for (; i < size; ++i) {
+    difference = vector_0[i]-vector_1[i];
+    x += difference*difference;
+  }
+  return x;
+}
+
+__attribute__((target("sse2"))) float DotProductSse2(const float* vector_0, const float* vector_1, const int size) {
+  __m128 sum_0 = _mm_setzero_ps(), sum_1 = _mm_setzero_ps();
+  int i = 0;
+  for (; i+8 <= size; i += 8) {
+    sum_0 = _mm_add_ps(sum_0, _mm_mul_ps(_mm_loadu_ps(vector_0+i), _mm_loadu_ps(vector_1+i)));
+    sum_1 = _mm_add_ps(sum_1, _mm_mul_ps(_mm_loadu_ps(vector_0+i+4), _mm_loadu_ps(vector_1+i+4)));
+  }
+  float sums[4];
+  _mm_storeu_ps(sums, _mm_add_ps(sum_0, sum_1));
+  float x = sums[0]+sums[1]+sums[2]+sums[3];
+  for (; i < size; ++i)
+    x += vector_0[i]*vector_1[i];
+  return x;
+}
+
+__attribute__((target("sse2"))) float SquaredDistanceSse2(const float* vector_0, const float* vector_1, const int size) {
+  __m128 sum_0 = _mm_setzero_ps(), sum_1 = _mm_setzero_ps(), difference_0, difference_1;
+  int i = 0;
+  for (; i+8 <= size; i += 8) {
+    difference_0 = _mm_sub_ps(_mm_loadu_ps(vector_0+i), _mm_loadu_ps(vector_1+i));
+    difference_1 = _mm_sub_ps(_mm_loadu_ps(vector_0+i+4), _mm_loadu_ps(vector_1+i+4));
+    sum_0 = _mm_add_ps(sum_0, _mm_mul_ps(difference_0, difference_0));
+    sum_1 = _mm_add_ps(sum_1, _mm_mul_ps(difference_1, difference_1));
+  }
+  float sums[4];
+  _mm_storeu_ps(sums, _mm_add_ps(sum_0, sum_1));
+  float x = sums[0]+sums[1]+sums[2]+sums[3], difference;
+  for (; i < size; ++i) {
+    difference = vector_0[i]-vector_1[i];
+    x += difference*difference;
+  }
+  return x;
+}
+
+// AVX2 with FMA (four doubles or eight floats per register).
+
+__attribute__((target("avx2,fma"))) double DotProductAvx2(const double* vector_0, const double* vector_1, const int size) {
+  __m256d sum_0 = _mm256_setzero_pd(), sum_1 = _mm256_setzero_pd();
+  int i = 0;
+  for (; i+8 <= size; i += 8) {
+    sum_0 = _mm256_fmadd_pd(_mm256_loadu_pd(vector_0+i), _mm256_loadu_pd(vector_1+i), sum_0);
+    sum_1 = _mm256_fmadd_pd(_mm256_loadu_pd(vector_0+i+4), _mm256_loadu_pd(vector_1+i+4), sum_1);
+  }
+  double sums[4];
+  _mm256_storeu_pd(sums, _mm256_add_pd(sum_0, sum_1));
+  double x = sums[0]+sums[1]+sums[2]+sums[3];
+  for (; i < size; ++i)
+    x += vector_0[i]*vector_1[i];
+  return x;
+}
+
+__attribute__((target("avx2,fma"))) double SquaredDistanceAvx2(const double* vector_0, const double* vector_1, const int size) {
+  __m256d sum_0 = _mm256_setzero_pd(), sum_1 = _mm256_setzero_pd(), difference_0, difference_1;
+  int i = 0;
+  for (; i+8 <= size; i += 8) {
+    difference_0 = _mm256_sub_pd(_mm256_loadu_pd(vector_0+i), _mm256_loadu_pd(vector_1+i));
+    difference_1 = _mm256_sub_pd(_mm256_loadu_pd(vector_0+i+4), _mm256_loadu_pd(vector_1+i+4));
+    sum_0 = _mm256_fmadd_pd(difference_0, difference_0, sum_0);
+    sum_1 = _mm256_fmadd_pd(difference_1, difference_1, sum_1);
+  }
+  double sums[4];
+  _mm256_storeu_pd(sums, _mm256_add_pd(sum_0, sum_1));
+  double x = sums[0]+sums[1]+sums[2]+sums[3], difference;
+  for (; i < size; ++i) {
+    difference = vector_0[i]-vector_1[i];
+    x += difference*difference;
+  }
+  return x;
+}
+
+__attribute__((target("avx2,fma"))) float DotProductAvx2(const float* vector_0, const float* vector_1, const int size) {
+  __m256 sum_0 = _mm256_setzero_ps(), sum_1 = _mm256_setzero_ps();
+  int i = 0;
+  for (; i+16 <= size; i += 16) {
+    sum_0 = _mm256_fmadd_ps(_mm256_loadu_ps(vector_0+i), _mm256_loadu_ps(vector_1+i), sum_0);
+    sum_1 = _mm256_fmadd_ps(_mm256_loadu_ps(vector_0+i+8), _mm256_loadu_ps(vector_1+i+8), sum_1);
+  }
+  float sums[8];
+  _mm256_storeu_ps(sums, _mm256_add_ps(sum_0, sum_1));
+  float x = sums[0]+sums[1]+sums[2]+sums[3]+sums[4]+sums[5]+sums[6]+sums[7];
+  for (; i < size; ++i)
+    x += vector_0[i]*vector_1[i];
+  return x;
+}
+
+__attribute__((target("avx2,fma"))) float SquaredDistanceAvx2(const float* vector_0, const float* vector_1, const int size) {
+  __m256 sum_0 = _mm256_setzero_ps(), sum_1 = _mm256_setzero_ps(), difference_0, difference_1;
+  int i = 0;
+  for (; i+16 <= size; i += 16) {
+    difference_0 = _mm256_sub_ps(_mm256_loadu_ps(vector_0+i), _mm256_loadu_ps(vector_1+i));
+    difference_1 = _mm256_sub_ps(_mm256_loadu_ps(vector_0+i+8), _mm256_loadu_ps(vector_1+i+8));
+    sum_0 = _mm256_fmadd_ps(difference_0, difference_0, sum_0);
+    sum_1 = _mm256_fmadd_ps(difference_1, difference_1, sum_1);
+  }
+  float sums[8];
+  _mm256_storeu_ps(sums, _mm256_add_ps(sum_0, sum_1));
+  float x = sums[0]+sums[1]+sums[2]+sums[3]+sums[4]+sums[5]+sums[6]+sums[7], difference;
+  for (; i < size; ++i) {
+    difference = vector_0[i]-vector_1[i];
+    x += difference*difference;
+  }
+  return x;
+}
+
+// AVX2 with FMA and F16C for quantized vectors (fp16 values are widened to
+// floats, int8 values to 16-bit integers whose products are summed up as
+// 32-bit integers).
+
+__attribute__((target("avx2,fma,f16c"))) double DotProductAvx2(const double* vector_0, const uint16_t* vector_1, const int size) {
+  __m256d sum_0 = _mm256_setzero_pd(), sum_1 = _mm256_setzero_pd();
+  int i = 0;
+  for (; i+8 <= size; i += 8) {
+    const __m256 values = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (vector_1+i)));
+    sum_0 = _mm256_fmadd_pd(_mm256_loadu_pd(vector_0+i), _mm256_cvtps_pd(_mm256_castps256_ps128(values)), sum_0);
+    sum_1 = _mm256_fmadd_pd(_mm256_loadu_pd(vector_0+i+4), _mm256_cvtps_pd(_mm256_extractf128_ps(values, 1)), sum_1);
+  }
+  double sums[4];
+  _mm256_storeu_pd(sums, _mm256_add_pd(sum_0, sum_1));
+  double x = sums[0]+sums[1]+sums[2]+sums[3];
+  for (; i < size; ++i) // "_cvtsh_ss()" instead of "ConvertFromHalf()", which would be compiled without AVX (an AVX-SSE transition per element)
+    x += vector_0[i]*_cvtsh_ss(vector_1[i]);
+  return x;
+}
+
+__attribute__((target("avx2,fma,f16c"))) float DotProductAvx2(const uint16_t* vector_0, const uint16_t* vector_1, const int size) {
+  __m256 sum_0 = _mm256_setzero_ps(), sum_1 = _mm256_setzero_ps();
+  int i = 0;
+  for (; i+16 <= size; i += 16) {
+    sum_0 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (vector_0+i))), _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (vector_1+i))), sum_0);
+    sum_1 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (vector_0+i+8))), _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (vector_1+i+8))), sum_1);
+  }
+  float sums[8];
+  _mm256_storeu_ps(sums, _mm256_add_ps(sum_0, sum_1));
+  float x = sums[0]+sums[1]+sums[2]+sums[3]+sums[4]+sums[5]+sums[6]+sums[7];
+  for (; i < size; ++i) // see above
+    x += _cvtsh_ss(vector_0[i])*_cvtsh_ss(vector_1[i]);
+  return x;
+}
+
+__attribute__((target("avx2,fma"))) double DotProductAvx2(const double* vector_0, const int8_t* vector_1, const int size) {
+  __m256d sum_0 = _mm256_setzero_pd(), sum_1 = _mm256_setzero_pd();
+  int i = 0;
+  for (; i+8 <= size; i += 8) {
+    const __m256i values = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*) (vector_1+i)));
+    sum_0 = _mm256_fmadd_pd(_mm256_loadu_pd(vector_0+i), _mm256_cvtepi32_pd(_mm256_castsi256_si128(values)), sum_0);
+    sum_1 = _mm256_fmadd_pd(_mm256_loadu_pd(vector_0+i+4), _mm256_cvtepi32_pd(_mm256_extracti128_si256(values, 1)), sum_1);
+  }
+  double sums[4];
+  _mm256_storeu_pd(sums, _mm256_add_pd(sum_0, sum_1));
+  double x = sums[0]+sums[1]+sums[2]+sums[3];
+  for (; i < size; ++i)
+    x += vector_0[i]*vector_1[i];
+  return x;
+}
+
+__attribute__((target("avx2"))) int DotProductAvx2(const int8_t* vector_0, const int8_t* vector_1, const int size) {
+  __m256i sum = _mm256_setzero_si256();
+  int i = 0;
+  for (; i+16 <= size; i += 16) {
+    const __m256i values_0 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (vector_0+i)));
+    const __m256i values_1 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (vector_1+i)));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(values_0, values_1));
+  }
+  int sums[8];
+  _mm256_storeu_si256((__m256i*) sums, sum);
+  int x = sums[0]+sums[1]+sums[2]+sums[3]+sums[4]+sums[5]+sums[6]+sums[7];
+  for (; i < size; ++i)
+    x += vector_0[i]*vector_1[i];
+  return x;
+}
+
+// AVX-512 (eight doubles or 16 floats per register; the remainder is handled
+// with masked loads).
+
+__attribute__((target("avx512f"))) double SumOfElements(const __m512d sum) {
+  double sums[8];
+  _mm512_storeu_pd(sums, sum);
+  return ((sums[0]+sums[1])+(sums[2]+sums[3]))+((sums[4]+sums[5])+(sums[6]+sums[7]));
+}
+
+__attribute__((target("avx512f"))) float SumOfElements(const __m512 sum) {
+  float sums[16];
+  _mm512_storeu_ps(sums, sum);
+  float x = 0;
+  for (int i = 0; i < 16; ++i)
+    x += sums[i];
+  return x;
+}
+
+__attribute__((target("avx512f"))) double DotProductAvx512(const double* vector_0, const double* vector_1, const int size) {
+  __m512d sum_0 = _mm512_setzero_pd(), sum_1 = _mm512_setzero_pd();
+  int i = 0;
+  for (; i+16 <= size; i += 16) {
+    sum_0 = _mm512_fmadd_pd(_mm512_loadu_pd(vector_0+i), _mm512_loadu_pd(vector_1+i), sum_0);
+    sum_1 = _mm512_fmadd_pd(_mm512_loadu_pd(vector_0+i+8), _mm512_loadu_pd(vector_1+i+8), sum_1);
+  }
+  for (; i < size; i += 8) {
+    const __mmask8 mask = (size-i >= 8)? 0xFF : (__mmask8) ((1u << (size-i))-1);
+    sum_0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, vector_0+i), _mm512_maskz_loadu_pd(mask, vector_1+i), sum_0);
+  }
+  return SumOfElements(_mm512_add_pd(sum_0, sum_1));
+}
+
+__attribute__((target("avx512f"))) double SquaredDistanceAvx512(const double* vector_0, const double* vector_1, const int size) {
+  __m512d sum_0 = _mm512_setzero_pd(), sum_1 = _mm512_setzero_pd(), difference_0, difference_1;
+  int i = 0;
+  for (; i+16 <= size; i += 16) {
+    difference_0 = _mm512_sub_pd(_mm512_loadu_pd(vector_0+i), _mm512_loadu_pd(vector_1+i));
+    difference_1 = _mm512_sub_pd(_mm512_loadu_pd(vector_0+i+8), _mm512_loadu_pd(vector_1+i+8));
+    sum_0 = _mm512_fmadd_pd(difference_0, difference_0, sum_0);
+    sum_1 = _mm512_fmadd_pd(difference_1, difference_1, sum_1);
+  }
+  for (; i < size; i += 8) {
+    const __mmask8 mask = (size-i >= 8)? 0xFF : (__mmask8) ((1u << (size-i))-1);
+    difference_0 = _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, vector_0+i), _mm512_maskz_loadu_pd(mask, vector_1+i));
+    sum_0 = _mm512_fmadd_pd(difference_0, difference_0, sum_0);
+  }
+  return SumOfElements(_mm512_add_pd(sum_0, sum_1));
+}
+
+__attribute__((target("avx512f"))) float DotProductAvx512(const float* vector_0, const float* vector_1, const int size) {
+  __m512 sum_0 = _mm512_setzero_ps(), sum_1 = _mm512_setzero_ps();
+  int i = 0;
+  for (; i+32 <= size; i += 32) {
+    sum_0 = _mm512_fmadd_ps(_mm512_loadu_ps(vector_0+i), _mm512_loadu_ps(vector_1+i), sum_0);
+    sum_1 = _mm512_fmadd_ps(_mm512_loadu_ps(vector_0+i+16), _mm512_loadu_ps(vector_1+i+16), sum_1);
+  }
+  for (; i < size; i += 16) {
+    const __mmask16 mask = (size-i >= 16)? 0xFFFF : (__mmask16) ((1u << (size-i))-1);
+    sum_0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, vector_0+i), _mm512_maskz_loadu_ps(mask, vector_1+i), sum_0);
+  }
+  return SumOfElements(_mm512_add_ps(sum_0, sum_1));
+}
+
+__attribute__((target("avx512f"))) float SquaredDistanceAvx512(const float* vector_0, const float* vector_1, const int size) {
+  __m512 sum_0 = _mm512_setzero_ps(), sum_1 = _mm512_setzero_ps(), difference_0, difference_1;
+  int i = 0;
+  for (; i+32 <= size; i += 32) {
+    difference_0 = _mm512_sub_ps(_mm512_loadu_ps(vector_0+i), _mm512_loadu_ps(vector_1+i));
+    difference_1 = _mm512_sub_ps(_mm512_loadu_ps(vector_0+i+16), _mm512_loadu_ps(vector_1+i+16));
+    sum_0 = _mm512_fmadd_ps(difference_0, difference_0, sum_0);
+    sum_1 = _mm512_fmadd_ps(difference_1, difference_1, sum_1);
+  }
+  for (; i < size; i += 16) {
+    const __mmask16 mask = (size-i >= 16)? 0xFFFF : (__mmask16) ((1u << (size-i))-1);
+    difference_0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, vector_0+i), _mm512_maskz_loadu_ps(mask, vector_1+i));
+    sum_0 = _mm512_fmadd_ps(difference_0, difference_0, sum_0);
+  }
+  return SumOfElements(_mm512_add_ps(sum_0, sum_1));
+}
+
+#endif // WVEWHT_X86_KERNELS
+
+void SetQuantizedKernels(const bool use_avx2, SimilarityKernels& kernels) {
+// Sets the kernels for quantized vectors (the AVX2 versions are used by the
+// AVX2 and the AVX-512 kernels, every CPU supporting AVX-512 supports F16C).
+#ifdef WVEWHT_X86_KERNELS
+  if (use_avx2 && __builtin_cpu_supports("f16c")) {
+    kernels.dot_product_f64_f16 = DotProductAvx2;
+    kernels.dot_product_f16 = DotProductAvx2;
+    kernels.dot_product_f64_i8 = DotProductAvx2;
+    kernels.dot_product_i8 = DotProductAvx2;
+    return;
+  }
+#endif
+  kernels.dot_product_f64_f16 = DotProductScalar;
+  kernels.dot_product_f16 = DotProductScalar;
+  kernels.dot_product_f64_i8 = DotProductScalar;
+  kernels.dot_product_i8 = DotProductScalar;
+}
+
+SimilarityKernels GetScalarKernels() {
+  SimilarityKernels kernels;
+  kernels.name = "scalar";
+  kernels.dot_product_f64 = DotProductScalar<double>;
+  kernels.squared_distance_f64 = SquaredDistanceScalar<double>;
+  kernels.dot_product_f32 = DotProductScalar<float>;
+  kernels.squared_distance_f32 = SquaredDistanceScalar<float>;
+  SetQuantizedKernels(false, kernels);
+  return kernels;
+}
+
+bool SetKernels(const std::string& name, SimilarityKernels& kernels) {
+// Sets "kernels" to the kernels called "name" and returns "true" if the CPU
+// supports them and "false" otherwise.
+  if (name == "scalar") {
+    kernels = GetScalarKernels();
+    return true;
+  }
+#ifdef WVEWHT_X86_KERNELS
+  __builtin_cpu_init();
+  if (name == "avx512" && __builtin_cpu_supports("avx512f")) {
+    kernels.name = "avx512";
+    kernels.dot_product_f64 = DotProductAvx512;
+    kernels.squared_distance_f64 = SquaredDistanceAvx512;
+    kernels.dot_product_f32 = DotProductAvx512;
+    kernels.squared_distance_f32 = SquaredDistanceAvx512;
+    SetQuantizedKernels(true, kernels);
+    return true;
+  }
+  if (name == "avx2" && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    kernels.name = "avx2";
+    kernels.dot_product_f64 = DotProductAvx2;
+    kernels.squared_distance_f64 = SquaredDistanceAvx2;
+    kernels.dot_product_f32 = DotProductAvx2;
+    kernels.squared_distance_f32 = SquaredDistanceAvx2;
+    SetQuantizedKernels(true, kernels);
+    return true;
+  }
+  if (name == "sse2" && __builtin_cpu_supports("sse2")) {
+    kernels.name = "sse2";
+    kernels.dot_product_f64 = DotProductSse2;
+    kernels.squared_distance_f64 = SquaredDistanceSse2;
+    kernels.dot_product_f32 = DotProductSse2;
+    kernels.squared_distance_f32 = SquaredDistanceSse2;
+    SetQuantizedKernels(false, kernels);
+    return true;
+  }
+#endif
+  return false;
+}
+
+SimilarityKernels SelectBestKernels() {
+// Returns the best kernels the CPU supports.
+  SimilarityKernels kernels = GetScalarKernels();
+  for (const std::string name : {"avx512", "avx2", "sse2"}) {
+    if (SetKernels(name, kernels))
+      break;
+  }
+  return kernels;
+}
+
+} // namespace
+
+SimilarityKernels kSimilarityKernels = SelectBestKernels(); // selected at startup
+
+bool SelectSimilarityKernels(const std::string& name) {
+// Replaces the kernels selected at startup by the kernels called "name"
+// ("scalar", "sse2", "avx2", "avx512" or "auto" for the best ones the CPU
+// supports). Returns "false" (keeping the current kernels) if the CPU does not
+// support the kernels in question.
+  if (name == "auto") {
+    kSimilarityKernels = SelectBestKernels();
+    return true;
+  }
+  return SetKernels(name, kSimilarityKernels);
+}
+
+uint16_t ConvertToHalf(const float value) {
+// Converts "value" to a half-precision (IEEE 754 binary16) number, rounding to
+// the nearest representable value (ties to even).
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = (bits >> 16)&0x8000;
+  const uint32_t absolute_value = bits&0x7FFFFFFF;
+  if (absolute_value >= 0x7F800000) // infinity or NaN
+    return sign|0x7C00|((absolute_value > 0x7F800000)? 0x200 : 0);
+  if (absolute_value >= 0x477FF000) // too large (rounded to infinity)
+    return sign|0x7C00;
+  if (absolute_value <= 0x33000000) // too small (rounded to zero)
+    return sign;
+  uint32_t half, remainder, halfway;
+  if (absolute_value < 0x38800000) { // subnormal half-precision number
+    const uint32_t mantissa = (absolute_value&0x7FFFFF)|0x800000;
+    const int shift = 126-(absolute_value >> 23);
+    half = mantissa >> shift;
+    remainder = mantissa&((1u << shift)-1);
+    halfway = 1u << (shift-1);
+  } else { // normal half-precision number (the exponent is rebiased from 127 to 15)
+    half = (absolute_value >> 13)-(112 << 10);
+    remainder = absolute_value&0x1FFF;
+    halfway = 0x1000;
+  }
+  if (remainder > halfway || (remainder == halfway && (half&1)))
+    half++; // a carry into the exponent is correct as well
+  return sign|half;
+}
+
+float ConvertFromHalf(const uint16_t half) {
+// Converts the half-precision number "half" to a float (exactly).
+  const uint32_t sign = (uint32_t) (half&0x8000) << 16;
+  uint32_t exponent = (half >> 10)&0x1F, mantissa = half&0x3FF, bits;
+  if (exponent == 0x1F) // infinity or NaN
+    bits = sign|0x7F800000|(mantissa << 13);
+  else if (exponent != 0)
+    bits = sign|((exponent+112) << 23)|(mantissa << 13);
+  else if (mantissa == 0)
+    bits = sign;
+  else { // subnormal half-precision number (normalized as a float)
+    for (exponent = 113; !(mantissa&0x400); exponent--)
+      mantissa <<= 1;
+    bits = sign|(exponent << 23)|((mantissa&0x3FF) << 13);
+  }
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
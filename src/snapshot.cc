@@ -0,0 +1,244 @@
+// snapshot.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Binary snapshots of "HashTableOnMemory": the slots, the words and the
+// matrix of the word vectors are written exactly as they are held on memory,
+// so that a snapshot can be mapped read-only instead of parsing the word
+// vector file again. The mapped pages are shared by all processes mapping the
+// same snapshot (and stay in the page cache between runs).
+
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+namespace {
+
+// The snapshot file starts with "kSnapshotMagic" and the values described by
+// "SnapshotValue", followed by the slots, the word offsets, the words, the
+// norms, the scales (only if the word vectors are stored as int8 values) and
+// the word vectors. Every section starts at a multiple of
+// "kSnapshotAlignment" bytes.
+const std::string kSnapshotMagic = "WVEWHTSN";
+const unsigned long long kSnapshotVersion = 1;
+const unsigned long long kByteOrderMark = 0x0102030405060708ULL; // differs if the snapshot was written on a machine of another byte order
+const size_t kSnapshotAlignment = 64;
+
+enum SnapshotValue {
+  kVersion,
+  kByteOrder,
+  kVectorSize,
+  kPrecision,
+  kNormalize,
+  kNumOfRows,
+  kNumOfSlots,
+  kSizeOfWords,
+  kSizeOfWordVectorFile,
+  kModificationTimeOfWordVectorFile,
+  kSizeOfSnapshot,
+  kChecksumOfIndex, // the checksum of the slots, the word offsets and the words
+  kChecksumOfData, // the checksum of the norms, the scales and the word vectors
+  kChecksumOfHeader, // the checksum of all values above
+  kNumOfSnapshotValues
+};
+
+struct SnapshotSections {
+// The offsets of the sections of a snapshot (derived from its values).
+  size_t slots, word_offsets, words, norms, scales, vectors, end;
+};
+
+size_t Align(const size_t offset) {
+  return (offset+kSnapshotAlignment-1)/kSnapshotAlignment*kSnapshotAlignment;
+}
+
+SnapshotSections GetSnapshotSections(const unsigned long long* values) {
+// Returns the offsets of the sections of a snapshot with "values".
+  const size_t size_of_element = (values[kPrecision] == kInt8)? sizeof(int8_t) : ((values[kPrecision] == kFloat16)? sizeof(uint16_t) : sizeof(double));
+  SnapshotSections sections;
+  sections.slots = Align(kSnapshotMagic.size()+kNumOfSnapshotValues*sizeof(unsigned long long));
+  sections.word_offsets = Align(sections.slots+values[kNumOfSlots]*8);
+  sections.words = Align(sections.word_offsets+(values[kNumOfRows]+1)*sizeof(size_t));
+  sections.norms = Align(sections.words+values[kSizeOfWords]);
+  sections.scales = Align(sections.norms+values[kNumOfRows]*sizeof(double));
+  sections.vectors = Align(sections.scales+((values[kPrecision] == kInt8)? values[kNumOfRows]*sizeof(float) : 0));
+  sections.end = sections.vectors+values[kNumOfRows]*values[kVectorSize]*size_of_element;
+  return sections;
+}
+
+uint64_t GetChecksum(const char* begin, const char* end, const uint64_t checksum) {
+// Combines "checksum" with the MurmurHash64A of the bytes from "begin" to
+// "end".
+  return (checksum*1099511628211ULL)^GetMurmurHash64(begin, end-begin);
+}
+
+long long GetModificationTime(const std::string& file) {
+// Returns the time of the last modification of "file" in nanoseconds (-1 if
+// it does not exist).
+  struct stat file_status;
+  if (stat(file.c_str(), &file_status) != 0)
+    return -1;
+  return file_status.st_mtim.tv_sec*1000000000LL+file_status.st_mtim.tv_nsec;
+}
+
+bool ReadSnapshotValues(const std::string& snapshot_file, unsigned long long* values) {
+// Reads the values of "snapshot_file" and returns "false" if it is no
+// snapshot file.
+  std::ifstream in(snapshot_file, std::ios_base::binary);
+  std::string magic(kSnapshotMagic.size(), ' ');
+  in.read(&magic[0], magic.size());
+  in.read((char*) values, kNumOfSnapshotValues*sizeof(unsigned long long));
+  return (in && magic == kSnapshotMagic);
+}
+
+} // namespace
+
+bool HashTableOnMemory::IsSnapshotFile(const std::string& file) {
+// Returns "true" if "file" starts with "kSnapshotMagic".
+  std::ifstream file_stream(file, std::ios_base::binary);
+  std::string magic(kSnapshotMagic.size(), ' ');
+  file_stream.read(&magic[0], magic.size());
+  return (file_stream && magic == kSnapshotMagic);
+}
+
+int HashTableOnMemory::GetVectorSizeOfSnapshot(const std::string& snapshot_file) {
+// Returns the size of the word vectors of "snapshot_file" (-1 if it is no
+// snapshot file of this version).
+  unsigned long long values[kNumOfSnapshotValues];
+  if (!ReadSnapshotValues(snapshot_file, values) || values[kVersion] != kSnapshotVersion || values[kByteOrder] != kByteOrderMark)
+    return -1;
+  return values[kVectorSize];
+}
+
+bool HashTableOnMemory::SaveSnapshot(const std::string& snapshot_file) {
+// Saves the slots, the words and the word vectors to "snapshot_file" and
+// returns "true" if that was successful. The snapshot is written to a
+// temporary file first, which replaces "snapshot_file" afterwards, so that
+// other processes never map an incomplete snapshot.
+  static_assert(sizeof(Slot) == 8 && sizeof(size_t) == 8, "The snapshot format needs slots and word offsets of 8 bytes.");
+  const size_t size_of_element = (options_.precision == kInt8)? sizeof(int8_t) : ((options_.precision == kFloat16)? sizeof(uint16_t) : sizeof(double));
+  ParseAllRows();
+  const unsigned num_of_rows = GetNumOfRows();
+  unsigned long long values[kNumOfSnapshotValues] = {};
+  values[kVersion] = kSnapshotVersion;
+  values[kByteOrder] = kByteOrderMark;
+  values[kVectorSize] = vector_size_;
+  values[kPrecision] = options_.precision;
+  values[kNormalize] = options_.normalize;
+  values[kNumOfRows] = num_of_rows;
+  values[kNumOfSlots] = (size_t) slot_mask_+1;
+  values[kSizeOfWords] = word_offsets_[num_of_rows];
+  values[kSizeOfWordVectorFile] = GetFileSize(input_file_);
+  values[kModificationTimeOfWordVectorFile] = GetModificationTime(input_file_);
+  const SnapshotSections sections = GetSnapshotSections(values);
+  values[kSizeOfSnapshot] = sections.end;
+  const char* vectors = (options_.precision == kInt8)? (const char*) int8_vectors_ : ((options_.precision == kFloat16)? (const char*) half_vectors_ : (const char*) vectors_);
+  values[kChecksumOfIndex] = GetChecksum(words_, words_+values[kSizeOfWords], GetChecksum((const char*) word_offsets_, (const char*) (word_offsets_+num_of_rows+1), GetChecksum((const char*) slots_, (const char*) (slots_+values[kNumOfSlots]), 0)));
+  values[kChecksumOfData] = GetChecksum(vectors, vectors+(size_t) num_of_rows*vector_size_*size_of_element, GetChecksum((const char*) scales_, (const char*) (scales_+((options_.precision == kInt8)? num_of_rows : 0)), GetChecksum((const char*) norms_, (const char*) (norms_+num_of_rows), 0)));
+  values[kChecksumOfHeader] = GetChecksum((const char*) values, (const char*) &values[kChecksumOfHeader], 0);
+  const std::string temporary_file = snapshot_file+".tmp";
+  std::ofstream out(temporary_file, std::ios_base::trunc|std::ios_base::binary);
+  auto write_section = [&](const size_t offset, const void* data, const size_t size) {
+    out.seekp(offset);
+    out.write((const char*) data, size);
+  };
+  write_section(0, kSnapshotMagic.data(), kSnapshotMagic.size());
+  write_section(kSnapshotMagic.size(), values, sizeof(values));
+  write_section(sections.slots, slots_, values[kNumOfSlots]*sizeof(Slot));
+  write_section(sections.word_offsets, word_offsets_, (num_of_rows+1)*sizeof(size_t));
+  write_section(sections.words, words_, values[kSizeOfWords]);
+  write_section(sections.norms, norms_, num_of_rows*sizeof(double));
+  if (options_.precision == kInt8)
+    write_section(sections.scales, scales_, num_of_rows*sizeof(float));
+  write_section(sections.vectors, vectors, (size_t) num_of_rows*vector_size_*size_of_element);
+  out.close();
+  if (!out || std::rename(temporary_file.c_str(), snapshot_file.c_str()) != 0) {
+    std::cout << "WARNING: SAVING THE SNAPSHOT TO \"" << snapshot_file << "\" FAILED!\n";
+    std::remove(temporary_file.c_str());
+    return false;
+  }
+  std::cout << "\tSnapshot saved (\"" << snapshot_file << "\", " << sections.end/(1024.0*1024.0) << " MB).\n";
+  return true;
+}
+
+bool HashTableOnMemory::MapSnapshot(const std::string& snapshot_file, const bool check_word_vector_file) {
+// Maps "snapshot_file" read-only and lets the pointers to the word vectors,
+// norms, words and slots point into it. Returns "false" if it is no valid
+// snapshot file or if "check_word_vector_file" is set and it was not created
+// from "input_file_" (in its current state) with the precision and
+// normalization given by "options_". The checksums of the header and of the
+// slots and words are always verified; the checksum of the word vectors only
+// if "options_.verify_snapshot" is set (it needs all pages of the matrix to be
+// read).
+  unsigned long long values[kNumOfSnapshotValues];
+  if (!ReadSnapshotValues(snapshot_file, values))
+    return false;
+  if (values[kVersion] != kSnapshotVersion || values[kByteOrder] != kByteOrderMark || values[kChecksumOfHeader] != GetChecksum((const char*) values, (const char*) &values[kChecksumOfHeader], 0) || GetFileSize(snapshot_file) != (long long) values[kSizeOfSnapshot] || GetSnapshotSections(values).end != values[kSizeOfSnapshot]) {
+    std::cout << "\t\"" << snapshot_file << "\" is no snapshot file of this version or is incomplete.\n";
+    return false;
+  }
+  if (check_word_vector_file && (values[kVectorSize] != (unsigned long long) vector_size_ || values[kPrecision] != (unsigned long long) options_.precision || values[kNormalize] != (unsigned long long) options_.normalize || (long long) values[kSizeOfWordVectorFile] != GetFileSize(input_file_) || (long long) values[kModificationTimeOfWordVectorFile] != GetModificationTime(input_file_))) {
+    std::cout << "\tThe snapshot file \"" << snapshot_file << "\" does not fit the word vectors or the parameters and will be rebuilt.\n";
+    return false;
+  }
+  const int file_descriptor = open(snapshot_file.c_str(), O_RDONLY);
+  if (file_descriptor < 0) {
+    std::cout << "ERROR: OPENING \"" << snapshot_file << "\" FAILED!\n";
+    return false;
+  }
+  void* snapshot = mmap(NULL, values[kSizeOfSnapshot], PROT_READ, MAP_SHARED, file_descriptor, 0);
+  close(file_descriptor); // the mapping stays valid
+  if (snapshot == MAP_FAILED) {
+    std::cout << "ERROR: MAPPING \"" << snapshot_file << "\" FAILED!\n";
+    return false;
+  }
+  const SnapshotSections sections = GetSnapshotSections(values);
+  const char* begin = (const char*) snapshot;
+  const unsigned num_of_rows = values[kNumOfRows];
+  const size_t size_of_vectors = sections.end-sections.vectors;
+  uint64_t checksum = GetChecksum(begin+sections.words, begin+sections.words+values[kSizeOfWords], GetChecksum(begin+sections.word_offsets, begin+sections.word_offsets+(num_of_rows+1)*sizeof(size_t), GetChecksum(begin+sections.slots, begin+sections.slots+values[kNumOfSlots]*sizeof(Slot), 0)));
+  bool is_valid = (checksum == values[kChecksumOfIndex]);
+  if (is_valid && options_.verify_snapshot) {
+    checksum = GetChecksum(begin+sections.vectors, begin+sections.end, GetChecksum(begin+sections.scales, begin+sections.scales+((values[kPrecision] == kInt8)? num_of_rows*sizeof(float) : 0), GetChecksum(begin+sections.norms, begin+sections.norms+num_of_rows*sizeof(double), 0)));
+    is_valid = (checksum == values[kChecksumOfData]);
+  }
+  if (!is_valid) {
+    std::cout << "\tThe snapshot file \"" << snapshot_file << "\" is corrupted.\n";
+    munmap(snapshot, values[kSizeOfSnapshot]);
+    return false;
+  }
+  snapshot_ = snapshot;
+  size_of_snapshot_ = values[kSizeOfSnapshot];
+  options_.precision = (VectorPrecision) values[kPrecision];
+  options_.normalize = values[kNormalize];
+  slots_ = (const Slot*) (begin+sections.slots);
+  word_offsets_ = (const size_t*) (begin+sections.word_offsets);
+  words_ = begin+sections.words;
+  norms_ = (const double*) (begin+sections.norms);
+  scales_ = (const float*) (begin+sections.scales);
+  vectors_ = (const double*) (begin+sections.vectors);
+  half_vectors_ = (const uint16_t*) (begin+sections.vectors);
+  int8_vectors_ = (const int8_t*) (begin+sections.vectors);
+  num_of_rows_ = num_of_rows;
+  hash_table_size_ = values[kNumOfSlots];
+  slot_mask_ = hash_table_size_-1;
+  vector_num_ = num_of_rows;
+  std::cout << "\tSnapshot mapped (\"" << snapshot_file << "\": " << num_of_rows << " word vectors, " << size_of_vectors/(1024.0*1024.0) << " MB of vectors).\n";
+  return true;
+}
@@ -0,0 +1,181 @@
+// statistics.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+#include <cstdio>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+namespace {
+
+const char* const kNamesOfCounters[] = {"bytes_read", "lines_parsed", "lookups", "lookup_misses", "probes", "chain_lookups", "chain_steps", "reader_queries", "reader_bytes_scanned", "kernel_calls", "bytes_written"};
+const char* const kNamesOfTimers[] = {"load", "lookup", "parse", "store", "kernel", "reader", "writer"};
+const char* const kNamesOfOperations[] = {"lookup", "similarity", "scan", "reader"};
+const double kPercentiles[] = {50.0, 90.0, 99.0, 99.9};
+const char* const kNamesOfPercentiles[] = {"p50", "p90", "p99", "p99.9"};
+
+} // namespace
+
+Statistics kStatistics;
+
+LatencyHistogram::LatencyHistogram()
+    : count_(0) {
+  for (auto& count : counts_)
+    count.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Add(const double microseconds) {
+// Counts a latency of "microseconds".
+  const int bucket = (microseconds < 1.0)? 0 : std::min<int>(std::log2(microseconds)*kBucketsPerPowerOfTwo, kNumOfBuckets-1);
+  counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::GetPercentile(const double percentile) {
+// Returns the latency (in microseconds) "percentile" percent of the counted
+// latencies are smaller than or equal to: the upper bound of its bucket.
+  const uint64_t count = GetCount();
+  if (count == 0)
+    return 0.0;
+  const uint64_t rank = std::max<uint64_t>(1, std::ceil(percentile/100.0*count));
+  uint64_t num_of_latencies = 0;
+  int bucket = 0;
+  for (; bucket < kNumOfBuckets-1; ++bucket) {
+    num_of_latencies += counts_[bucket].load(std::memory_order_relaxed);
+    if (num_of_latencies >= rank)
+      break;
+  }
+  return std::exp2((double) (bucket+1)/kBucketsPerPowerOfTwo);
+}
+
+std::string LatencyHistogram::GetSummary() {
+// Returns the number of counted latencies and the 50th, 90th, 99th and 99.9th
+// percentiles.
+  char summary[160];
+  snprintf(summary, sizeof(summary), "n=%llu\tp50=%.1fus\tp90=%.1fus\tp99=%.1fus\tp99.9=%.1fus", (unsigned long long) GetCount(), GetPercentile(50.0), GetPercentile(90.0), GetPercentile(99.0), GetPercentile(99.9));
+  return summary;
+}
+
+Statistics::Statistics()
+    : enabled_(false) {
+  for (auto& counter : counters_)
+    counter.store(0, std::memory_order_relaxed);
+  for (auto& nanoseconds : nanoseconds_)
+    nanoseconds.store(0, std::memory_order_relaxed);
+}
+
+void Statistics::Enable() {
+// Enables the statistics (which has to be done before any other thread is
+// started).
+  enabled_ = true;
+}
+
+void Statistics::SetMemory(const std::string& component, const size_t bytes) {
+// Sets the number of bytes "component" needs (components that are created
+// more than once keep the largest number).
+  std::lock_guard<std::mutex> lock(memory_mutex_);
+  memory_[component] = std::max(memory_[component], bytes);
+}
+
+double Statistics::GetRatio(const Counter numerator, const Counter denominator) {
+// Returns the quotient of two counters (0 if "denominator" is 0).
+  const uint64_t value = counters_[denominator].load(std::memory_order_relaxed);
+  return (value > 0)? (double) counters_[numerator].load(std::memory_order_relaxed)/value : 0.0;
+}
+
+void Statistics::GetResidentMemory(size_t& resident_memory, size_t& peak_resident_memory) {
+// Reads the resident memory of the process and its peak (in bytes) from
+// "/proc/self/status" (both are 0 where that file does not exist).
+  std::ifstream status_file_stream("/proc/self/status");
+  std::string line;
+  resident_memory = peak_resident_memory = 0;
+  while (std::getline(status_file_stream, line)) {
+    if (line.compare(0, 6, "VmRSS:") == 0)
+      resident_memory = std::stoull(line.substr(6))*1024;
+    else if (line.compare(0, 6, "VmHWM:") == 0)
+      peak_resident_memory = std::stoull(line.substr(6))*1024;
+  }
+}
+
+void Statistics::ShowReport() {
+// Prints all counters, timers, latency percentiles and the memory breakdown.
+  std::cout << "\nStatistics:\n\tCounters:\n";
+  for (int counter = 0; counter < kNumOfCounters; ++counter)
+    std::cout << "\t " << kNamesOfCounters[counter] << " = " << counters_[counter].load(std::memory_order_relaxed) << '\n';
+  std::cout << "\t Probes per lookup = " << GetRatio(kProbes, kLookups) << '\n';
+  std::cout << "\t Chain steps per chain lookup = " << GetRatio(kChainSteps, kChainLookups) << '\n';
+  std::cout << "\t Bytes scanned per reader query = " << GetRatio(kReaderBytesScanned, kReaderQueries) << '\n';
+  std::cout << "\tTimers:\n";
+  for (int timer = 0; timer < kNumOfTimers; ++timer)
+    std::cout << "\t " << kNamesOfTimers[timer] << " = " << nanoseconds_[timer].load(std::memory_order_relaxed)/1e9 << " s\n";
+  std::cout << "\tLatencies:\n";
+  for (int operation = 0; operation < kNumOfOperations; ++operation) {
+    if (latencies_[operation].GetCount() > 0)
+      std::cout << "\t " << kNamesOfOperations[operation] << '\t' << latencies_[operation].GetSummary() << '\n';
+  }
+  size_t resident_memory, peak_resident_memory;
+  GetResidentMemory(resident_memory, peak_resident_memory);
+  std::cout << "\tMemory:\n";
+  {
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    for (auto& component : memory_)
+      std::cout << "\t " << component.first << " = " << component.second/1048576. << " MB\n";
+  }
+  std::cout << "\t resident = " << resident_memory/1048576. << " MB (peak: " << peak_resident_memory/1048576. << " MB)\n";
+}
+
+bool Statistics::SaveJson(const std::string& file) {
+// Writes all statistics as a JSON object to "file" and returns "true" if that
+// was successful.
+  std::ofstream out(file, std::ios_base::trunc);
+  char number[32];
+  out << "{\n  \"counters\": {";
+  for (int counter = 0; counter < kNumOfCounters; ++counter)
+    out << ((counter == 0)? "\n" : ",\n") << "    \"" << kNamesOfCounters[counter] << "\": " << counters_[counter].load(std::memory_order_relaxed);
+  snprintf(number, sizeof(number), "%.6g", GetRatio(kProbes, kLookups));
+  out << "\n  },\n  \"derived\": {\n    \"probes_per_lookup\": " << number;
+  snprintf(number, sizeof(number), "%.6g", GetRatio(kChainSteps, kChainLookups));
+  out << ",\n    \"chain_steps_per_chain_lookup\": " << number;
+  snprintf(number, sizeof(number), "%.6g", GetRatio(kReaderBytesScanned, kReaderQueries));
+  out << ",\n    \"bytes_scanned_per_reader_query\": " << number << "\n  },\n  \"timers_seconds\": {";
+  for (int timer = 0; timer < kNumOfTimers; ++timer) {
+    snprintf(number, sizeof(number), "%.9f", nanoseconds_[timer].load(std::memory_order_relaxed)/1e9);
+    out << ((timer == 0)? "\n" : ",\n") << "    \"" << kNamesOfTimers[timer] << "\": " << number;
+  }
+  out << "\n  },\n  \"latencies_microseconds\": {";
+  for (int operation = 0; operation < kNumOfOperations; ++operation) {
+    out << ((operation == 0)? "\n" : ",\n") << "    \"" << kNamesOfOperations[operation] << "\": {\"count\": " << latencies_[operation].GetCount();
+    for (int i = 0; i < 4; ++i) {
+      snprintf(number, sizeof(number), "%.1f", latencies_[operation].GetPercentile(kPercentiles[i]));
+      out << ", \"" << kNamesOfPercentiles[i] << "\": " << number;
+    }
+    out << '}';
+  }
+  size_t resident_memory, peak_resident_memory;
+  GetResidentMemory(resident_memory, peak_resident_memory);
+  out << "\n  },\n  \"memory_bytes\": {";
+  {
+    std::lock_guard<std::mutex> lock(memory_mutex_);
+    for (auto& component : memory_)
+      out << "\n    \"" << component.first << "\": " << component.second << ',';
+  }
+  out << "\n    \"resident\": " << resident_memory << ",\n    \"peak_resident\": " << peak_resident_memory << "\n  }\n}\n";
+  if (!out) {
+    std::cout << "ERROR: WRITING THE STATISTICS FILE \"" << file << "\" FAILED!\n";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,93 @@
+// thread_pool.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+ThreadPool::ThreadPool(const int num_of_threads)
+    : stop_(false) {
+  const int num = (num_of_threads > 0)? num_of_threads : GetDefaultNumOfThreads();
+  for (int i = 0; i < num; ++i)
+    threads_.emplace_back(&ThreadPool::Work, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  task_available_.notify_all();
+  for (auto& thread : threads_)
+    thread.join();
+}
+
+int ThreadPool::GetDefaultNumOfThreads() {
+// Returns the number of threads the hardware supports (at least 1).
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void ThreadPool::Work() {
+// The loop every thread of the pool runs: it waits for tasks and executes
+// them until the pool is destroyed (remaining tasks are finished first).
+  std::function<void()> task;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      task_available_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+      if (tasks_.empty())
+        return;
+      task = std::move(tasks_.front());
+      tasks_.pop();
+    }
+    task();
+  }
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+// Adds "task" to the queue of tasks, which will be executed by the first
+// thread available.
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push(std::move(task));
+  }
+  task_available_.notify_one();
+}
+
+void ThreadPool::ParallelFor(const size_t num_of_items, const std::function<void(size_t begin, size_t end, int chunk)>& function, int num_of_chunks) {
+// Splits the range [0, "num_of_items") into "num_of_chunks" consecutive chunks
+// (by default as many chunks as there are threads), calls "function" for
+// every chunk on the threads of the pool and returns when all chunks are
+// done. The chunks are numbered in the order of their ranges, so that results
+// collected per chunk can be merged in order.
+  if (num_of_items == 0)
+    return;
+  if (num_of_chunks < 1)
+    num_of_chunks = GetNumOfThreads();
+  num_of_chunks = std::min((size_t) num_of_chunks, num_of_items);
+  std::mutex done_mutex;
+  std::condition_variable all_done;
+  int num_of_chunks_left = num_of_chunks;
+  for (int chunk = 0; chunk < num_of_chunks; ++chunk) {
+    const size_t begin = num_of_items*chunk/num_of_chunks, end = num_of_items*(chunk+1)/num_of_chunks;
+    Submit([&, begin, end, chunk] {
+      function(begin, end, chunk);
+      std::lock_guard<std::mutex> lock(done_mutex);
+      if (--num_of_chunks_left == 0)
+        all_done.notify_one();
+    });
+  }
+  std::unique_lock<std::mutex> lock(done_mutex);
+  all_done.wait(lock, [&] { return num_of_chunks_left == 0; });
+}
@@ -0,0 +1,226 @@
+// word_vector_files.cc
+
+// Copyright 2019 E. Decker
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Detecting the format of word vector files (see "WordVectorFormat") and
+// reading their word vectors regardless of it, optionally restricted by a
+// "VocabularyFilter". The values of binary word vectors are expected in the
+// byte order of the machine (little-endian for the files word2vec writes on
+// x86 machines).
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iterator>
+
+#include "wvewht.h" // wvewht = "word_vector_evaluation_with_hash_table"
+
+namespace {
+
+const size_t kMaxLengthOfWord = 1000; // longer "words" in front of the first binary word vector are no words
+
+bool ParseHeader(const std::string& line, long long& num_of_vectors, int& vector_size) {
+// Parses the header "line" (the number of word vectors and their size) and
+// returns "false" if it is no header.
+  const char* position = line.data();
+  const char* end = position+line.size();
+  while (end > position && (end[-1] == '\r' || end[-1] == ' '))
+    end--;
+  std::from_chars_result result = std::from_chars(position, end, num_of_vectors);
+  if (result.ec != std::errc() || result.ptr == end || *result.ptr != ' ')
+    return false;
+  position = result.ptr;
+  while (position < end && *position == ' ')
+    position++;
+  result = std::from_chars(position, end, vector_size);
+  return (result.ec == std::errc() && result.ptr == end && num_of_vectors >= 0 && vector_size > 0);
+}
+
+bool IsTextWordVector(const char* begin, const char* end, const int vector_size) {
+// Checks if the line from "begin" to "end" is a word followed by
+// "vector_size" values.
+  if (end > begin && end[-1] == '\r')
+    end--;
+  const char* position = std::find(begin, end, ' ');
+  if (position == begin)
+    return false;
+  int num_of_values = 0;
+  double value;
+  while (position < end) {
+    while (position < end && *position == ' ')
+      position++;
+    if (position == end)
+      break;
+    const std::from_chars_result result = std::from_chars(position, end, value);
+    if (result.ec != std::errc() || (result.ptr < end && *result.ptr != ' '))
+      return false;
+    position = result.ptr;
+    num_of_values++;
+  }
+  return (num_of_values == vector_size);
+}
+
+} // namespace
+
+VocabularyFilter::VocabularyFilter(const long long max_words, const std::string& vocabulary_file)
+    : max_words_(std::max(0LL, max_words)),
+      has_vocabulary_(!vocabulary_file.empty()),
+      is_valid_(true) {
+  if (!has_vocabulary_)
+    return;
+  // The first token of every line is a word (so that e.g. word frequency
+  // lists can be used as vocabulary files); the words are not copied but
+  // referred to in "words_".
+  std::ifstream vocabulary_file_stream(vocabulary_file, std::ios_base::binary);
+  if (!vocabulary_file_stream.is_open()) {
+    std::cout << "ERROR: OPENING THE VOCABULARY FILE \"" << vocabulary_file << "\" FAILED!\n";
+    is_valid_ = false;
+    return;
+  }
+  words_.assign(std::istreambuf_iterator<char>(vocabulary_file_stream), std::istreambuf_iterator<char>());
+  vocabulary_.reserve(std::count(words_.begin(), words_.end(), '\n')+1);
+  const char* end_of_words = words_.data()+words_.size();
+  for (const char* line = words_.data(); line < end_of_words; ) {
+    const char* end_of_line = std::find(line, end_of_words, '\n');
+    const char* end_of_word = line;
+    while (end_of_word < end_of_line && *end_of_word != ' ' && *end_of_word != '\t' && *end_of_word != '\r')
+      end_of_word++;
+    if (end_of_word > line)
+      vocabulary_.insert(std::string_view(line, end_of_word-line));
+    line = end_of_line+1;
+  }
+  std::cout << "\tVocabulary: " << vocabulary_.size() << " words (\"" << vocabulary_file << "\").\n";
+}
+
+VocabularyFilter::~VocabularyFilter() {}
+
+long long VocabularyFilter::GetMaxNumOfVectors(const long long num_of_vectors) const {
+// Returns the highest number of the "num_of_vectors" word vectors of a word
+// vector file that can pass the filter.
+  long long max_num_of_vectors = num_of_vectors;
+  if (max_words_ > 0)
+    max_num_of_vectors = std::min(max_num_of_vectors, max_words_);
+  if (has_vocabulary_)
+    max_num_of_vectors = std::min(max_num_of_vectors, (long long) vocabulary_.size());
+  return max_num_of_vectors;
+}
+
+WordVectorFileReader::WordVectorFileReader(const std::string& file, const VocabularyFilter* vocabulary_filter)
+    : file_(file),
+      file_stream_(file),
+      info_(GetInfo(file)),
+      values_(std::max(0, info_.vector_size)),
+      vocabulary_filter_((vocabulary_filter != NULL && vocabulary_filter->IsActive())? vocabulary_filter : NULL),
+      num_of_vectors_read_(0) {
+  file_stream_.seekg(info_.size_of_header);
+}
+
+WordVectorFileReader::~WordVectorFileReader() {}
+
+WordVectorFileInfo WordVectorFileReader::GetInfo(const std::string& file) {
+// Returns the format of "file": a first line consisting of two integers is a
+// header if the first word vector after it is either a text line with as many
+// values as the header says or a word followed by as many binary values.
+  WordVectorFileInfo info;
+  InputFileStream file_stream(file);
+  std::string first_line;
+  long long num_of_vectors;
+  int vector_size;
+  if (!std::getline(file_stream, first_line) || !ParseHeader(first_line, num_of_vectors, vector_size))
+    return info;
+  std::vector<char> first_vector(32*(size_t) vector_size+kMaxLengthOfWord+1); // long enough for the first word vector in either format
+  file_stream.read(first_vector.data(), first_vector.size());
+  const char* begin = first_vector.data();
+  const char* end = begin+file_stream.gcount();
+  const char* end_of_line = std::find(begin, end, '\n');
+  if (IsTextWordVector(begin, end_of_line, vector_size))
+    info.format = kTextFormatWithHeader;
+  else {
+    while (begin < end && *begin == '\n')
+      begin++;
+    const char* end_of_word = std::find(begin, std::min(end, begin+kMaxLengthOfWord), ' ');
+    if (end_of_word == begin || std::find(begin, end_of_word, '\n') != end_of_word || FindEndOfBinaryVector(begin, end, vector_size) == NULL)
+      return info; // e.g. a text file whose first word vector consists of a number and one value
+    info.format = kBinaryFormat;
+  }
+  info.vector_size = vector_size;
+  info.num_of_vectors = num_of_vectors;
+  info.size_of_header = first_line.size()+1;
+  return info;
+}
+
+const char* WordVectorFileReader::FindEndOfBinaryVector(const char* begin, const char* end, const int vector_size) {
+// Returns the end of the binary word vector starting at "begin" (its word, a
+// space and "vector_size" floats) or NULL if it does not end before "end".
+  const char* end_of_word = (const char*) memchr(begin, ' ', end-begin);
+  if (end_of_word == NULL || end-(end_of_word+1) < (long long) (vector_size*sizeof(float)))
+    return NULL;
+  return end_of_word+1+vector_size*sizeof(float);
+}
+
+bool WordVectorFileReader::ReadLine(std::string& line) {
+// Reads the next word vector passing "vocabulary_filter_" as a text line and
+// returns "false" at the end of the file (or after the maximum number of word
+// vectors, or if the file is corrupt - see "IsCorrupt()"). Binary values are
+// written with as many digits as are needed to parse exactly the same values
+// again (as doubles, like "HashTableOnMemory" stores them); the values of
+// skipped binary word vectors are not converted.
+  if (file_stream_.bad())
+    return false;
+  while (true) {
+    if (vocabulary_filter_ != NULL && vocabulary_filter_->GetMaxWords() > 0 && num_of_vectors_read_ >= vocabulary_filter_->GetMaxWords())
+      return false;
+    if (info_.format != kBinaryFormat) {
+      if (!std::getline(file_stream_, line))
+        return ReportCorruptFile();
+      num_of_vectors_read_++;
+      if (vocabulary_filter_ == NULL || vocabulary_filter_->Contains(line.data(), std::min(line.find(' '), line.size())))
+        return true;
+      continue;
+    }
+    while (file_stream_.peek() == '\n') // word2vec ends every word vector with '\n'
+      file_stream_.get();
+    if (!std::getline(file_stream_, line, ' '))
+      return ReportCorruptFile();
+    num_of_vectors_read_++;
+    if (vocabulary_filter_ == NULL || vocabulary_filter_->Contains(line.data(), line.size()))
+      break;
+    file_stream_.ignore(values_.size()*sizeof(float));
+  }
+  file_stream_.read((char*) values_.data(), values_.size()*sizeof(float));
+  if (!file_stream_)
+    return ReportCorruptFile(); // an incomplete last word vector of a complete file is skipped
+  char value[32];
+  for (auto& element : values_) {
+    value[0] = ' ';
+    line.append(value, std::to_chars(value+1, value+sizeof(value), (double) element).ptr);
+  }
+  return true;
+}
+
+bool WordVectorFileReader::ReportCorruptFile() {
+// Prints an error if reading stopped because the file is truncated or corrupt
+// (and not at its end); returns "false" for "ReadLine()" either way.
+  if (file_stream_.bad())
+    std::cout << "ERROR: \"" << file_ << "\" IS CORRUPT - READING IT FAILED BEFORE ITS END!\n";
+  return false;
+}
+
+void WordVectorFileReader::Rewind() {
+// Continues with the first word vector again.
+  file_stream_.clear();
+  file_stream_.seekg(info_.size_of_header);
+  num_of_vectors_read_ = 0;
+}
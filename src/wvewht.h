@@ -17,28 +17,636 @@
 #ifndef WORD_VECTOR_EVALUATION_WITH_HASH_TABLE_SRC_WVEWHT_H_ // wvewht = "word_vector_evaluation_with_hash_table"
 #define WORD_VECTOR_EVALUATION_WITH_HASH_TABLE_SRC_WVEWHT_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 class HashTable;
+class HnswIndex;
+
+struct SimilarityKernels {
+// The kernels every similarity calculation is based on (see
+// "similarity_kernels.cc"); the Euclidean norm of a vector is the square root
+// of its dot product with itself.
+  const char* name;
+  double (*dot_product_f64)(const double* vector_0, const double* vector_1, const int size);
+  double (*squared_distance_f64)(const double* vector_0, const double* vector_1, const int size);
+  float (*dot_product_f32)(const float* vector_0, const float* vector_1, const int size);
+  float (*squared_distance_f32)(const float* vector_0, const float* vector_1, const int size);
+  double (*dot_product_f64_f16)(const double* vector_0, const uint16_t* vector_1, const int size);
+  float (*dot_product_f16)(const uint16_t* vector_0, const uint16_t* vector_1, const int size);
+  double (*dot_product_f64_i8)(const double* vector_0, const int8_t* vector_1, const int size);
+  int (*dot_product_i8)(const int8_t* vector_0, const int8_t* vector_1, const int size);
+};
+extern SimilarityKernels kSimilarityKernels; // the best kernels the CPU supports (selected at startup)
+bool SelectSimilarityKernels(const std::string& name);
+uint16_t ConvertToHalf(const float value);
+float ConvertFromHalf(const uint16_t half);
+
+class ThreadPool {
+// Pool of worker threads executing submitted tasks (see "thread_pool.cc").
+// "ParallelFor()" must not be called from within a task of the same pool.
+ public:
+  ThreadPool(const int num_of_threads = 0); // 0 = as many threads as the hardware supports
+  ~ThreadPool();
+  static int GetDefaultNumOfThreads();
+  void Submit(std::function<void()> task);
+  void ParallelFor(const size_t num_of_items, const std::function<void(size_t begin, size_t end, int chunk)>& function, int num_of_chunks = 0);
+
+  int GetNumOfThreads() {
+    return threads_.size();
+  }
+
+ private:
+  std::vector<std::thread> threads_;
+  std::queue<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable task_available_;
+  bool stop_;
+  void Work();
+};
+
+class LatencyHistogram {
+// Histogram of latencies (in microseconds) with logarithmic buckets (eight per
+// power of two, i.e. the percentiles are accurate to about 9 %). The counters
+// are atomic, so that "Add()" can be called by many threads without locks.
+ public:
+  LatencyHistogram();
+  void Add(const double microseconds);
+  double GetPercentile(const double percentile);
+  std::string GetSummary();
+
+  uint64_t GetCount() {
+    return count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static const int kBucketsPerPowerOfTwo = 8;
+  static const int kNumOfBuckets = 40*kBucketsPerPowerOfTwo; // up to 2^40 microseconds
+  std::atomic<uint64_t> counts_[kNumOfBuckets];
+  std::atomic<uint64_t> count_;
+};
+
+class Statistics {
+// Counters, timers, latency histograms and a memory breakdown of the hot paths
+// (see "statistics.cc"), enabled by "--stats". The counters are atomic, so
+// that they can be updated by many threads without locks; if the statistics
+// are disabled, the hot paths only check "IsEnabled()".
+ public:
+  enum Counter {
+    kBytesRead, // bytes of word vector files read by "HashTableOnMemory"
+    kLinesParsed,
+    kLookups, // words looked up in "HashTableOnMemory"
+    kLookupMisses,
+    kProbes, // slots probed by the lookups
+    kChainLookups, // words looked up in buckets of hash table files
+    kChainSteps, // word vectors of buckets compared with the words looked up
+    kReaderQueries, // calls of "HashTableReader::FetchVectors()"
+    kReaderBytesScanned, // bytes of hash table files read by the queries
+    kKernelCalls, // similarities (dot products) calculated by comparisons and scans
+    kBytesWritten, // bytes of hash table files written
+    kNumOfCounters
+  };
+  enum Timer {
+    kLoadTime, // loading word vector files ("HashTableOnMemory")
+    kLookupTime, // looking words up in "HashTableOnMemory"
+    kParseTime, // parsing the chunks of word vector files (part of "kLoadTime")
+    kStoreTime, // inserting the parsed word vectors into the slots (part of "kLoadTime")
+    kKernelTime, // similarity calculations of comparisons and scans
+    kReaderTime, // queries of "HashTableReader"
+    kWriterTime, // writing hash table files
+    kNumOfTimers
+  };
+  enum Operation {
+    kLookupOperation,
+    kSimilarityOperation,
+    kScanOperation, // a nearest neighbour scan over all word vectors (for one or more queries)
+    kReaderOperation,
+    kNumOfOperations
+  };
+  Statistics();
+  void Enable();
+  void SetMemory(const std::string& component, const size_t bytes);
+  void ShowReport();
+  bool SaveJson(const std::string& file);
+
+  bool IsEnabled() {
+    return enabled_;
+  }
+
+  void Add(const Counter counter, const uint64_t value) {
+    counters_[counter].fetch_add(value, std::memory_order_relaxed);
+  }
+
+  void AddTime(const Timer timer, const Operation operation, const double seconds) {
+  // Adds "seconds" to "timer" and to the latencies of "operation" (unless it is
+  // "kNumOfOperations").
+    nanoseconds_[timer].fetch_add((uint64_t) (seconds*1e9), std::memory_order_relaxed);
+    if (operation != kNumOfOperations)
+      latencies_[operation].Add(seconds*1e6);
+  }
+
+ private:
+  bool enabled_;
+  std::atomic<uint64_t> counters_[kNumOfCounters];
+  std::atomic<uint64_t> nanoseconds_[kNumOfTimers];
+  LatencyHistogram latencies_[kNumOfOperations];
+  std::mutex memory_mutex_;
+  std::map<std::string, size_t> memory_; // the bytes of every component (e.g. "hash_table_on_memory.vectors")
+  double GetRatio(const Counter numerator, const Counter denominator);
+  void GetResidentMemory(size_t& resident_memory, size_t& peak_resident_memory);
+};
+extern Statistics kStatistics; // the statistics of the program (disabled unless "--stats" is given)
+
+class StatisticsTimer {
+// Adds the time from its construction to its destruction to a timer of
+// "kStatistics" (and to the latencies of an operation) if the statistics are
+// enabled; otherwise it costs only the check whether they are.
+ public:
+  StatisticsTimer(const Statistics::Timer timer, const Statistics::Operation operation = Statistics::kNumOfOperations)
+      : timer_(timer),
+        operation_(operation),
+        enabled_(kStatistics.IsEnabled()) {
+    if (enabled_)
+      start_ = std::chrono::steady_clock::now();
+  }
+
+  ~StatisticsTimer() {
+    if (enabled_)
+      kStatistics.AddTime(timer_, operation_, std::chrono::duration<double>(std::chrono::steady_clock::now()-start_).count());
+  }
+
+ private:
+  const Statistics::Timer timer_;
+  const Statistics::Operation operation_;
+  const bool enabled_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+enum Metric {
+// The measurements that can be used to find the nearest neighbours of a word
+// vector.
+  kCosineSimilarity,
+  kEuclideanDistance
+};
+
+enum AnalogyMethod {
+// The methods word analogies ("a" is to "b" as "c" is to "d") can be answered
+// with (Levy & Goldberg, 2014): the word "d" maximizing
+// cos(d, b)-cos(d, a)+cos(d, c) or cos'(d, b)*cos'(d, c)/(cos'(d, a)+0.001)
+// with cos' = (cos+1)/2.
+  k3CosAdd = 1,
+  k3CosMul = 2,
+  kBothAnalogyMethods = 3
+};
+
+class WordSimilarityBenchmarks {
+// Word similarity benchmarks (e.g. WordSim-353, SimLex-999 or MEN), i.e.
+// files of word pairs rated by humans ("word_0 word_1 rating" per line): the
+// cosine similarities of the pairs are compared with the ratings by their
+// Spearman and Pearson correlations (see "evaluation.cc").
+ public:
+  WordSimilarityBenchmarks(const std::vector<std::string>& files);
+  ~WordSimilarityBenchmarks();
+  void ShowResults(const std::vector<double>& cosine_similarities, const std::vector<std::string>& unknown_words);
+
+  bool BenchmarksAreValid() {
+    return !benchmarks_.empty();
+  }
+
+  const std::vector<std::pair<std::string, std::string>>& GetWordPairs() {
+  // Returns the word pairs of all benchmarks (in lower case).
+    return word_pairs_;
+  }
+
+ private:
+  struct Benchmark {
+    std::string name;
+    size_t first_pair, end_of_pairs; // the range of the pairs of the benchmark in "word_pairs_"
+  };
+  std::vector<Benchmark> benchmarks_;
+  std::vector<std::pair<std::string, std::string>> word_pairs_;
+  std::vector<double> ratings_; // the rating of every word pair
+  bool ReadBenchmark(const std::string& file);
+};
+
+struct Neighbour {
+// A word found by a nearest neighbour search and its cosine similarity or
+// Euclidean distance to the query.
+  std::string word;
+  double score;
+};
+
+enum HashFunction {
+// The hash functions a hash table can be built with. Hash table files record
+// the hash function (see "HashTableReader::GetHashTableValues()"), so that
+// files built with the original hash function remain readable.
+  kPrimeHash = 0, // the original hash function (the characters of a key multiplied by ten primes and summed up), used by files without a recorded hash function
+  kMurmurHash64 = 1, // MurmurHash64A (see "GetMurmurHash64()"), used for all new hash tables by default
+  kMinimalPerfectHash = 2 // a "MinimalPerfectHash" over the words (stored next to the hash table file, see "kMinimalPerfectHashExtension")
+};
+
+uint64_t GetMurmurHash64(const char* key, const size_t length);
+
+class MinimalPerfectHash {
+// Minimal perfect hash function (BBHash, see "minimal_perfect_hash.cc") mapping
+// every key of a static set of "n" keys to a distinct number smaller than "n".
+ public:
+  MinimalPerfectHash();
+  ~MinimalPerfectHash();
+  void Build(std::vector<uint64_t>& hashes, ThreadPool& thread_pool);
+  bool Save(const std::string& file);
+  bool Load(const std::string& file);
+  uint64_t GetIndex(const char* key, const size_t length) const;
+
+  uint64_t GetNumOfKeys() const {
+    return num_of_keys_;
+  }
+
+  size_t GetMemoryUsage() const {
+  // Returns the (approximate) number of bytes the function needs.
+    return (bits_.capacity()+level_offsets_.capacity()+ranks_.capacity())*sizeof(uint64_t)+fallback_.size()*4*sizeof(uint64_t);
+  }
+
+  size_t GetSizeInBytes() const {
+    return (bits_.size()+ranks_.size()+level_offsets_.size()+2*fallback_.size())*sizeof(uint64_t);
+  }
+
+ private:
+  uint64_t num_of_keys_;
+  std::vector<uint64_t> bits_; // the bits of all levels
+  std::vector<uint64_t> level_offsets_; // the first bit of every level (contains one more element than there are levels)
+  std::vector<uint64_t> ranks_; // the number of set bits before every block of bits (see "SetRanks()")
+  std::unordered_map<uint64_t, uint64_t> fallback_; // the numbers of the keys left after the last level (by their hashes)
+  void SetRanks();
+  uint64_t GetRank(const uint64_t position) const;
+};
+
+enum VectorPrecision {
+// The precisions the values of the word vectors can be stored with: doubles,
+// half-precision floats (fp16) or 8-bit integers with a scale per vector
+// (the value "v" of a vector with the scale "s" stands for v*s).
+  kFloat64,
+  kFloat16,
+  kInt8
+};
+
+enum Compression {
+// The compressions of word vector files that are decompressed while reading
+// them (detected by their magic bytes).
+  kUncompressed,
+  kGzip, // decompressed with zlib
+  kZstd // decompressed by the external program "zstd"
+};
+
+class DecompressingStreamBuffer : public std::streambuf {
+// Stream buffer delivering the decompressed content of a compressed file (see
+// "compressed_files.cc"). The file is decompressed by a pipeline thread of
+// its own in blocks of "kSizeOfDecompressedBlocks" bytes, a few blocks ahead
+// of the reader, so that decompressing overlaps with processing the content.
+ public:
+  DecompressingStreamBuffer(const std::string& file, const Compression compression);
+  ~DecompressingStreamBuffer();
+
+  bool IsOpen() {
+    return is_open_;
+  }
+
+ protected:
+  int_type underflow() override;
+  pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode mode) override;
+  pos_type seekpos(pos_type position, std::ios_base::openmode mode) override;
+
+ private:
+  const std::string file_;
+  const Compression compression_;
+  bool is_open_;
+  std::thread decompressor_;
+  std::mutex mutex_;
+  std::condition_variable block_added_, block_taken_;
+  std::deque<std::vector<char>> blocks_; // the decompressed blocks not read yet
+  bool is_finished_, is_stopped_; // set by the pipeline thread at the end of the file and by "Stop()"
+  bool has_failed_; // set by the pipeline thread if the file is truncated or corrupt
+  std::vector<char> current_block_; // the block the get area refers to
+  long long position_of_current_block_; // the position of "current_block_" in the decompressed content
+  void* gzip_file_; // the "gzFile" of zlib
+  int pipe_of_zstd_; // the pipe the external "zstd" writes to
+  pid_t process_of_zstd_; // -1 if "zstd" is not running (any more)
+  void Start();
+  void Stop();
+  void Decompress();
+  bool AddBlock(std::vector<char>& block);
+};
+
+class InputFileStream : public std::istream {
+// Input stream of a word vector file reading compressed files (see
+// "Compression") as if they were uncompressed. The "badbit" is set if a
+// compressed file turns out to be truncated or corrupt, so that its end can
+// be told apart from the end of a complete file.
+ public:
+  InputFileStream(const std::string& file);
+  ~InputFileStream();
+  static Compression GetCompression(const std::string& file);
+  static long long GetEstimatedSize(const std::string& file);
+
+  bool is_open() {
+    return (decompressing_stream_buffer_ != NULL)? decompressing_stream_buffer_->IsOpen() : file_buffer_.is_open();
+  }
+
+ private:
+  std::filebuf file_buffer_;
+  std::unique_ptr<DecompressingStreamBuffer> decompressing_stream_buffer_;
+};
+
+enum WordVectorFormat {
+// The formats of word vector files: text with one word vector per line (the
+// word followed by its values, e.g. GloVe), the same with a first line
+// containing the number of word vectors and their size (e.g. fastText ".vec"
+// files) and the binary format of word2vec (a header like that of ".vec"
+// files followed by every word, a space and its values as 32-bit floats).
+  kTextFormat,
+  kTextFormatWithHeader,
+  kBinaryFormat
+};
+
+struct WordVectorFileInfo {
+// The format of a word vector file and the values of its header (see
+// "WordVectorFileReader::GetInfo()").
+  WordVectorFormat format = kTextFormat;
+  int vector_size = -1; // -1 if the file has no header
+  long long num_of_vectors = -1; // -1 if the file has no header
+  size_t size_of_header = 0; // the offset of the first word vector
+};
+
+class VocabularyFilter {
+// Class to restrict the word vectors read from a word vector file to its
+// first "max_words" word vectors (word vector files are usually sorted by the
+// frequency of their words) and/or to the words of a vocabulary file (see
+// "word_vector_files.cc"). The words are checked before any value of their
+// word vectors is parsed.
+ public:
+  VocabularyFilter(const long long max_words, const std::string& vocabulary_file);
+  ~VocabularyFilter();
+  long long GetMaxNumOfVectors(const long long num_of_vectors) const;
+
+  bool IsActive() const {
+    return (max_words_ > 0 || has_vocabulary_);
+  }
+
+  bool IsValid() const {
+    return is_valid_;
+  }
+
+  bool HasVocabulary() const {
+    return has_vocabulary_;
+  }
+
+  long long GetMaxWords() const {
+    return max_words_;
+  }
+
+  bool Contains(const char* word, const size_t length) const {
+  // Checks if "word" (consisting of "length" characters) passes the
+  // vocabulary file (every word does if there is none).
+    return (!has_vocabulary_ || vocabulary_.count(std::string_view(word, length)) > 0);
+  }
+
+ private:
+  const long long max_words_; // 0 = all word vectors
+  bool has_vocabulary_;
+  bool is_valid_; // "false" if the vocabulary file cannot be read
+  std::string words_; // the content of the vocabulary file "vocabulary_" refers to
+  std::unordered_set<std::string_view> vocabulary_;
+};
+
+class WordVectorFileReader {
+// Class to read the word vectors of a word vector file of any
+// "WordVectorFormat" one after another as text lines (the word followed by
+// its values, separated by spaces), so that the header of the file is skipped
+// and binary word vectors are converted (see "word_vector_files.cc").
+ public:
+  WordVectorFileReader(const std::string& file, const VocabularyFilter* vocabulary_filter = NULL);
+  ~WordVectorFileReader();
+  static WordVectorFileInfo GetInfo(const std::string& file);
+  static const char* FindEndOfBinaryVector(const char* begin, const char* end, const int vector_size);
+  bool ReadLine(std::string& line);
+  void Rewind();
+
+  bool IsOpen() {
+    return file_stream_.is_open();
+  }
+
+  bool IsCorrupt() { // "true" if "ReadLine()" stopped because the (compressed) file is truncated or corrupt
+    return file_stream_.bad();
+  }
+
+  const WordVectorFileInfo& GetInfo() {
+    return info_;
+  }
+
+ private:
+  const std::string file_;
+  InputFileStream file_stream_;
+  const WordVectorFileInfo info_;
+  std::vector<float> values_; // the values of the binary word vector read last
+  const VocabularyFilter* vocabulary_filter_; // the word vectors that are skipped (NULL = none)
+  long long num_of_vectors_read_; // including the ones skipped because of the vocabulary
+  bool ReportCorruptFile();
+};
+
+struct HashTableOptions {
+// Options of "HashTableOnMemory" (see "main()" for the corresponding command
+// line options).
+  bool normalize = false; // if "true", the word vectors are stored unit-normalized (their original norms are kept in order to calculate Euclidean distances)
+  VectorPrecision precision = kFloat64;
+  double max_load_factor = 0.5; // the maximum number of word vectors per slot (the slots grow if it would be exceeded)
+  std::string snapshot_file; // if not empty, the hash table is mapped from this snapshot file if it fits the word vector file and the options above; otherwise it is created from the word vector file and saved to the snapshot file
+  bool verify_snapshot = false; // if "true", the checksum of the word vectors of a mapped snapshot is verified as well (the checksum of its slots and words always is)
+  bool lazy = false; // if "true", only the words are read while loading and every word vector is parsed (from the mapped word vector file) when its word is looked up first
+  bool warm_up = false; // if "true" (and "lazy" is set), a background thread parses all word vectors after loading
+  long long max_words = 0; // if greater than 0, only the first "max_words" word vectors of the word vector file are loaded
+  std::string vocabulary_file; // if not empty, only the word vectors of the words in this file (one per line) are loaded
+};
+
+struct HashTableWriterOptions {
+// Options of "HashTableWriter" (see "main()" for the corresponding command
+// line options).
+  long long memory_budget = 1024LL*1024*1024; // bytes of the word vector file that may be held on memory at once (1 GB)
+  VectorPrecision precision = kFloat64;
+  double max_load_factor = 1.0; // the maximum average number of word vectors per bucket
+  bool minimal_perfect_hash = false; // if "true", the buckets are given by a "MinimalPerfectHash" (one word per bucket, no empty buckets)
+  int num_of_threads = 0; // the number of threads building the minimal perfect hash (0 = as many as the hardware supports)
+  bool append = false; // if "true", the word vectors are written to a new delta segment of the output file (see "kDeltaSegmentExtension")
+  bool compact = false; // if "true", the input file is a hash table file whose delta segments are merged into it
+  long long max_words = 0; // if greater than 0, only the first "max_words" word vectors of the word vector file are written
+  std::string vocabulary_file; // if not empty, only the word vectors of the words in this file (one per line) are written
+};
+
+struct HashTableReaderOptions {
+// Options of "HashTableReader" (see "main()" for the corresponding command
+// line options).
+  size_t vector_cache_size = 64LL*1024*1024; // bytes of recently parsed word vectors kept on memory (64 MB; 0 = no cache)
+  size_t bucket_cache_size = 0; // bytes of recently read buckets (lines of the hash table file) kept on memory
+  bool read_delta_segments = true; // if "true", the delta segments of the hash table file are read as well (the delta segments themselves are read without them and without messages)
+};
+
+template <typename Key, typename Value>
+class LruCache {
+// Cache holding at most "max_size" bytes of values (the size of every value is
+// given to "Put()"); if it is full, the least recently used values are
+// evicted first. It is not thread-safe.
+ public:
+  LruCache(const size_t max_size = 0)
+      : max_size_(max_size),
+        size_(0),
+        num_of_hits_(0),
+        num_of_misses_(0) {}
+
+  const Value* Get(const Key& key) {
+  // Returns the value cached for "key" (which becomes the most recently used
+  // one) or NULL if there is none (a cache without bytes counts no misses).
+    if (max_size_ == 0)
+      return NULL;
+    auto entry = entries_.find(key);
+    if (entry == entries_.end()) {
+      ++num_of_misses_;
+      return NULL;
+    }
+    ++num_of_hits_;
+    order_.splice(order_.begin(), order_, entry->second);
+    return &entry->second->value;
+  }
+
+  void Put(const Key& key, const Value& value, const size_t size) {
+  // Caches "value" (needing "size" bytes) for "key" and evicts the least
+  // recently used values as long as the cache holds too many bytes.
+    if (size > max_size_)
+      return;
+    auto entry = entries_.find(key);
+    if (entry != entries_.end()) {
+      size_ -= entry->second->size;
+      order_.erase(entry->second);
+      entries_.erase(entry);
+    }
+    order_.push_front(Entry{key, value, size});
+    entries_[key] = order_.begin();
+    size_ += size;
+    while (size_ > max_size_) {
+      size_ -= order_.back().size;
+      entries_.erase(order_.back().key);
+      order_.pop_back();
+    }
+  }
+
+  size_t GetNumOfEntries() {
+    return entries_.size();
+  }
+
+  size_t GetSize() {
+    return size_;
+  }
+
+  uint64_t GetNumOfHits() {
+    return num_of_hits_;
+  }
+
+  uint64_t GetNumOfMisses() {
+    return num_of_misses_;
+  }
+
+ private:
+  struct Entry {
+    Key key;
+    Value value;
+    size_t size;
+  };
+  const size_t max_size_;
+  size_t size_;
+  uint64_t num_of_hits_, num_of_misses_;
+  std::list<Entry> order_; // the most recently used entry first
+  std::unordered_map<Key, typename std::list<Entry>::iterator> entries_;
+};
+
+// Extension of the offset index file "HashTableWriter" writes next to a hash
+// table file. The offset index file starts with "kOffsetIndexMagic", followed
+// by the size of the hash table file, the number of buckets and the byte
+// offset of every bucket (all of them as 64-bit integers; the offset of an
+// empty bucket is -1).
+const std::string kOffsetIndexExtension = ".idx";
+const std::string kOffsetIndexMagic = "WVEWHTIX";
+
+// Extension of the file containing the "MinimalPerfectHash" of a hash table
+// file written with "HashTableWriterOptions::minimal_perfect_hash".
+const std::string kMinimalPerfectHashExtension = ".mph";
+
+// Extension of the delta segments of a hash table file: hash table files of
+// their own (with offset index files), written by "HashTableWriter" with
+// "HashTableWriterOptions::append" and named like the hash table file followed
+// by "kDeltaSegmentExtension" and their number (1, 2, ...; the highest number
+// belongs to the newest delta segment). "HashTableReader" prefers the word
+// vectors of newer delta segments to older ones and to those of the hash table
+// file; "HashTableWriterOptions::compact" merges them into the hash table file.
+const std::string kDeltaSegmentExtension = ".delta";
 
 class HashTableReader {
-// Class to read hash tables created by "HashTableWriter".
+// Class to read hash tables created by "HashTableWriter". The hash table file
+// stays open between queries, and recently read word vectors (and optionally
+// buckets) are cached, so that repeated words need no access to the file. It
+// is not thread-safe.
  public:
-  HashTableReader(const std::string& hash_table_file);
+  HashTableReader(const std::string& hash_table_file, const HashTableReaderOptions& options = HashTableReaderOptions());
   ~HashTableReader();
   void CompareWordVectors(const std::vector<std::string>& words);
   void GetVectors(HashTable& hash_table, const std::vector<std::string>& words);
+  void EvaluateWordSimilarities(WordSimilarityBenchmarks& benchmarks);
+  void FetchVectors(const std::vector<std::string>& words, std::unordered_map<std::string, std::pair<std::vector<double>, double>>& vectors);
+  void ReadVectors(const std::vector<std::string>& words, std::unordered_map<std::string, std::pair<std::vector<double>, double>>& vectors);
+  void ShowCacheInfo();
+  static std::vector<int> GetHashTableValues(const std::string& hash_table_file);
+
+  int GetVectorSize() {
+    return hash_table_values_[0];
+  }
 
  private:
   const std::string hash_table_file_;
   const std::vector<int> hash_table_values_;
-  std::vector<int> GetHashTableValues();
-  void GetBothVectors(const std::string& line, const std::vector<std::string>& words_to_find, std::vector<std::vector<double>>& vectors);
+  std::vector<std::unique_ptr<HashTableReader>> delta_segments_; // the newest delta segment first
+  std::vector<long long> bucket_offsets_; // byte offsets of the buckets in "hash_table_file_" (empty if there is no offset index file)
+  std::unique_ptr<MinimalPerfectHash> minimal_perfect_hash_; // the buckets of the words if the hash table file was written with a minimal perfect hash
+  std::ifstream hash_table_file_stream_;
+  LruCache<std::string, std::pair<std::vector<double>, double>> vector_cache_; // the vectors and norms of recently read words (an empty vector if the word couldn't be found)
+  LruCache<int, std::string> bucket_cache_; // the lines of recently read buckets
+  void OpenDeltaSegments();
+  void LoadOffsetIndex();
+  bool ReadBucket(const int index, std::string& line);
+  void ReadBuckets(std::map<int, std::string>& lines);
   std::string GetWordVectorsFromLine(const std::string& line, const std::string& word_to_find);
-  std::vector<double> GetVector(const std::string& word_vector);
+  std::vector<double> GetVector(const std::string& word_vector, double& norm);
+  void DecodeQuantizedVector(std::stringstream& stream, std::vector<double>& vector);
+
+  HashFunction GetHashFunction() {
+    return (HashFunction) hash_table_values_[3];
+  }
 
   bool CheckIndex(const std::string& index, const std::string& line) {
   // Checks if the current "line" of a hash table file is equal to the "index"
@@ -47,16 +655,16 @@ class HashTableReader {
     return (index == line.substr(0, line.find_first_of(',')));
   }
 
-  bool VectorIsValid(const std::string& word, const std::vector<double>& vector_to_check) {
-  // Checks whether "vector_to_check" contains only zeros - if so, "false" will
-  // be returned (for this means that the corresponding "word" was not found);
-  // otherwise "true" will be returned.
-    if (vector_to_check != std::vector<double>(hash_table_values_[0], 0))
-      return true;
-    else {
-      std::cout << "\t\"" << word << "\" couldn't be found in your data! Comparison impossible.\n" << std::endl;
-      return false;
-    }
+  bool IsWordVectorOf(const std::string& word_vector, const std::string& word) {
+  // Checks if "word_vector" (i.e. a word followed by the values of its vector)
+  // belongs to "word" (and not only starts with it).
+    return (word_vector.size() > word.length() && word_vector[word.length()] == ' ' && word_vector.compare(0, word.length(), word) == 0);
+  }
+
+  size_t GetSizeOfCachedVector(const std::string& word, const std::vector<double>& vector) {
+  // Returns the (approximate) number of bytes the cached "vector" of "word"
+  // needs, including the overhead of the cache.
+    return sizeof(std::pair<std::vector<double>, double>)+word.size()+vector.size()*sizeof(double)+64;
   }
 };
 
@@ -64,89 +672,471 @@ class HashTable {
 // Basic hash table class containing the main methods and members of a hash
 // table.
  public:
-  HashTable(const std::string& input_file);
-  HashTable(const int hash_table_size);
+  HashTable(const std::string& input_file, const HashFunction hash_function = kMurmurHash64);
+  HashTable(const int hash_table_size, const HashFunction hash_function, const MinimalPerfectHash* minimal_perfect_hash = NULL);
   ~HashTable();
 
   bool HashTableIsValid() {
     return (vector_size_ < 1 || vector_num_ < 1)? false : true;
   }
 
+  static long long GetFileSize(const std::string& file);
+  static const char* GetNameOfHashFunction(const HashFunction hash_function);
+  static std::vector<std::string> GetDeltaSegments(const std::string& hash_table_file);
+
  protected:
   const std::string input_file_;
-  const int vector_size_, vector_num_, hash_table_size_;
+  const WordVectorFileInfo input_file_info_; // the format of "input_file_" if it is a word vector file
+  const int vector_size_;
+  const HashFunction hash_function_;
+  const MinimalPerfectHash* minimal_perfect_hash_; // used by "GetIndex()" if "hash_function_" is "kMinimalPerfectHash"
+  int vector_num_, hash_table_size_; // set by the derived classes, for "HashTableWriter" may know "vector_num_" only after reading "input_file_"
   const int GetSizeOfVectors();
   const int CountVectors();
-  int GetIndex(const std::string& key); // hash function
-  void ShowInfo(const int num_of_empty_buckets, const int highest_num_of_nodes_in_a_bucket);
-  void ShowSimilarity(const std::vector<std::string>& words, const std::vector<std::vector<double>>& vectors);
-  double CalculateCosineSimilarity(const std::vector<std::vector<double>>& vectors);
-  double CalculateEuclideanDistance(const std::vector<std::vector<double>>& vectors);
-  double CalculateEuclideanNorm(const std::vector<double>& vector);
+  void SetHashTableSize(const double max_load_factor);
+  uint64_t GetHash(const char* key, const size_t length); // hash function
+
+  uint64_t GetHash(const std::string& key) {
+    return GetHash(key.data(), key.length());
+  }
+
+  int GetIndex(const std::string& key);
+  void ShowInfo(const int num_of_empty_buckets, const std::vector<int>& num_of_buckets_per_length);
+  void ShowSimilarity(const std::vector<std::string>& words, const double dot_product, const double norm_0, const double norm_1);
+  double CalculateCosineSimilarity(const double dot_product, const double norm_0, const double norm_1);
+  double CalculateEuclideanDistance(const double dot_product, const double norm_0, const double norm_1);
+  double CalculateDotProduct(const double* vector_0, const double* vector_1, const int size);
+  double CalculateEuclideanNorm(const double* vector, const int size);
+  void QuantizeToHalf(double* vector, uint16_t* quantized_vector);
+  float QuantizeToInt8(double* vector, int8_t* quantized_vector);
 
  friend void HashTableReader::GetVectors(HashTable& hash_table, const std::vector<std::string>& words);
+ friend void HashTableReader::EvaluateWordSimilarities(WordSimilarityBenchmarks& benchmarks);
+ friend void HashTableReader::ReadVectors(const std::vector<std::string>& words, std::unordered_map<std::string, std::pair<std::vector<double>, double>>& vectors);
 };
 
 class HashTableOnMemory : public HashTable {
 // Class to create a hash table on memory containing the word vectors of a
-// given word vector file.
+// given word vector file. All vectors are stored in one contiguous row-major
+// matrix and all words in one string arena; the hash table itself uses open
+// addressing (linear probing) with slots referring to the rows of the matrix.
+// Instead of being read from the word vector file, the matrix, the words and
+// the slots can be mapped read-only from a snapshot file (see "snapshot.cc"),
+// which needs no parsing and is shared by all processes mapping it.
  public:
-  HashTableOnMemory(const std::string& file);
+  HashTableOnMemory(const std::string& file, ThreadPool& thread_pool, const HashTableOptions& options = HashTableOptions());
   ~HashTableOnMemory();
+  static bool IsSnapshotFile(const std::string& file);
+  static int GetVectorSizeOfSnapshot(const std::string& snapshot_file);
+  bool SaveSnapshot(const std::string& snapshot_file);
   void PrintInfo();
+  void ShowQuantizationError(const int num_of_pairs);
   void CompareWordVectors(const std::vector<std::string>& words);
+  void CompareWordPairs(std::istream& word_pairs, std::ostream& out, ThreadPool& thread_pool);
+  void ReportMemory();
+  int GetRow(const std::string& word);
+  std::vector<double> GetVectorOfWord(const std::string& word, double& norm);
+  void GetSimilarityOfRows(const unsigned row_0, const unsigned row_1, double& cosine_similarity, double& euclidean_distance);
+  std::vector<Neighbour> Nearest(const std::string& word, const int k, const Metric metric, ThreadPool& thread_pool);
+  std::vector<Neighbour> Nearest(const std::vector<double>& query_vector, const int k, const Metric metric, ThreadPool& thread_pool);
+  void FindNearestNeighbours(std::istream& queries, std::ostream& out, const int k, const Metric metric, ThreadPool& thread_pool, HnswIndex* hnsw_index = NULL);
+  void EvaluateAnalogies(std::istream& analogies, const AnalogyMethod method, ThreadPool& thread_pool);
+  void EvaluateWordSimilarities(WordSimilarityBenchmarks& benchmarks, ThreadPool& thread_pool);
+
+  int GetVectorSize() {
+    return vector_size_;
+  }
+
+  std::string GetWordOfRow(const unsigned row) {
+    return std::string(words_+word_offsets_[row], word_offsets_[row+1]-word_offsets_[row]);
+  }
 
  private:
-  struct WordVector {
-    std::string word;
+  struct Query {
+  // A query of a nearest neighbour search.
     std::vector<double> vector;
-    WordVector* next;
-    WordVector(std::string str, std::vector<double> vec) : word(str), vector(vec), next(NULL) {}
+    double norm;
+    int excluded_row; // the row of the query word itself (-1 if the query is not a stored word vector)
+  };
+  struct ParsedLines {
+  // The word vectors of a part of a chunk of the word vector file, parsed by
+  // one thread before they are stored.
+    std::string words;
+    std::vector<size_t> ends_of_words; // the end of every word in "words"
+    std::vector<unsigned> hashes; // see "GetSlotHash()"
+    std::vector<double> values, norms; // "values" contains the word vectors if they are stored as doubles
+    std::vector<uint16_t> half_values; // the word vectors if they are stored as fp16 values
+    std::vector<int8_t> int8_values; // the word vectors if they are stored as int8 values
+    std::vector<float> scales; // the scales of the int8 word vectors
+    std::vector<const char*> lines; // the beginnings of the lines (or binary word vectors) if only the words are parsed (see "HashTableOptions::lazy")
   };
-  std::vector<WordVector*> hash_table_;
-  void ReadVectorFile();
-  void StoreVectors(const std::string& line);
-  std::vector<std::string> SplitLine(const std::string& line);
-  int GetNumOfWordVectors(const int index);
-  std::vector<double> GetVector(const std::string& word);
+  struct Slot {
+    unsigned hash; // the (mixed) hash of the word, compared before the word itself
+    unsigned row; // the row of the word vector in "vectors_" ("kEmptySlot" if the slot is empty)
+  };
+  struct LoadedData {
+  // The word vectors, norms, words and slots read from the word vector file
+  // (all of them stay empty if a snapshot is mapped instead).
+    std::vector<double> vectors, norms;
+    std::vector<uint16_t> half_vectors;
+    std::vector<int8_t> int8_vectors;
+    std::vector<float> scales;
+    std::string words;
+    std::vector<size_t> word_offsets;
+    std::vector<Slot> slots;
+    std::vector<Slot> old_slots; // the slots before the last growth while they are migrated to "slots" (see "GrowSlots()")
+    std::vector<size_t> offsets; // the offsets of the word vectors in the word vector file if they are parsed lazily
+  };
+  static const unsigned kEmptySlot = 0xFFFFFFFF;
+  HashTableOptions options_; // "precision" and "normalize" are taken from the snapshot if one is given instead of a word vector file; "max_load_factor" is limited to the supported range
+  const VocabularyFilter vocabulary_filter_;
+  LoadedData loaded_data_;
+  // The following members point to "loaded_data_" or into the mapped snapshot.
+  const double* vectors_; // the word vectors (the vector of row "r" starts at "vectors_[r*vector_size_]") if they are stored as doubles
+  const uint16_t* half_vectors_; // the word vectors if they are stored as fp16 values (see "vectors_")
+  const int8_t* int8_vectors_; // the word vectors if they are stored as int8 values (see "vectors_")
+  const float* scales_; // the scales of the int8 word vectors
+  const double* norms_; // the Euclidean norms of the word vectors (calculated once while loading them)
+  const char* words_; // the words (the word of row "r" starts at "words_[word_offsets_[r]]")
+  const size_t* word_offsets_; // contains one more element than there are rows
+  const Slot* slots_;
+  unsigned slot_mask_; // the number of slots minus 1 (the number of slots is a power of two)
+  unsigned num_of_rows_;
+  size_t num_of_migrated_slots_;
+  void* snapshot_; // the mapped snapshot (NULL if there is none)
+  size_t size_of_snapshot_;
+  // The members of lazy loading (see "lazy_loading.cc"):
+  bool is_lazy_;
+  void* mapped_vector_file_; // the word vector file the word vectors are parsed from
+  size_t size_of_mapped_vector_file_;
+  void* lazy_data_; // the (anonymously mapped) memory of the word vectors, norms and scales, which is only used for the word vectors parsed so far
+  size_t size_of_lazy_data_;
+  std::unique_ptr<std::atomic<bool>[]> row_is_parsed_;
+  std::atomic<unsigned> num_of_parsed_rows_;
+  std::mutex lazy_parsing_mutex_;
+  std::thread warm_up_thread_;
+  std::atomic<bool> warm_up_is_stopped_;
+  void SetPointersToLoadedData();
+  bool MapSnapshot(const std::string& snapshot_file, const bool check_word_vector_file);
+  bool MapVectorFile();
+  bool PrepareLazyParsing();
+  void ParseRows(const unsigned first_row, const unsigned end_row);
+  void ParseAllRows();
+  void StopLazyParsing();
+  int EstimateNumOfVectors();
+  bool ReadVectorFile(ThreadPool& thread_pool);
+  bool ReadChunk(std::istream& vector_file_stream, std::vector<char>& chunk, std::string& rest_of_last_line, std::vector<size_t>& binary_vectors, long long& num_of_vectors_left);
+  void ParseLines(const char* begin, const char* end_of_part, const char* end_of_chunk, ParsedLines& parsed_lines, const bool only_words = false);
+  void ParseBinaryVectors(const char* chunk, const size_t* begin, const size_t* end, ParsedLines& parsed_lines, const bool only_words = false);
+  void AddParsedVector(const char* word, const size_t length, std::vector<double>& vector, ParsedLines& parsed_lines);
+  void AddParsedWord(const char* word, const size_t length, ParsedLines& parsed_lines);
+  void StoreVectors(const ParsedLines& parsed_lines, const char* begin_of_chunk, const long long offset_of_chunk);
+  void GrowSlots();
+  void MigrateSlots(size_t num_of_slots);
+  unsigned GetSlotHash(const char* word, const size_t length);
+  unsigned GetProbeLength(const unsigned slot);
+  bool GetQuery(const std::string& line, Query& query, std::string& name);
+  void ScanNearestRows(const std::vector<Query>& queries, const int k, const Metric metric, ThreadPool& thread_pool, std::vector<std::vector<Neighbour>>& results);
+  void AnswerAnalogies(const std::vector<std::vector<unsigned>>& questions, const AnalogyMethod method, ThreadPool& thread_pool, std::vector<std::vector<unsigned>>& answers);
+
+  unsigned GetNumOfRows() {
+    return num_of_rows_;
+  }
+
+  void ParseRow(const unsigned row) {
+  // Parses the word vector of "row" if it is parsed lazily and has not been
+  // parsed yet.
+    if (is_lazy_ && !row_is_parsed_[row].load(std::memory_order_acquire))
+      ParseRows(row, row+1);
+  }
+
+  unsigned GetSlotHash(const std::string& word) {
+    return GetSlotHash(word.data(), word.length());
+  }
+
+  bool WordOfRowIs(const unsigned row, const char* word, const size_t length) {
+  // Checks if "word" (consisting of "length" characters) is the word of "row".
+    return (word_offsets_[row+1]-word_offsets_[row] == length && memcmp(words_+word_offsets_[row], word, length) == 0);
+  }
+
+  bool WordOfRowIs(const unsigned row, const std::string& word) {
+    return WordOfRowIs(row, word.data(), word.length());
+  }
+
+  void GetVectorOfRow(const unsigned row, double* vector) {
+  // Writes the values of the word vector of "row" as they are stored (i.e.
+  // unit-normalized if "options_.normalize" is set) to "vector".
+    const size_t offset = (size_t) row*vector_size_;
+    for (int i = 0; i < vector_size_; ++i)
+      vector[i] = (options_.precision == kInt8)? int8_vectors_[offset+i]*scales_[row] : ((options_.precision == kFloat16)? ConvertFromHalf(half_vectors_[offset+i]) : vectors_[offset+i]);
+  }
+
+  double GetDotProductWithRow(const double* vector, const unsigned row) {
+  // Returns the dot product of "vector" and the (original, i.e. not
+  // normalized) word vector of "row" (calculated directly on the quantized
+  // values if the word vectors are quantized).
+    const size_t offset = (size_t) row*vector_size_;
+    double dot_product;
+    if (options_.precision == kInt8)
+      dot_product = kSimilarityKernels.dot_product_f64_i8(vector, &int8_vectors_[offset], vector_size_)*scales_[row];
+    else if (options_.precision == kFloat16)
+      dot_product = kSimilarityKernels.dot_product_f64_f16(vector, &half_vectors_[offset], vector_size_);
+    else
+      dot_product = CalculateDotProduct(vector, &vectors_[offset], vector_size_);
+    return options_.normalize? dot_product*norms_[row] : dot_product;
+  }
+
+  double GetDotProductOfRows(const unsigned row_0, const unsigned row_1) {
+  // Returns the dot product of the (original, i.e. not normalized) word
+  // vectors of "row_0" and "row_1".
+    const size_t offset_0 = (size_t) row_0*vector_size_, offset_1 = (size_t) row_1*vector_size_;
+    double dot_product;
+    if (options_.precision == kInt8)
+      dot_product = (double) kSimilarityKernels.dot_product_i8(&int8_vectors_[offset_0], &int8_vectors_[offset_1], vector_size_)*scales_[row_0]*scales_[row_1];
+    else if (options_.precision == kFloat16)
+      dot_product = kSimilarityKernels.dot_product_f16(&half_vectors_[offset_0], &half_vectors_[offset_1], vector_size_);
+    else
+      dot_product = CalculateDotProduct(&vectors_[offset_0], &vectors_[offset_1], vector_size_);
+    return options_.normalize? dot_product*norms_[row_0]*norms_[row_1] : dot_product;
+  }
+
+ friend class HnswIndex;
+};
+
+struct HnswParameters {
+// Parameters of "HnswIndex" (see "main()" for the corresponding command line
+// options).
+  int m = 16; // the maximum number of links of a node per level (2*m on the lowest level)
+  int ef_construction = 200; // the size of the dynamic candidate list while building the index
+  int ef_search = 64; // the size of the dynamic candidate list while searching (at least "k")
+};
+
+class HnswIndex {
+// Approximate nearest neighbour index (Hierarchical Navigable Small World
+// graph) over the word vectors of a "HashTableOnMemory" (see
+// "hnsw_index.cc"). The index can be saved to a file and loaded again as long
+// as the words of the "HashTableOnMemory" do not change.
+ public:
+  HnswIndex(HashTableOnMemory& hash_table, const Metric metric, const HnswParameters& parameters = HnswParameters());
+  ~HnswIndex();
+  void Build(ThreadPool& thread_pool);
+  bool Save(const std::string& index_file);
+  bool Load(const std::string& index_file);
+  std::vector<Neighbour> Nearest(const std::string& word, const int k);
+  void ShowRecall(const int k, const int num_of_queries, ThreadPool& thread_pool);
+
+  Metric GetMetric() {
+    return metric_;
+  }
+
+ private:
+  struct VisitedList {
+  // Marks the nodes visited by a search ("marks[node] == generation").
+    std::vector<unsigned> marks;
+    unsigned generation;
+  };
+  typedef std::pair<double, unsigned> NodeDistance;
+  HashTableOnMemory& hash_table_;
+  const Metric metric_;
+  const HnswParameters parameters_;
+  const unsigned num_of_nodes_, max_links_, max_links_of_level_0_;
+  std::vector<int> levels_; // the highest level of every node
+  std::vector<unsigned> links_of_level_0_; // "max_links_of_level_0_"+1 values per node: the number of links followed by the links
+  std::vector<std::vector<unsigned>> links_of_upper_levels_; // "max_links_"+1 values per node and level above 0
+  std::unique_ptr<std::mutex[]> node_mutexes_; // protect the links of the nodes while building the index
+  std::mutex entry_point_mutex_;
+  unsigned entry_point_;
+  int max_level_;
+  bool building_;
+  std::vector<std::unique_ptr<VisitedList>> free_visited_lists_;
+  std::mutex visited_lists_mutex_;
+  void Insert(const unsigned node);
+  template <typename Distance>
+  std::vector<NodeDistance> SearchLevel(const unsigned entry_point, const double distance_of_entry_point, const int ef, const int level, Distance distance);
+  template <typename Distance>
+  unsigned SearchGreedily(unsigned entry_point, const int from_level, const int to_level, Distance distance);
+  std::vector<unsigned> SelectNeighbours(std::vector<NodeDistance>& candidates, const unsigned max_num_of_neighbours);
+  void AddLink(const unsigned node, const unsigned new_neighbour, const int level);
+  std::vector<Neighbour> Search(const HashTableOnMemory::Query& query, const int k);
+  double GetDistance(const unsigned node_0, const unsigned node_1);
+  double GetDistance(const HashTableOnMemory::Query& query, const unsigned node);
+  double GetScore(const double distance);
+  unsigned long long GetChecksumOfWords();
+  VisitedList* GetVisitedList();
+  void ReleaseVisitedList(VisitedList* visited_list);
+
+  unsigned* GetLinks(const unsigned node, const int level) {
+  // Returns the links of "node" on "level" (the first value is the number of
+  // links).
+    return (level == 0)? &links_of_level_0_[(size_t) node*(max_links_of_level_0_+1)] : &links_of_upper_levels_[node][(level-1)*(max_links_+1)];
+  }
+
+ friend class HashTableOnMemory;
+};
+
+struct PqParameters {
+// Parameters of "PqTable" (see "main()" for the corresponding command line
+// options).
+  int num_of_subspaces = 0; // the number of subspaces (i.e. of bytes per encoded vector; 0 = a quarter of the vector size)
+  int num_of_centroids = 256; // the number of centroids per subspace (at most 256)
+  int sample_size = 20000; // the number of word vectors the codebooks are trained on
+};
+
+class PqTable {
+// Product-quantized table of word vectors (see "product_quantization.cc"): an
+// alternative to "HashTableOnMemory" for vocabularies too big to be stored in
+// full precision. Every word vector is encoded as one centroid per subspace
+// (i.e. in "num_of_subspaces" bytes); nearest neighbours are found with
+// asymmetric distance tables and may be re-ranked exactly with the vectors of
+// a hash table file. The table is stored in its own binary file format.
+ public:
+  PqTable(const PqParameters& parameters = PqParameters());
+  ~PqTable();
+  static bool IsPqFile(const std::string& file);
+  bool Build(const std::string& word_vector_file, ThreadPool& thread_pool);
+  bool Save(const std::string& pq_file);
+  bool Load(const std::string& pq_file, const std::string& word_vector_file = "");
+  void SetReranking(HashTableReader* reranking_table, const int shortlist_size);
+  std::vector<Neighbour> Nearest(const std::string& word, const int k, const Metric metric, ThreadPool& thread_pool);
+  void FindNearestNeighbours(std::istream& queries, std::ostream& out, const int k, const Metric metric, ThreadPool& thread_pool);
+
+  void ReportMemory();
+
+  bool PqTableIsValid() {
+    return (num_of_vectors_ > 0);
+  }
+  bool ScoresAreExact() const { // "false" if the scores are only approximated with the centroids (i.e. without re-ranking)
+    return (reranking_table_ != NULL);
+  }
+
+ private:
+  const PqParameters parameters_;
+  unsigned vector_size_, num_of_subspaces_, num_of_centroids_;
+  size_t num_of_vectors_;
+  long long size_of_word_vector_file_; // the size of the word vector file the table was built from (checked by "Load()")
+  std::vector<unsigned> subspace_offsets_; // the first dimension of every subspace (contains one more element than there are subspaces)
+  std::vector<float> centroids_; // the centroid "c" of subspace "s" starts at "centroids_[num_of_centroids_*subspace_offsets_[s]+c*(size of s)]"
+  std::vector<uint8_t> codes_; // the codes of the word vectors ("num_of_subspaces_" bytes per row)
+  std::vector<float> norms_; // the Euclidean norms of the (original) word vectors
+  std::string words_; // the words (see "HashTableOnMemory")
+  std::vector<size_t> word_offsets_;
+  std::vector<unsigned> slots_; // open addressing (linear probing) with slots containing rows ("kEmptySlot" if a slot is empty)
+  size_t slot_mask_;
+  HashTableReader* reranking_table_; // if not NULL, the candidates are re-ranked with the exact vectors of this hash table file
+  int shortlist_size_; // the number of candidates re-ranked (at least "k")
+  static const unsigned kEmptySlot = 0xFFFFFFFF;
+  void SetSubspaces(const int num_of_subspaces, const int num_of_centroids);
+  void TrainCodebook(const unsigned subspace, const std::vector<double>& sample, const size_t sample_size);
+  void Encode(const double* vector, uint8_t* code);
+  void Decode(const unsigned row, double* vector);
+  bool AddWord(const char* word, const size_t length);
+  void ResizeSlots(const size_t num_of_words);
+  int GetRow(const std::string& word);
+  bool GetQueryVector(const std::string& line, std::vector<double>& query_vector, int& excluded_row, std::string& name);
+  std::vector<Neighbour> Search(const std::vector<double>& query_vector, const int excluded_row, const int k, const Metric metric, ThreadPool& thread_pool);
+
+  unsigned GetSizeOfSubspace(const unsigned subspace) {
+    return subspace_offsets_[subspace+1]-subspace_offsets_[subspace];
+  }
+
+  const float* GetCentroid(const unsigned subspace, const unsigned centroid) {
+    return &centroids_[(size_t) num_of_centroids_*subspace_offsets_[subspace]+centroid*GetSizeOfSubspace(subspace)];
+  }
+
+  std::string GetWordOfRow(const size_t row) {
+    return words_.substr(word_offsets_[row], word_offsets_[row+1]-word_offsets_[row]);
+  }
 };
 
 class HashTableWriter : public HashTable {
 // Class to create a hash table containing the word vectors of a given word
 // vector file and to write this hash table to a file.
  public:
-  HashTableWriter(const std::string& input_file, const std::string& output_file);
+  HashTableWriter(const std::string& input_file, const std::string& output_file, const HashTableWriterOptions& options = HashTableWriterOptions());
   ~HashTableWriter();
 
  private:
-  const std::string input_file_, output_file_;
+  const std::string input_file_, output_file_; // "output_file_" is a new delta segment if "options_.append" is set and a temporary file if "options_.compact" is set
+  HashTableWriterOptions options_; // "max_load_factor" is raised to the smallest one supported
+  const VocabularyFilter vocabulary_filter_;
+  MinimalPerfectHash minimal_perfect_hash_of_words_; // the buckets of the words if "options_.minimal_perfect_hash" is set
+  int num_of_empty_buckets_;
+  std::vector<int> num_of_buckets_per_length_; // the number of buckets containing "i" word vectors
+  long long bytes_written_; // the current size of "output_file_"
+  std::vector<long long> bucket_offsets_; // byte offsets of the buckets in "output_file_" (-1 if a bucket is empty)
   void CreateHashTable();
+  int CountFilteredVectors();
+  bool CreateHashTableOnMemory(std::ofstream& out);
+  bool CreateHashTableWithSpillFiles(std::ofstream& out, const long long input_file_size);
+  int GetNumOfSpillFiles(const long long input_file_size);
+  bool OpenSpillFiles(const int num_of_spill_files, std::vector<std::string>& spill_files, std::vector<std::ofstream>& spill_file_streams);
+  void WriteBucketsFromSpillFiles(std::ofstream& out, const std::vector<std::string>& spill_files, const bool lines_have_norms);
+  bool SetNumOfBuckets(const std::vector<std::string>* lines);
+  void WriteHeader(std::ofstream& out);
+  void WriteBuckets(std::ofstream& out, const std::vector<std::string>& lines, const int first_bucket, const int last_bucket, const bool lines_have_norms = false);
+  void WriteOffsetIndex();
+  std::string GetWordVectorWithNorm(const std::string& line);
+  bool CanBeAppended();
+  bool CompactHashTable(std::ofstream& out);
+  bool ReadDeltaSegments(std::unordered_map<std::string, std::string>& word_vectors_of_segments);
+  void MergeBuckets(std::ofstream& out, const std::unordered_map<std::string, std::string>& word_vectors_of_segments);
+  bool RebuildBuckets(std::ofstream& out, const std::unordered_map<std::string, std::string>& word_vectors_of_segments);
+  bool ReplaceHashTableFile();
+  static std::string GetOutputFile(const std::string& input_file, const std::string& output_file, const HashTableWriterOptions& options);
+
+  static void SplitBucketLine(const std::string& line, std::vector<std::string>& word_vectors) {
+  // Splits the "line" of a bucket of a hash table file into its "word_vectors".
+    std::stringstream stream_of_line(line);
+    std::string word_vector;
+    std::getline(stream_of_line, word_vector, ','); // skips the index of the bucket
+    while (std::getline(stream_of_line, word_vector, ','))
+      word_vectors.push_back(word_vector);
+  }
 
-  bool VectorInCurrentBucket(const std::string& line, const int bucket_num) {
-  // Returns "true" if the word vector fits into the current bucket and "false"
-  // if not. (Remember: If the vector file is designed in a way this program
-  // can work with, the "word" of a word vector is equal to all of the chars of
-  // a line up to the first whitespace (i.e. the first "node" of a line)).
-    return (bucket_num == GetIndex(line.substr(0, line.find_first_of(' '))));
+  int GetSpillFileOfBucket(const int bucket, const int num_of_spill_files) {
+  // Returns the spill file the lines of "bucket" are distributed to (every
+  // spill file gets the lines of a consecutive range of buckets).
+    return (long long) bucket*num_of_spill_files/hash_table_size_;
+  }
+
+  int GetBucketOfLine(const std::string& line) {
+  // Returns the index of the bucket the word vector of "line" belongs to.
+  // (Remember: If the vector file is designed in a way this program can work
+  // with, the "word" of a word vector is equal to all of the chars of a line
+  // up to the first whitespace (i.e. the first "node" of a line)).
+    return GetIndex(line.substr(0, line.find_first_of(' ')));
   }
 };
 
-class BinaryTree {
+class QueryServer {
+// Server answering requests for the word vectors of a "HashTableOnMemory" on a
+// Unix domain socket or a local TCP port (see "server.cc"), so that the word
+// vector file is loaded only once for many clients. The word vectors are not
+// changed while serving, so that requests are answered without locks.
  public:
-  BinaryTree();
-  ~BinaryTree();
-  void AddIndex(const unsigned index_to_add);
-  bool IndexIsAlreadyStored(const unsigned index_to_check_for);
+  QueryServer(HashTableOnMemory& hash_table, ThreadPool& thread_pool, const int num_of_workers = 0);
+  ~QueryServer();
+  int Serve(const std::string& address);
 
  private:
-  struct Node {
-    unsigned index;
-    Node* left;
-    Node* right;
-    Node(unsigned i) : index(i), left(NULL), right(NULL) {}
+  enum RequestType {
+    kSimilarityRequest,
+    kLookupRequest,
+    kNearestRequest,
+    kBatchRequest,
+    kOtherRequest,
+    kNumOfRequestTypes
   };
-  Node* root_ = NULL;
-  void DestroyTree(Node* current_node);
+  HashTableOnMemory& hash_table_;
+  ThreadPool& thread_pool_; // used by nearest neighbour and batch requests
+  ThreadPool workers_; // answer the requests (one request of a connection at a time)
+  LatencyHistogram latencies_[kNumOfRequestTypes];
+  int wake_up_pipe_[2]; // messages to "Serve()": answered or closed connections and stop requests
+  void AnswerRequest(const int connection);
+  std::string GetResponse(const std::string& request, RequestType& type);
+  std::string GetStatistics();
 };
 
+int StartClient(const std::string& address, const std::vector<std::string>& request);
+
 #endif // WORD_VECTOR_EVALUATION_WITH_HASH_TABLE_SRC_WVEWHT_H_